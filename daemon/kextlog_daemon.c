@@ -2,19 +2,44 @@
  * Created 190417 lynnl
  */
 
+#if !defined(__APPLE__) && !defined(_GNU_SOURCE)
+/* memmem(3) and CPU affinity of glibc */
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
 
 #include <sys/errno.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#ifdef __APPLE__
 #include <sys/sys_domain.h>
 #include <sys/kern_control.h>
-#include <sys/ioctl.h>
+#include <sys/sysctl.h>
+#include <sys/event.h>
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#else
+#include <sys/epoll.h>
+#include <sched.h>
+#endif
 
 #include "../kext/kextlog.h"
+#include "../kext/fmtpack.h"
+#include "../kext/hist.h"
+#include "../kext/evfilter.h"
+#include "../kext/hdrpack.h"
+#include "../kext/lzpack.h"
+#include "spsc.h"
+#include "segment.h"
 
 /*
  * Used to indicate unused function parameters
@@ -34,6 +59,28 @@
 
 #define BUILD_BUG_ON(cond)  UNUSED(sizeof(char[-!!(cond)]))
 
+#ifndef __APPLE__
+/*
+ * There's no kext elsewhere  such builds only exercise the receive pipeline
+ *  see: test/daemon_bench.c
+ */
+#define SYSPROTO_CONTROL    2
+
+static int sysctlbyname(const char *name, void *old, size_t *oldlen, void *new, size_t newlen)
+{
+    UNUSED(name, old, oldlen, new, newlen);
+    errno = ENOTSUP;
+    return -1;
+}
+
+static int connect_to_kctl(const char *name, int socktype)
+{
+    UNUSED(socktype);
+    LOG_ERR("no kernel control %s out of macOS", name);
+    errno = ENOTSUP;
+    return -1;
+}
+#else
 /**
  * Connect to a kernel control
  * @name        kernel control name
@@ -103,65 +150,1235 @@ out_close:
     fd = -1;
     goto out_exit;
 }
+#endif
 
 /*
  * User space read buffer should over commit 25% from ctl_recvsize
  * see: xnu/bsd/kern/kern_control.c#ctl_rcvbspace
  *
  * Generally speaking: use more buffer in user space
+ * Sized from kextlog.kctl.recvsize  fallback to below if unavailable
  */
 #define BUFFER_SIZE     24576       /* 8192 * 3 */
 
-static char buffer[BUFFER_SIZE];
+static char *buffer = NULL;
+static size_t buffer_size = 0;
 
-static void read_log_from_kctl(int fd)
+/* Wire format negotiated  see: KEXTLOG_SOCKOPT_WIRE */
+static uint32_t wire = KEXTLOG_WIRE_V1;
+/* Mirror of kext's thread dictionary  V3 only */
+static struct hdrpack_dict dict;
+
+/* Nonzero if kext frames and compresses batches  see: KEXTLOG_SOCKOPT_COMPRESS */
+static uint32_t compress = 0;
+/* Records decompressed from a frame */
+static char *unlz = NULL;
+
+/**
+ * Allocate read buffer according to kctl receive buffer size
+ * @return      0 if success  -1 otherwise
+ */
+static int buffer_alloc(void)
 {
-    struct kextlog_msghdr *m;
-    ssize_t n;
+    uint32_t recvsize = 0;
+    size_t sz = sizeof(recvsize);
+
+    if (sysctlbyname("kextlog.kctl.recvsize", &recvsize, &sz, NULL, 0) == 0 && recvsize != 0) {
+        buffer_size = (size_t) recvsize + recvsize / 4;
+    } else {
+        LOG_WARN("cannot get kextlog.kctl.recvsize  errno: %d", errno);
+        buffer_size = BUFFER_SIZE;
+    }
+
+    buffer = malloc(buffer_size);
+    if (buffer == NULL) {
+        LOG_ERR("malloc(3) fail  size: %zu errno: %d", buffer_size, errno);
+        return -1;
+    }
+
+    unlz = malloc(buffer_size);
+    if (unlz == NULL) {
+        LOG_ERR("malloc(3) fail  size: %zu errno: %d", buffer_size, errno);
+        free(buffer);
+        buffer = NULL;
+        return -1;
+    }
+
+    LOG_DBG("read buffer size: %zu", buffer_size);
+    return 0;
+}
+
+/*
+ * Pipeline stages  each runs on its own thread
+ *  receive: drains kctl socket into raw buffers
+ *  decode:  reassembles frames  decompresses and unpacks records into V1 layout
+ *  render:  checks seq  formats records into text
+ *  write:   writes text out
+ *  persist: appends records to segment files  only if asked  fed by render stage
+ * Adjacent stages are connected by a channel  see: spsc.h
+ */
+#define STAGE_RECEIVE   0
+#define STAGE_DECODE    1
+#define STAGE_RENDER    2
+#define STAGE_WRITE     3
+#define STAGE_PERSIST   4
+#define STAGE_NR        5
+
+static const char *stage_names[STAGE_NR] = {"receive", "decode", "render", "write", "persist"};
+/* CPU each stage pinned to  -1 if not pinned */
+static int stage_cpu[STAGE_NR] = {-1, -1, -1, -1, -1};
+
+#define CHAN_NBUF       8           /* Power of 2 */
+#define CHAN_BUFMUL     4           /* Raw and record buffer size in read buffer sizes */
+#define OUT_BUFSZ       262144
+
+static struct chan ch_rx;           /* receive -> decode  raw reads */
+static struct chan ch_dec;          /* decode -> render  records 8-byte aligned */
+static struct chan ch_out;          /* render -> write  text */
+static struct chan ch_seg;          /* render -> persist  copy of records decoded */
+
+static struct chan_buf *dec_buf = NULL;     /* Being filled by decode stage */
+static struct chan_buf *out_buf = NULL;     /* Being filled by render stage */
+
+static const char *seg_dir = NULL;  /* Segment directory  NULL if not persisting */
+static uint64_t seg_size = SEG_SIZE_DEFAULT;
+static uint32_t seg_secs = 0;
+static uint32_t seg_sync = SEG_SYNC_NONE;
+static uint32_t seg_sync_ms = 0;
+static struct segw segw;
+static uint64_t seg_errors = 0;
+
+static int quiet = 0;               /* Nonzero if records aren't printed */
+
+/**
+ * Append text to render stage output  a line longer than a whole buffer is truncated
+ */
+static void out_printf(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+static void out_printf(const char *fmt, ...)
+{
+    va_list ap;
+    size_t room;
+    int n;
+
+    if (out_buf == NULL) out_buf = chan_get(&ch_out);
+
+    room = ch_out.bufsz - out_buf->used;
+    va_start(ap, fmt);
+    n = vsnprintf(out_buf->data + out_buf->used, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+
+    if ((size_t) n >= room && out_buf->used != 0) {
+        /* Retry on an empty buffer */
+        chan_put(&ch_out, out_buf);
+        out_buf = chan_get(&ch_out);
+        room = ch_out.bufsz;
+        va_start(ap, fmt);
+        n = vsnprintf(out_buf->data, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+    }
+
+    out_buf->used += (size_t) n < room ? (size_t) n : room - 1;
+}
+
+#define OUT(fmt, ...)       out_printf(fmt "\n", ##__VA_ARGS__)
+
+/*
+ * Format strings defined by kext  keyed by format id
+ * Used to render binary messages
+ */
+#define FMTDICT_SIZE    4096        /* Power of 2 */
+
+struct fmtdict_entry {
+    uint64_t id;
+    char *fmt;
+};
+
+static struct fmtdict_entry fmtdict[FMTDICT_SIZE];
+
+static struct fmtdict_entry *fmtdict_slot(uint64_t id)
+{
+    uint32_t h = (uint32_t) (id >> 3) * 2654435761u;
+    struct fmtdict_entry *e;
+    uint32_t i;
+
+    for (i = 0; i < FMTDICT_SIZE; i++) {
+        e = &fmtdict[(h + i) & (FMTDICT_SIZE - 1)];
+        if (e->fmt == NULL || e->id == id) return e;
+    }
+
+    return NULL;
+}
+
+static void fmt_define(const struct kextlog_msghdr *m)
+{
+    struct fmtdict_entry *e;
+    uint64_t id;
+    char *fmt;
+
+    if (m->size <= sizeof(struct kextlog_binmsg) || m->buffer[m->size - 1] != '\0') {
+        LOG_ERR("malformed format definition  sz: %u", m->size);
+        return;
+    }
+
+    /* Records are packed back-to-back  fields may misaligned */
+    (void) memcpy(&id, m->buffer, sizeof(id));
+
+    e = fmtdict_slot(id);
+    if (e == NULL) {
+        LOG_ERR("format dictionary full  id: %#llx", id);
+        return;
+    }
+
+    fmt = strdup(m->buffer + sizeof(struct kextlog_binmsg));
+    if (fmt == NULL) {
+        LOG_ERR("strdup(3) fail  errno: %d", errno);
+        return;
+    }
+
+    free(e->fmt);
+    e->id = id;
+    e->fmt = fmt;
+}
+
+#define RENDER_BUFSZ    65536
+
+static void render_binary(const struct kextlog_msghdr *m)
+{
+    static char buf[RENDER_BUFSZ];
+    struct fmtdict_entry *e;
+    uint64_t id;
+    int n;
+
+    if (m->size < sizeof(struct kextlog_binmsg)) {
+        LOG_ERR("malformed binary message  sz: %u", m->size);
+        return;
+    }
+
+    (void) memcpy(&id, m->buffer, sizeof(id));
+
+    e = fmtdict_slot(id);
+    if (e == NULL || e->fmt == NULL) {
+        LOG_WARN("undefined format id %#llx  message skipped", id);
+        return;
+    }
+
+    n = fmtpack_render(buf, sizeof(buf), e->fmt,
+                        m->buffer + sizeof(struct kextlog_binmsg),
+                        m->size - sizeof(struct kextlog_binmsg));
+    if (n < 0) {
+        LOG_ERR("malformed binary message  fmt: %s", e->fmt);
+        return;
+    }
+
+    OUT("%s%s\n", buf, n >= (int) sizeof(buf) ? "(truncated)" : "");
+}
+
+/*
+ * Loss accounting
+ *  seq gaps denote records lost between kext and us
+ *  drop reports carry cumulative per-level drop counts since kext loaded
+ *  the first report after connected is taken as baseline
+ */
+static uint64_t next_seq = 0;
+static int seq_started = 0;
+static uint64_t seq_gaps = 0;
+static uint64_t received[KEXTLOG_NLEVEL];
+static struct kextlog_dropmsg drop_base;
+static struct kextlog_dropmsg drop_last;
+static int drop_seen = 0;
+
+static const char *level_names[KEXTLOG_NLEVEL] = {"trace", "debug", "info", "warning", "error"};
+
+static void check_seq(const struct kextlog_msghdr *m)
+{
+    if (seq_started && m->seq != next_seq) {
+        if (m->seq > next_seq) {
+            seq_gaps += m->seq - next_seq;
+            LOG_WARN("%llu records missing  seq: %llu..%llu",
+                        m->seq - next_seq, next_seq, m->seq - 1);
+        } else {
+            LOG_WARN("seq went backwards  expected: %llu got: %llu", next_seq, m->seq);
+        }
+    }
+
+    seq_started = 1;
+    next_seq = m->seq + 1;
+}
+
+static void print_loss(void)
+{
+    uint64_t lost;
+    uint64_t total;
+    uint32_t i;
+
+    for (i = 0; i < KEXTLOG_NLEVEL; i++) {
+        lost = drop_last.dropped[i] - drop_base.dropped[i];
+        total = lost + received[i];
+        if (total == 0) continue;
+
+        OUT("loss  %-7s received: %llu dropped: %llu rate: %.4f%%",
+                level_names[i], received[i], lost, 100.0 * (double) lost / (double) total);
+    }
+
+    OUT("loss  seq gaps: %llu records", seq_gaps);
+}
+
+static void drop_report(const struct kextlog_msghdr *m)
+{
+    uint32_t i;
+
+    if (m->size < sizeof(struct kextlog_dropmsg)) {
+        LOG_ERR("drop report too short  size: %u", m->size);
+        return;
+    }
+
+    /* Message body may be misaligned in a batch */
+    (void) memcpy(&drop_last, m->buffer, sizeof(drop_last));
+
+    if (!drop_seen) {
+        drop_seen = 1;
+        drop_base = drop_last;
+        for (i = 0; i < KEXTLOG_NLEVEL; i++) {
+            if (drop_base.dropped[i] != 0) {
+                OUT("%llu %s messages dropped before connected", drop_base.dropped[i], level_names[i]);
+            }
+        }
+        return;
+    }
+
+    print_loss();
+}
+
+/**
+ * Handle a complete record  render stage
+ */
+static void handle_record(const struct kextlog_msghdr *m)
+{
+    if (m->_padding != _KEXTLOG_PADDING_MAGIC) {
+        LOG_ERR("bad message magic: %#x", m->_padding);
+        assert(m->_padding == _KEXTLOG_PADDING_MAGIC);
+    }
+
+    check_seq(m);
+
+    if (m->flags & KEXTLOG_FLAG_DROP_REPORT) {
+        drop_report(m);
+        return;
+    }
+
+    if (m->level < KEXTLOG_NLEVEL && !(m->flags & KEXTLOG_FLAG_FMT_DEFINE)) {
+        received[m->level]++;
+    }
+
+    if (m->flags & KEXTLOG_FLAG_FMT_DEFINE) {
+        fmt_define(m);
+    } else if (quiet) {
+        /* Counted and seq checked  that's all */
+    } else if (m->flags & KEXTLOG_FLAG_MSG_BINARY) {
+        render_binary(m);
+    } else {
+        OUT("%.*s\n", (int) m->size, m->buffer);
+    }
+}
+
+/* Records handed to render stage are 8-byte aligned */
+#define REC_ALIGN(n)        (((n) + 7) & ~(size_t) 7)
+
+/**
+ * Render records decoded  render stage
+ */
+static void render_records(const struct chan_buf *b)
+{
+    const struct kextlog_msghdr *m;
+    size_t i;
+    size_t concur;
+
+    for (i = 0, concur = 0; i < b->used; i += REC_ALIGN(sizeof(*m) + m->size), concur++) {
+        m = (const struct kextlog_msghdr *) (b->data + i);
+
+        if (!quiet) {
+            OUT("[%zu:%zu]  pid: %d tid: %#llx ts: %#llx level: %u flags: %#x sz: %u seq: %llu",
+                concur, i, m->pid, m->tid, m->timestamp, m->level, m->flags, m->size, m->seq);
+        }
+
+        handle_record(m);
+    }
+}
+
+/**
+ * Hand a record to render stage  decode stage
+ *  header and body are copied  so records of all wire formats look the same downstream
+ */
+static void emit_record(const struct kextlog_msghdr *m, const char *body)
+{
+    size_t need = REC_ALIGN(sizeof(*m) + m->size);
+    struct kextlog_msghdr *d;
+
+    if (need > ch_dec.bufsz) {
+        LOG_WARN("record too large  sz: %u", m->size);
+        return;
+    }
+
+    if (dec_buf != NULL && ch_dec.bufsz - dec_buf->used < need) {
+        chan_put(&ch_dec, dec_buf);
+        dec_buf = NULL;
+    }
+    if (dec_buf == NULL) dec_buf = chan_get(&ch_dec);
+
+    d = (struct kextlog_msghdr *) (dec_buf->data + dec_buf->used);
+    /* Records are packed back-to-back in a read  m may misaligned */
+    (void) memcpy(d, m, sizeof(*d));
+    (void) memcpy(d->buffer, body, m->size);
+    dec_buf->used += need;
+}
+
+/**
+ * Handle V2 records packed back-to-back  see: kext/hdrpack.h
+ */
+static void handle_packed(const char *buf, ssize_t n)
+{
+    struct hdrpack_state st;
+    struct kextlog_msghdr m;
+    const char *body;
     ssize_t i;
-    ssize_t concur;
+    int k;
 
-    while (1) {
-        n = read(fd, buffer, BUFFER_SIZE);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            LOG_ERR("read(2) fail  errno: %d", errno);
+    hdrpack_reset(&st);
+    for (i = 0; i < n; i += k) {
+        k = hdrpack_decode(&st, wire == KEXTLOG_WIRE_V3 ? &dict : NULL, buf + i, (size_t) (n - i), &m, &body);
+        if (k < 0) {
+            LOG_WARN("malformed V2 record  offset: %zd n: %zd", i, n);
+            break;
+        }
+        emit_record(&m, body);
+    }
+
+    if (i < n) {
+        LOG_WARN("%zd bytes left unread in buffer  n: %zd", n - i, n);
+    }
+}
+
+/**
+ * Handle records packed back-to-back  decode stage
+ */
+static void handle_records(const char *buf, ssize_t n)
+{
+    const struct kextlog_msghdr *m;
+    ssize_t i;
+
+    if (wire != KEXTLOG_WIRE_V1) {
+        handle_packed(buf, n);
+        return;
+    }
+
+    for (i = 0; i + (ssize_t) sizeof(*m) <= n; i += sizeof(*m) + m->size) {
+        m = (const struct kextlog_msghdr *) (buf + i);
+
+        if (i + (ssize_t) (sizeof(*m) + m->size) > n) {
+            LOG_WARN("message body(%u bytes) incomplete  n: %zd", m->size, n);
             break;
         }
-        /* If n != BUFFER_SIZE  it means an early socket read wakeup */
 
-        for (i = 0, concur = 0; i + (ssize_t) sizeof(*m) <= n; i += sizeof(*m) + m->size, concur++) {
-            m = (struct kextlog_msghdr *) (buffer + i);
+        emit_record(m, m->buffer);
+    }
+
+    if (i < n) {
+        LOG_WARN("%zd bytes left unread in buffer  n: %zd", n - i, n);
+    }
+}
+
+/**
+ * @return      1 if records in a frame add up to its length  0 otherwise
+ */
+static int frame_valid(const char *p, uint32_t len, uint32_t cnt)
+{
+    static struct hdrpack_dict scratch;
+    struct kextlog_msghdr m;
+    struct hdrpack_state st;
+    const char *body;
+    uint32_t i = 0;
+    int k;
+
+    if (wire != KEXTLOG_WIRE_V1) {
+        /* Validation must not touch the real dictionary */
+        hdrpack_reset(&st);
+        hdrpack_dict_reset(&scratch);
+        while (cnt-- != 0) {
+            k = hdrpack_decode(&st, wire == KEXTLOG_WIRE_V3 ? &scratch : NULL, p + i, len - i, &m, &body);
+            if (k < 0) return 0;
+            i += (uint32_t) k;
+        }
+        return i == len;
+    }
+
+    while (cnt-- != 0) {
+        if (len - i < sizeof(m)) return 0;
+        (void) memcpy(&m, p + i, sizeof(m));
+        if (m._padding != _KEXTLOG_PADDING_MAGIC || m.size > len - i - sizeof(m)) return 0;
+        i += sizeof(m) + m.size;
+    }
+
+    return i == len;
+}
+
+/**
+ * Validate a frame  decompress its payload if needed
+ * @p           payload of the frame
+ * @len         (OUT) bytes of records
+ * @return      records carried by the frame  NULL if it's invalid
+ */
+static const char *frame_open(const struct kextlog_frame *f, const char *p, uint32_t *len)
+{
+    *len = f->len;
+
+    if (f->raw_len != 0) {
+        if (f->raw_len > buffer_size) return NULL;
+        if (lzpack_decompress(p, f->len, unlz, buffer_size) != (int) f->raw_len) return NULL;
+        p = unlz;
+        *len = f->raw_len;
+    }
+
+    return frame_valid(p, *len, f->cnt) ? p : NULL;
+}
+
+/**
+ * Handle a datagram read from SOCK_DGRAM kctl
+ */
+static void handle_datagram(const char *buf, ssize_t n)
+{
+    struct kextlog_frame f;
+    const char *p;
+    uint32_t len;
+
+    if (!compress) {
+        handle_records(buf, n);
+        return;
+    }
+
+    /* A datagram holds exactly one frame */
+    if ((size_t) n < sizeof(f)) {
+        LOG_WARN("datagram too short for a frame  n: %zd", n);
+        return;
+    }
+    (void) memcpy(&f, buf, sizeof(f));
+    p = NULL;
+    if (f.magic == KEXTLOG_FRAME_MAGIC && f.len == (size_t) n - sizeof(f)) {
+        p = frame_open(&f, buf + sizeof(f), &len);
+    }
+    if (p == NULL) {
+        LOG_WARN("bad frame  magic: %#x len: %u raw_len: %u n: %zd", f.magic, f.len, f.raw_len, n);
+        return;
+    }
+    handle_records(p, len);
+}
+
+/*
+ * SOCK_STREAM framing  see: struct kextlog_frame
+ * A frame may span read(2) boundaries  bytes of a partial frame are kept
+ *  in the read buffer  and a corrupted stream is resynchronized on next frame magic
+ */
+static size_t stream_have = 0;
+static size_t stream_skipped = 0;
+
+static void stream_parse(void)
+{
+    static const uint32_t magic = KEXTLOG_FRAME_MAGIC;
+    struct kextlog_frame f;
+    size_t off = 0;
+    const char *q;
+    const char *p;
+    uint32_t len;
+
+    while (stream_have - off >= sizeof(f)) {
+        (void) memcpy(&f, buffer + off, sizeof(f));
+
+        if (f.magic != magic || f.len > buffer_size - sizeof(f)) {
+            /* Lost sync  scan for next magic */
+            q = memmem(buffer + off + 1, stream_have - off - 1, &magic, sizeof(magic));
+            if (q == NULL) {
+                /* Keep tail bytes may be a partial magic */
+                stream_skipped += stream_have - off - (sizeof(magic) - 1);
+                off = stream_have - (sizeof(magic) - 1);
+                break;
+            }
+            stream_skipped += (size_t) (q - (buffer + off));
+            off = (size_t) (q - buffer);
+            continue;
+        }
+
+        if (stream_have - off - sizeof(f) < f.len) break;   /* Partial frame */
+
+        p = frame_open(&f, buffer + off + sizeof(f), &len);
+        if (p == NULL) {
+            stream_skipped += 1;
+            off += 1;
+            continue;
+        }
+
+        if (stream_skipped != 0) {
+            LOG_WARN("stream resynchronized  %zu bytes skipped", stream_skipped);
+            stream_skipped = 0;
+        }
+
+        handle_records(p, len);
+        off += sizeof(f) + f.len;
+    }
+
+    stream_have -= off;
+    (void) memmove(buffer, buffer + off, stream_have);
+}
+
+/**
+ * Feed bytes read from SOCK_STREAM kctl
+ */
+static void stream_feed(const char *data, size_t n)
+{
+    size_t k;
+
+    while (n != 0) {
+        if (stream_have == buffer_size) {
+            /* A frame never larger than kctl receive buffer  must be garbage */
+            LOG_WARN("read buffer full of garbage  %zu bytes discarded", stream_have);
+            stream_skipped += stream_have;
+            stream_have = 0;
+        }
+
+        k = buffer_size - stream_have;
+        if (k > n) k = n;
+        (void) memcpy(buffer + stream_have, data, k);
+        stream_have += k;
+        data += k;
+        n -= k;
+
+        stream_parse();
+    }
+}
+
+/* Receive stage statistics */
+static uint64_t rx_wakeups = 0;
+static uint64_t rx_reads = 0;
+
+/**
+ * Pin calling thread to the CPU configured for a stage
+ */
+static void stage_pin(int stage)
+{
+    int cpu = stage_cpu[stage];
+#ifdef __APPLE__
+    thread_affinity_policy_data_t policy;
+    kern_return_t kr;
+#else
+    cpu_set_t set;
+#endif
+
+    if (cpu < 0) return;
+
+#ifdef __APPLE__
+    /* xnu has no hard pinning  distinct affinity tags keep stages on distinct CPUs */
+    policy.affinity_tag = cpu + 1;
+    kr = thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY,
+                            (thread_policy_t) &policy, THREAD_AFFINITY_POLICY_COUNT);
+    if (kr != KERN_SUCCESS) {
+        LOG_WARN("cannot pin %s stage to CPU %d  kr: %#x", stage_names[stage], cpu, kr);
+    }
+#else
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        LOG_WARN("cannot pin %s stage to CPU %d", stage_names[stage], cpu);
+    }
+#endif
+}
+
+static void *decode_thread(void *arg)
+{
+    int stream = *(int *) arg;
+    struct chan_buf *b;
+    size_t off;
+    uint32_t i;
+
+    stage_pin(STAGE_DECODE);
+
+    while ((b = chan_recv(&ch_rx)) != NULL) {
+        if (stream) {
+            stream_feed(b->data, b->used);
+        } else {
+            for (i = 0, off = 0; i < b->nseg; off += b->seg[i], i++) {
+                handle_datagram(b->data + off, b->seg[i]);
+            }
+        }
+        chan_done(&ch_rx, b);
+
+        /* Don't hold records back till the buffer fills up */
+        if (dec_buf != NULL && dec_buf->used != 0) {
+            chan_put(&ch_dec, dec_buf);
+            dec_buf = NULL;
+        }
+    }
+
+    /* Buffer left is empty  push it anyway so render stage gets it back */
+    if (dec_buf != NULL) chan_put(&ch_dec, dec_buf);
+    chan_close(&ch_dec);
+    return NULL;
+}
+
+static void *render_thread(void *arg)
+{
+    struct chan_buf *b;
+    struct chan_buf *s;
+
+    UNUSED(arg);
+    stage_pin(STAGE_RENDER);
+
+    while ((b = chan_recv(&ch_dec)) != NULL) {
+        if (seg_dir != NULL) {
+            /* Records are persisted as they are  a single copy per buffer */
+            s = chan_get(&ch_seg);
+            (void) memcpy(s->data, b->data, b->used);
+            s->used = b->used;
+            chan_put(&ch_seg, s);
+        }
+
+        render_records(b);
+        chan_done(&ch_dec, b);
 
-            LOG("[%zd:%zd]  pid: %d tid: %#llx ts: %#llx level: %u flags: %#x sz: %u",
-                concur, i, m->pid, m->tid, m->timestamp, m->level, m->flags, m->size);
+        if (out_buf != NULL && out_buf->used != 0) {
+            chan_put(&ch_out, out_buf);
+            out_buf = NULL;
+        }
+    }
 
-            if (i + (ssize_t) (sizeof(*m) + m->size) > n) {
-                LOG_WARN("message body(%u bytes) incomplete  n: %zd", m->size, n);
+    if (out_buf != NULL) chan_put(&ch_out, out_buf);
+    chan_close(&ch_out);
+    if (seg_dir != NULL) chan_close(&ch_seg);
+    return NULL;
+}
+
+static void *write_thread(void *arg)
+{
+    struct chan_buf *b;
+    size_t off;
+    ssize_t n;
+
+    UNUSED(arg);
+    stage_pin(STAGE_WRITE);
+
+    while ((b = chan_recv(&ch_out)) != NULL) {
+        for (off = 0; off < b->used; off += (size_t) n) {
+            n = write(STDERR_FILENO, b->data + off, b->used - off);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    n = 0;
+                    continue;
+                }
+                /* Output gone  keep draining so upstream stages never stall */
                 break;
             }
+        }
+        chan_done(&ch_out, b);
+    }
+
+    return NULL;
+}
+
+static void *persist_thread(void *arg)
+{
+    const struct kextlog_msghdr *m;
+    struct chan_buf *b;
+    size_t i;
+    size_t len;
+    int urgent;
+    int timedout;
+
+    UNUSED(arg);
+    stage_pin(STAGE_PERSIST);
+
+    /* Wakes up for a periodic sync even if no record comes */
+    while ((b = chan_recv_timed(&ch_seg, segw_sync_due(&segw), &timedout)) != NULL || timedout) {
+        urgent = 0;
+
+        for (i = 0; b != NULL && i < b->used; i += len) {
+            m = (const struct kextlog_msghdr *) (b->data + i);
+            len = REC_ALIGN(sizeof(*m) + m->size);
+            if (segw_append(&segw, m, len) != 0 && seg_errors++ == 0) {
+                LOG_ERR("cannot persist record  seq: %llu errno: %d", (unsigned long long) m->seq, errno);
+            }
+            if (m->level >= KEXTLOG_LEVEL_WARNING && !(m->flags & KEXTLOG_FLAG_FMT_DEFINE)) urgent = 1;
+        }
+        if (b != NULL) chan_done(&ch_seg, b);
+
+        /* Nothing else queued  write out what we have rather than wait for a full buffer */
+        if (segw_commit(&segw, urgent, spsc_depth(&ch_seg.fwd) == 0) != 0 && seg_errors++ == 0) {
+            LOG_ERR("cannot write segment  seq: %llu errno: %d", (unsigned long long) segw.hdr.seq, errno);
+        }
+    }
+
+    segw_close(&segw);
+    return NULL;
+}
+
+/**
+ * @return      0 if success  -1 otherwise
+ */
+static int pipeline_init(void)
+{
+    size_t bufsz = buffer_size * CHAN_BUFMUL;
+
+    if (chan_init(&ch_rx, stage_names[STAGE_RECEIVE], CHAN_NBUF, bufsz) != 0 ||
+            chan_init(&ch_dec, stage_names[STAGE_DECODE], CHAN_NBUF, bufsz) != 0 ||
+            chan_init(&ch_out, stage_names[STAGE_RENDER], CHAN_NBUF, OUT_BUFSZ) != 0 ||
+            (seg_dir != NULL && chan_init(&ch_seg, stage_names[STAGE_PERSIST], CHAN_NBUF, bufsz) != 0)) {
+        LOG_ERR("cannot allocate pipeline buffers  errno: %d", errno);
+        return -1;
+    }
+
+    if (seg_dir != NULL && segw_init(&segw, seg_dir, seg_size, seg_secs, seg_sync, seg_sync_ms) != 0) {
+        LOG_ERR("cannot persist into %s  errno: %d", seg_dir, errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Print per-stage throughput and queue depth
+ * @secs        seconds pipeline ran
+ */
+static void pipeline_stat(double secs)
+{
+    const struct chan *chs[] = {&ch_rx, &ch_dec, &ch_out, &ch_seg};
+    const struct chan *ch;
+    size_t i;
+
+    if (secs <= 0) secs = 1e-9;
+
+    LOG("pipeline  %.3f s  wakeups: %llu reads: %llu", secs,
+        (unsigned long long) rx_wakeups, (unsigned long long) rx_reads);
+
+    for (i = 0; i < sizeof(chs) / sizeof(*chs); i++) {
+        ch = chs[i];
+        if (ch == &ch_seg && seg_dir == NULL) continue;
+        LOG("pipeline  %-7s -> bufs: %llu bytes: %llu  %.2f MiB/s  depth avg: %.2f max: %llu  stalls: %llu",
+            ch->name, (unsigned long long) ch->nbuf, (unsigned long long) ch->bytes,
+            (double) ch->bytes / secs / 1048576.0,
+            ch->nbuf ? (double) ch->depth_sum / (double) ch->nbuf : 0.0,
+            (unsigned long long) ch->depth_max, (unsigned long long) ch->stalls);
+    }
+
+    if (seg_dir != NULL) {
+        LOG("persist  records: %llu bytes: %llu  %.2f MiB/s  writes: %llu avg: %.0f KiB  segments: %llu errors: %llu",
+            (unsigned long long) segw.records, (unsigned long long) segw.bytes,
+            (double) segw.bytes / secs / 1048576.0, (unsigned long long) segw.writes,
+            segw.writes ? (double) segw.bytes / (double) segw.writes / 1024.0 : 0.0,
+            (unsigned long long) segw.segments, (unsigned long long) seg_errors);
+        LOG("persist  syncs: %llu errors: %llu  records/sync: %.1f  fsync p50: %llu us p99: %llu us p999: %llu us",
+            (unsigned long long) segw.syncs, (unsigned long long) segw.sync_errors,
+            segw.syncs ? (double) segw.sync_records / (double) segw.syncs : 0.0,
+            (unsigned long long) hist_quantile(&segw.sync_lat, 50, 100) / 1000,
+            (unsigned long long) hist_quantile(&segw.sync_lat, 99, 100) / 1000,
+            (unsigned long long) hist_quantile(&segw.sync_lat, 999, 1000) / 1000);
+    }
+}
+
+/**
+ * Wait until fd readable  kqueue(2) on macOS  epoll(7) elsewhere(for testing)
+ * @return      0 if success  -1 otherwise(errno will be set)
+ */
+static int poller_open(int fd)
+{
+    int q;
+#ifdef __APPLE__
+    struct kevent ev;
+
+    q = kqueue();
+    if (q < 0) return -1;
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+    if (kevent(q, &ev, 1, NULL, 0, NULL) == 0) return q;
+#else
+    struct epoll_event ev;
 
-            LOG("%.*s\n", (int) m->size, m->buffer);
+    q = epoll_create1(0);
+    if (q < 0) return -1;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(q, EPOLL_CTL_ADD, fd, &ev) == 0) return q;
+#endif
+
+    (void) close(q);
+    return -1;
+}
+
+/**
+ * @return      number of events  -1 if failed(errno will be set)
+ */
+static int poller_wait(int q)
+{
+#ifdef __APPLE__
+    struct kevent ev;
+    return kevent(q, NULL, 0, &ev, 1, NULL);
+#else
+    struct epoll_event ev;
+    return epoll_wait(q, &ev, 1, -1);
+#endif
+}
+
+/**
+ * Receive stage  runs on calling thread  returns once kctl closed or failed
+ *  and downstream stages drained
+ * @stream      nonzero if fd is SOCK_STREAM
+ */
+static void receive_loop(int fd, int stream)
+{
+    void *(*fns[STAGE_NR])(void *) = {NULL, decode_thread, render_thread, write_thread, persist_thread};
+    pthread_t th[STAGE_NR];
+    struct chan_buf *b = NULL;
+    struct timespec t0;
+    struct timespec t1;
+    size_t want;
+    ssize_t n;
+    int q;
+    int i;
+    int done = 0;
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+        LOG_ERR("fcntl(2) O_NONBLOCK fail  fd: %d errno: %d", fd, errno);
+        return;
+    }
+
+    q = poller_open(fd);
+    if (q < 0) {
+        LOG_ERR("cannot watch fd %d  errno: %d", fd, errno);
+        return;
+    }
+
+    if (seg_dir == NULL) fns[STAGE_PERSIST] = NULL;
+
+    for (i = STAGE_DECODE; i < STAGE_NR; i++) {
+        if (fns[i] == NULL) continue;
+        if (pthread_create(&th[i], NULL, fns[i], &stream) != 0) {
+            /* Threads started are blocked on empty channels forever  just bail out */
+            LOG_ERR("pthread_create(3) fail  stage: %s", stage_names[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    stage_pin(STAGE_RECEIVE);
+    (void) clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (!done) {
+        if (poller_wait(q) < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERR("poller wait fail  errno: %d", errno);
+            break;
+        }
+        rx_wakeups++;
 
-            if (m->_padding != _KEXTLOG_PADDING_MAGIC) {
-                LOG_ERR("bad message magic: %#x", m->_padding);
-                assert(m->_padding == _KEXTLOG_PADDING_MAGIC);
+        /* Drain everything pending */
+        while (1) {
+            if (b == NULL) b = chan_get(&ch_rx);
+
+            /* A datagram must fit in whole  or its tail is lost */
+            want = stream ? ch_rx.bufsz - b->used : buffer_size;
+            if (want == 0 || ch_rx.bufsz - b->used < want || b->nseg == CHAN_NSEG) {
+                chan_put(&ch_rx, b);
+                b = NULL;
+                continue;
             }
+
+            n = read(fd, b->data + b->used, want);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                LOG_ERR("read(2) fail  errno: %d", errno);
+                done = 1;
+                break;
+            }
+            if (n == 0) {
+                done = 1;
+                break;
+            }
+            rx_reads++;
+            b->seg[b->nseg++] = (uint32_t) n;
+            b->used += (size_t) n;
+        }
+
+        /* Hand over what we have  decode stage shouldn't wait for next wakeup */
+        if (b != NULL && b->used != 0) {
+            chan_put(&ch_rx, b);
+            b = NULL;
         }
+    }
+
+    if (b != NULL) chan_put(&ch_rx, b);
+    chan_close(&ch_rx);
+    for (i = STAGE_DECODE; i < STAGE_NR; i++) {
+        if (fns[i] != NULL) (void) pthread_join(th[i], NULL);
+    }
+    (void) clock_gettime(CLOCK_MONOTONIC, &t1);
+    (void) close(q);
 
-        if (i < n) {
-            LOG_WARN("%zd bytes left unread in buffer  n: %zd", n - i, n);
+    pipeline_stat((double) (t1.tv_sec - t0.tv_sec) + (double) (t1.tv_nsec - t0.tv_nsec) / 1e9);
+}
+
+/* Phases of log_printf() latency recorded by kext  see: kextlog.latency */
+static const char *latency_phases[] = {"format", "enqueue", "spin"};
+
+/**
+ * Print latency percentiles of log_printf() phases
+ * @return      0 if success  -1 otherwise
+ */
+static int print_latency(void)
+{
+    struct hist h;
+    char name[64];
+    size_t sz;
+    size_t i;
+
+    for (i = 0; i < sizeof(latency_phases) / sizeof(*latency_phases); i++) {
+        (void) snprintf(name, sizeof(name), "kextlog.latency.%s", latency_phases[i]);
+
+        sz = sizeof(h);
+        if (sysctlbyname(name, &h, &sz, NULL, 0) != 0) {
+            LOG_ERR("sysctlbyname(3) fail  name: %s errno: %d", name, errno);
+            return -1;
+        }
+        if (sz != sizeof(h)) {
+            LOG_ERR("histogram size mismatch  name: %s %zu vs %zu", name, sz, sizeof(h));
+            return -1;
         }
+
+        LOG("%-8s n: %llu p50: %llu ns p99: %llu ns p999: %llu ns",
+                latency_phases[i],
+                (unsigned long long) hist_total(&h),
+                (unsigned long long) hist_quantile(&h, 50, 100),
+                (unsigned long long) hist_quantile(&h, 99, 100),
+                (unsigned long long) hist_quantile(&h, 999, 1000));
+    }
+
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    LOG("Usage: %s [-l] [-S] [-z] [-q] [-w wire] [-c cpus] [-o dir [-R MiB] [-T secs] [-d sync]] [-m level] [-s scope_mask]", prog);
+    LOG("       [-p pid | -P pid]... [-u uid | -U uid]... [-a scope:action_mask]... [-f path_prefix]...");
+    LOG("    -l    print log_printf() latency percentiles and exit");
+    LOG("    -S    connect to the SOCK_STREAM kctl  records are framed");
+    LOG("    -z    ask kext to compress batches");
+    LOG("    -q    don't print records  loss is still reported");
+    LOG("    -c    pin receive,decode,render,write,persist stages to CPUs  e.g. 0,1,2,3  -1 leaves one unpinned");
+    LOG("    -w    ask for wire format  1(default)  2(compact) or 3(compact with thread dictionary)");
+    LOG("          falls back to an older one if kext doesn't support it");
+    LOG("    -o    persist records into binary segment files in the directory");
+    LOG("    -R    segment size in MiB  default %llu", SEG_SIZE_DEFAULT >> 20);
+    LOG("    -T    rotate a segment once it's older than secs  default never");
+    LOG("    -d    durability  none(default)  group(fsync once WARNING or ERROR records come)");
+    LOG("          or a period in ms(fsync at most once per period)");
+    LOG("    -m    receive messages at or above the level only  0(trace) to 4(error)");
+    LOG("    -s    receive messages of the scopes only  bit i denotes KEXTLOG_SCOPE i");
+    LOG("    -p    receive KAuth events of the pid only  -P to exclude the pid");
+    LOG("    -u    receive KAuth events of the uid only  -U to exclude the uid");
+    LOG("    -a    receive KAuth events of the actions only in the scope");
+    LOG("    -f    receive KAuth events on paths start with the prefix only");
+}
+
+/**
+ * Add an item of an event filter option
+ * @return      0 if success  -1 otherwise
+ */
+static int evfilter_add(struct evfilter *f, int ch, const char *arg)
+{
+    char *end;
+    unsigned long scope;
+
+    switch (ch) {
+    case 'p':
+    case 'P':
+        if (f->npid == EVFILTER_NPID) return -1;
+        if (f->npid != 0 && !!(f->flags & EVFILTER_F_PID_EXCLUDE) != (ch == 'P')) return -1;
+        if (ch == 'P') f->flags |= EVFILTER_F_PID_EXCLUDE;
+        f->pids[f->npid++] = (int32_t) strtol(arg, NULL, 0);
+        break;
+    case 'u':
+    case 'U':
+        if (f->nuid == EVFILTER_NUID) return -1;
+        if (f->nuid != 0 && !!(f->flags & EVFILTER_F_UID_EXCLUDE) != (ch == 'U')) return -1;
+        if (ch == 'U') f->flags |= EVFILTER_F_UID_EXCLUDE;
+        f->uids[f->nuid++] = (uint32_t) strtoul(arg, NULL, 0);
+        break;
+    case 'a':
+        scope = strtoul(arg, &end, 0);
+        if (*end != ':' || scope >= EVFILTER_NSCOPE) return -1;
+        f->action_mask[scope] = (uint32_t) strtoul(end + 1, NULL, 0);
+        break;
+    case 'f':
+        if (f->npath == EVFILTER_NPATH || strlen(arg) >= EVFILTER_PATH_MAX) return -1;
+        (void) strcpy(f->paths[f->npath++], arg);
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Parse a comma separated CPU list  one per stage in pipeline order
+ * @return      0 if success  -1 otherwise
+ */
+static int parse_cpus(const char *arg)
+{
+    char *end;
+    long cpu;
+    int i;
+
+    for (i = 0; i < STAGE_NR; i++) {
+        cpu = strtol(arg, &end, 0);
+        if (end == arg || cpu < -1 || cpu > 1023) return -1;
+        stage_cpu[i] = (int) cpu;
+        if (*end == '\0') return 0;
+        if (*end != ',') return -1;
+        arg = end + 1;
     }
+
+    return -1;
+}
+
+/**
+ * Parse a durability mode  none  group or a period in milliseconds
+ * @return      0 if success  -1 otherwise
+ */
+static int parse_sync(const char *arg)
+{
+    char *end;
+    unsigned long ms;
+
+    if (strcmp(arg, "none") == 0) {
+        seg_sync = SEG_SYNC_NONE;
+    } else if (strcmp(arg, "group") == 0) {
+        seg_sync = SEG_SYNC_GROUP;
+    } else {
+        ms = strtoul(arg, &end, 0);
+        if (end == arg || *end != '\0' || ms == 0 || ms > UINT32_MAX) return -1;
+        seg_sync = SEG_SYNC_PERIODIC;
+        seg_sync_ms = (uint32_t) ms;
+    }
+
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    UNUSED(argc, argv);
+    struct kextlog_filter filter = {KEXTLOG_LEVEL_TRACE, KEXTLOG_SCOPE_ALL};
+    struct evfilter evf;
+    int set_filter = 0;
+    int set_evf = 0;
+    int stream = 0;
+    uint32_t want = KEXTLOG_WIRE_V1;
+    int ch;
+
+    (void) memset(&evf, 0, sizeof(evf));
 
-    int fd = connect_to_kctl(KEXTLOG_KCTL_NAME, KEXTLOG_KCTL_SOCKTYPE);
+    while ((ch = getopt(argc, argv, "lSzqc:w:o:R:T:d:m:s:p:P:u:U:a:f:h")) != -1) {
+        switch (ch) {
+        case 'l':
+            return print_latency() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        case 'S':
+            stream = 1;
+            break;
+        case 'z':
+            compress = 1;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'o':
+            seg_dir = optarg;
+            break;
+        case 'R':
+            seg_size = (uint64_t) strtoull(optarg, NULL, 0) << 20;
+            if (seg_size < SEG_SIZE_MIN) {
+                LOG_ERR("bad segment size: %s", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            seg_secs = (uint32_t) strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            if (parse_sync(optarg) != 0) {
+                LOG_ERR("bad durability mode: %s", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            if (parse_cpus(optarg) != 0) {
+                LOG_ERR("bad CPU list: %s", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            want = (uint32_t) strtoul(optarg, NULL, 0);
+            if (want < KEXTLOG_WIRE_V1 || want > KEXTLOG_WIRE_V3) {
+                LOG_ERR("bad wire format: %s", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'm':
+            filter.level_min = (uint32_t) strtoul(optarg, NULL, 0);
+            set_filter = 1;
+            break;
+        case 's':
+            filter.scope_mask = (uint32_t) strtoul(optarg, NULL, 0);
+            set_filter = 1;
+            break;
+        case 'p':
+        case 'P':
+        case 'u':
+        case 'U':
+        case 'a':
+        case 'f':
+            if (evfilter_add(&evf, ch, optarg) != 0) {
+                LOG_ERR("bad or too many -%c: %s", ch, optarg);
+                return EXIT_FAILURE;
+            }
+            set_evf = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (buffer_alloc() != 0 || pipeline_init() != 0) return EXIT_FAILURE;
+
+    int fd = stream ? connect_to_kctl(KEXTLOG_KCTL_STREAM_NAME, SOCK_STREAM) :
+                      connect_to_kctl(KEXTLOG_KCTL_NAME, KEXTLOG_KCTL_SOCKTYPE);
     if (fd >= 0) {
-        read_log_from_kctl(fd);
+        /* Kext holds records until KEXTLOG_SOCKOPT_START  none of them predates the negotiation */
+        for (wire = want; wire > KEXTLOG_WIRE_V1; wire--) {
+            if (setsockopt(fd, SYSPROTO_CONTROL, KEXTLOG_SOCKOPT_WIRE, &wire, sizeof(wire)) == 0) break;
+            LOG_WARN("kext doesn't support wire format V%u  errno: %d", wire, errno);
+        }
+        LOG_DBG("wire format: V%u", wire);
+        if (compress && setsockopt(fd, SYSPROTO_CONTROL, KEXTLOG_SOCKOPT_COMPRESS, &compress, sizeof(compress)) != 0) {
+            LOG_WARN("kext doesn't support compression  errno: %d", errno);
+            compress = 0;
+        }
+        if (set_filter && setsockopt(fd, SYSPROTO_CONTROL, KEXTLOG_SOCKOPT_FILTER, &filter, sizeof(filter)) != 0) {
+            LOG_ERR("setsockopt(2) KEXTLOG_SOCKOPT_FILTER fail  fd: %d errno: %d", fd, errno);
+        }
+        if (set_evf && setsockopt(fd, SYSPROTO_CONTROL, KEXTLOG_SOCKOPT_EVFILTER, &evf, sizeof(evf)) != 0) {
+            LOG_ERR("setsockopt(2) KEXTLOG_SOCKOPT_EVFILTER fail  fd: %d errno: %d", fd, errno);
+        }
+        /* An old kext never holds records */
+        if (setsockopt(fd, SYSPROTO_CONTROL, KEXTLOG_SOCKOPT_START, NULL, 0) != 0 && errno != ENOPROTOOPT) {
+            LOG_ERR("setsockopt(2) KEXTLOG_SOCKOPT_START fail  fd: %d errno: %d", fd, errno);
+        }
+        receive_loop(fd, stream);
         (void) close(fd);
     }
     return fd >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
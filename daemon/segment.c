@@ -0,0 +1,360 @@
+/*
+ * Created 200114
+ */
+
+/* pwrite(2)  posix_fallocate(2)  clock_gettime(2) and PATH_MAX under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+#ifdef __APPLE__
+/* F_PREALLOCATE is hidden by _POSIX_C_SOURCE */
+#define _DARWIN_C_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "../kext/kextlog.h"
+#include "segment.h"
+
+/* sscanf(3) has no zero padding flag */
+#define SEG_NAME_SCAN           "kextlog-%llu.seg"
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void seg_timebase(struct seg_header *h)
+{
+    struct timespec rt;
+#ifdef __APPLE__
+    mach_timebase_info_data_t tb;
+
+    (void) mach_timebase_info(&tb);
+    h->timebase_numer = tb.numer;
+    h->timebase_denom = tb.denom;
+    h->mach_time = mach_absolute_time();
+#else
+    struct timespec mt;
+
+    /* No mach time  monotonic clock in nanoseconds stands in */
+    (void) clock_gettime(CLOCK_MONOTONIC, &mt);
+    h->timebase_numer = 1;
+    h->timebase_denom = 1;
+    h->mach_time = (uint64_t) mt.tv_sec * 1000000000ull + (uint64_t) mt.tv_nsec;
+#endif
+
+    (void) clock_gettime(CLOCK_REALTIME, &rt);
+    h->wall_ns = (uint64_t) rt.tv_sec * 1000000000ull + (uint64_t) rt.tv_nsec;
+}
+
+/**
+ * Reserve disk blocks of a segment up front  so appends never extend the file
+ * @return      0 if success  -1 otherwise(errno will be set)
+ */
+static int seg_prealloc(int fd, uint64_t size)
+{
+#ifdef __APPLE__
+    fstore_t fst = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t) size, 0};
+
+    if (fcntl(fd, F_PREALLOCATE, &fst) != 0) {
+        /* Fragmented is better than nothing */
+        fst.fst_flags = F_ALLOCATEALL;
+        if (fcntl(fd, F_PREALLOCATE, &fst) != 0) return -1;
+    }
+    return ftruncate(fd, (off_t) size);
+#else
+    int e = posix_fallocate(fd, 0, (off_t) size);
+
+    if (e != 0) {
+        errno = e;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+/**
+ * @return      largest segment number in dir  zero if none
+ */
+static uint64_t seg_last(const char *dir)
+{
+    DIR *d;
+    struct dirent *ent;
+    unsigned long long n;
+    uint64_t last = 0;
+
+    d = opendir(dir);
+    if (d == NULL) return 0;
+
+    while ((ent = readdir(d)) != NULL) {
+        if (sscanf(ent->d_name, SEG_NAME_SCAN, &n) == 1 && n > last) last = n;
+    }
+
+    (void) closedir(d);
+    return last;
+}
+
+/**
+ * Create next segment
+ * @return      0 if success  -1 otherwise(errno will be set)
+ */
+static int seg_open(struct segw *w)
+{
+    char path[PATH_MAX];
+    uint64_t seq = w->hdr.seq + 1;
+    int fd;
+    int e;
+
+    if (snprintf(path, sizeof(path), "%s/" SEG_NAME_FMT, w->dir, (unsigned long long) seq) >= (int) sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return -1;
+
+    if (seg_prealloc(fd, w->seg_size) != 0) goto out_fail;
+
+    (void) memset(&w->hdr, 0, sizeof(w->hdr));
+    w->hdr.magic = SEG_MAGIC;
+    w->hdr.version = SEG_VERSION;
+    w->hdr.header_size = SEG_HEADER_SIZE;
+    w->hdr.seq = seq;
+    w->hdr.size = w->seg_size;
+    seg_timebase(&w->hdr);
+
+    if (pwrite(fd, &w->hdr, sizeof(w->hdr), 0) != (ssize_t) sizeof(w->hdr)) goto out_fail;
+
+    w->fd = fd;
+    w->off = SEG_HEADER_SIZE;
+    w->opened = time(NULL);
+    w->segments++;
+    return 0;
+
+out_fail:
+    e = errno;
+    (void) close(fd);
+    (void) unlink(path);
+    errno = e;
+    return -1;
+}
+
+/**
+ * Write records buffered out  in one sequential write
+ * @return      0 if success  -1 otherwise(errno will be set)
+ *              records buffered are dropped either way
+ */
+int segw_flush(struct segw *w)
+{
+    size_t done = 0;
+    ssize_t n;
+    int e = 0;
+
+    while (done < w->wlen) {
+        n = pwrite(w->fd, w->wbuf + done, w->wlen - done, (off_t) (w->off + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            e = -1;
+            break;
+        }
+        done += (size_t) n;
+    }
+
+    if (w->wlen != 0) w->writes++;
+    w->off += done;
+    w->wlen = 0;
+    return e;
+}
+
+/**
+ * fsync(2) current segment  records written so far become durable
+ *  a kernel panic(the crash we care about most) doesn't lose what fsync(2) got to drive
+ *  F_FULLFSYNC would survive power loss too  at many times the cost
+ * @return      0 if success  -1 otherwise(errno will be set)
+ */
+static int seg_fsync(struct segw *w)
+{
+    uint64_t t0;
+    uint64_t t1;
+
+    t0 = mono_ns();
+    if (fsync(w->fd) != 0) {
+        /* Retry a period later  not in a busy loop */
+        w->last_sync = mono_ns();
+        w->sync_errors++;
+        return -1;
+    }
+    t1 = mono_ns();
+
+    hist_record(&w->sync_lat, t1 - t0);
+    w->syncs++;
+    w->sync_records += w->unsynced;
+    w->unsynced = 0;
+    w->last_sync = t1;
+    return 0;
+}
+
+/**
+ * Flush  record bytes used into header and close current segment
+ * @return      0 if success  -1 otherwise(errno will be set)
+ */
+static int seg_finish(struct segw *w)
+{
+    int e;
+
+    e = segw_flush(w);
+    w->hdr.used = w->off - SEG_HEADER_SIZE;
+    if (pwrite(w->fd, &w->hdr, sizeof(w->hdr), 0) != (ssize_t) sizeof(w->hdr)) e = -1;
+    if (w->sync_mode != SEG_SYNC_NONE && seg_fsync(w) != 0) e = -1;
+    (void) close(w->fd);
+    w->fd = -1;
+    /* Records failed to sync are as durable as they'll ever be */
+    w->unsynced = 0;
+
+    return e;
+}
+
+/**
+ * @dir         directory segments go  numbering continues from the last one in it
+ * @size        segment size
+ * @secs        max segment age in seconds  zero never rotates by time
+ * @mode        durability mode  SEG_SYNC_*
+ * @ms          sync period in milliseconds  SEG_SYNC_PERIODIC only
+ * @return      0 if success  -1 otherwise(errno will be set)
+ */
+int segw_init(struct segw *w, const char *dir, uint64_t size, uint32_t secs, uint32_t mode, uint32_t ms)
+{
+    struct stat st;
+
+    (void) memset(w, 0, sizeof(*w));
+    w->fd = -1;
+
+    if (stat(dir, &st) != 0) return -1;
+    if (!S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    if (strlen(dir) >= sizeof(w->dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (size < SEG_SIZE_MIN || mode > SEG_SYNC_GROUP || (mode == SEG_SYNC_PERIODIC && ms == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    w->wbuf = malloc(SEG_WBUF_SIZE);
+    if (w->wbuf == NULL) return -1;
+
+    (void) strcpy(w->dir, dir);
+    w->seg_size = size;
+    w->rotate_secs = secs;
+    w->sync_mode = mode;
+    w->sync_ns = (uint64_t) ms * 1000000ull;
+    w->last_sync = mono_ns();
+    w->hdr.seq = seg_last(dir);
+    return 0;
+}
+
+/**
+ * Append a record  rotates segment by size or age
+ * @rec         a struct kextlog_msghdr followed by its buffer  8-byte aligned length
+ * @return      0 if success  -1 otherwise(errno will be set)
+ */
+int segw_append(struct segw *w, const void *rec, size_t len)
+{
+    int e = 0;
+
+    if (len > w->seg_size - SEG_HEADER_SIZE) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    if (w->fd >= 0 && (w->off + w->wlen + len > w->seg_size ||
+            (w->rotate_secs != 0 && time(NULL) - w->opened >= (time_t) w->rotate_secs))) {
+        /* Rotate anyway  the next segment may do better */
+        e = seg_finish(w);
+    }
+    if (w->fd < 0 && seg_open(w) != 0) return -1;
+
+    if (w->wlen + len > SEG_WBUF_SIZE && segw_flush(w) != 0) e = -1;
+
+    if (len > SEG_WBUF_SIZE) {
+        /* Too large to buffer  write it through */
+        if (pwrite(w->fd, rec, len, (off_t) w->off) != (ssize_t) len) return -1;
+        w->off += len;
+        w->writes++;
+    } else {
+        (void) memcpy(w->wbuf + w->wlen, rec, len);
+        w->wlen += len;
+    }
+
+    w->records++;
+    w->unsynced++;
+    w->bytes += len;
+    return e;
+}
+
+/**
+ * Flush and fsync(2) records appended
+ * @return      0 if success  -1 otherwise(errno will be set)
+ */
+int segw_sync(struct segw *w)
+{
+    int e;
+
+    e = segw_flush(w);
+    if (w->fd >= 0 && w->unsynced != 0 && seg_fsync(w) != 0) e = -1;
+
+    return e;
+}
+
+/**
+ * @return      nanoseconds till next periodic sync  zero if overdue
+ *              UINT64_MAX if no sync pending
+ */
+uint64_t segw_sync_due(const struct segw *w)
+{
+    uint64_t at;
+    uint64_t now;
+
+    if (w->sync_mode != SEG_SYNC_PERIODIC || w->fd < 0 || w->unsynced == 0) return UINT64_MAX;
+
+    at = w->last_sync + w->sync_ns;
+    now = mono_ns();
+    return now >= at ? 0 : at - now;
+}
+
+/**
+ * Called once a batch of records appended  writes and syncs as durability mode asks
+ * @urgent      nonzero if the batch has a record should be durable at once(group commit)
+ * @idle        nonzero if no more records queued  so buffered ones shouldn't wait
+ * @return      0 if success  -1 otherwise(errno will be set)
+ */
+int segw_commit(struct segw *w, int urgent, int idle)
+{
+    if (w->sync_mode == SEG_SYNC_GROUP && urgent) return segw_sync(w);
+    if (segw_sync_due(w) == 0) return segw_sync(w);
+    return idle ? segw_flush(w) : 0;
+}
+
+void segw_close(struct segw *w)
+{
+    if (w->fd >= 0) (void) seg_finish(w);
+    free(w->wbuf);
+    w->wbuf = NULL;
+}
+
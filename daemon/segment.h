@@ -0,0 +1,105 @@
+/*
+ * Created 200114
+ *
+ * Binary segment files  records persisted as they came from kext
+ */
+
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+
+#include "../kext/hist.h"
+
+/*
+ * Segment file layout:
+ *  struct seg_header  padded to SEG_HEADER_SIZE
+ *  records  each a struct kextlog_msghdr followed by its buffer  8-byte aligned
+ *  zeros to the end of preallocated file
+ *
+ * A reader stops at the first record whose _padding isn't _KEXTLOG_PADDING_MAGIC
+ *  so a segment left by a crash is still readable up to its last record written
+ * Format definitions(KEXTLOG_FLAG_FMT_DEFINE) are sent once per connection
+ *  binary records may refer to ones in earlier segments  read them in order
+ */
+#define SEG_MAGIC               0x6765736b  /* Little-endian 'kseg' */
+#define SEG_VERSION             1
+#define SEG_HEADER_SIZE         4096
+#define SEG_NAME_FMT            "kextlog-%08llu.seg"
+
+#define SEG_SIZE_DEFAULT        (64ull << 20)
+#define SEG_SIZE_MIN            (1ull << 20)
+#define SEG_WBUF_SIZE           (1u << 20)      /* Writes are batched up to this size */
+
+/*
+ * Durability modes
+ *  a segment is always synced before closed  unless SEG_SYNC_NONE
+ */
+#define SEG_SYNC_NONE           0   /* Left to the OS */
+#define SEG_SYNC_PERIODIC       1   /* At most one fsync per period  only if anything appended */
+#define SEG_SYNC_GROUP          2   /* One fsync per batch has an urgent record  covers all records before it */
+
+struct seg_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;       /* Records start here */
+    uint32_t _reserved;
+    uint64_t seq;               /* Segment number */
+    uint64_t size;              /* Preallocated file size */
+    uint64_t used;              /* Bytes of records  zero if not closed cleanly */
+
+    /*
+     * Timebase  converts a record timestamp(mach_absolute_time) to wall clock:
+     *  wall_ns + (timestamp - mach_time) * numer / denom
+     */
+    uint32_t timebase_numer;
+    uint32_t timebase_denom;
+    uint64_t mach_time;         /* mach_absolute_time() at creation */
+    uint64_t wall_ns;           /* Nanoseconds since epoch at creation */
+};
+
+/*
+ * Segment writer  owned by a single thread
+ */
+struct segw {
+    char dir[PATH_MAX];
+    uint64_t seg_size;
+    uint32_t rotate_secs;       /* Zero never rotates by time */
+
+    int fd;                     /* -1 if no segment open */
+    struct seg_header hdr;
+    uint64_t off;               /* Next write offset */
+    time_t opened;
+
+    char *wbuf;
+    size_t wlen;
+
+    uint32_t sync_mode;
+    uint64_t sync_ns;           /* Period  SEG_SYNC_PERIODIC only */
+    uint64_t last_sync;         /* CLOCK_MONOTONIC nanoseconds */
+    uint64_t unsynced;          /* Records appended since last sync */
+
+    /* Statistics */
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t writes;
+    uint64_t segments;
+    uint64_t syncs;
+    uint64_t sync_records;      /* Records covered by syncs */
+    uint64_t sync_errors;
+    struct hist sync_lat;       /* fsync(2) latency in nanoseconds */
+};
+
+int segw_init(struct segw *, const char *, uint64_t, uint32_t, uint32_t, uint32_t);
+int segw_append(struct segw *, const void *, size_t);
+int segw_flush(struct segw *);
+int segw_sync(struct segw *);
+uint64_t segw_sync_due(const struct segw *);
+int segw_commit(struct segw *, int, int);
+void segw_close(struct segw *);
+
+#endif /* SEGMENT_H */
+
@@ -0,0 +1,252 @@
+/*
+ * Created 200113
+ *
+ * Lock-free single-producer single-consumer queue of pointers
+ *  and buffer channels built on top of it  used by daemon pipeline stages
+ */
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#define SPSC_CACHE_LINE     64
+
+struct spsc {
+    size_t mask;                /* Capacity - 1  capacity is power of 2 */
+    void **slot;
+    /* Producer and consumer indexes never share a cache line */
+    size_t tail __attribute__ ((aligned (SPSC_CACHE_LINE)));
+    size_t head __attribute__ ((aligned (SPSC_CACHE_LINE)));
+};
+
+/**
+ * @size        capacity  power of 2
+ * @return      0 if success  -1 otherwise
+ */
+static inline int spsc_init(struct spsc *q, size_t size)
+{
+    q->slot = calloc(size, sizeof(*q->slot));
+    if (q->slot == NULL) return -1;
+    q->mask = size - 1;
+    q->head = 0;
+    q->tail = 0;
+    return 0;
+}
+
+/**
+ * Called by producer only
+ * @return      0 if success  -1 if full
+ */
+static inline int spsc_push(struct spsc *q, void *p)
+{
+    size_t t = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    if (t - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask) return -1;
+    q->slot[t & q->mask] = p;
+    __atomic_store_n(&q->tail, t + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Called by consumer only
+ * @return      NULL if empty
+ */
+static inline void *spsc_pop(struct spsc *q)
+{
+    size_t h = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    void *p;
+
+    if (h == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) return NULL;
+    p = q->slot[h & q->mask];
+    __atomic_store_n(&q->head, h + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+/**
+ * @return      number of items queued  racy by nature
+ */
+static inline size_t spsc_depth(struct spsc *q)
+{
+    return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Back off while a queue stays empty(or full)
+ *  spin a while  then yield  then sleep briefly
+ */
+#define SPSC_SPIN           64
+#define SPSC_YIELD          128
+#define SPSC_SLEEP_NS       50000
+
+static inline void spsc_backoff(uint32_t *n)
+{
+    struct timespec ts = {0, SPSC_SLEEP_NS};
+
+    if (*n < SPSC_SPIN) {
+        __asm__ __volatile__ ("" ::: "memory");
+    } else if (*n < SPSC_YIELD) {
+        (void) sched_yield();
+    } else {
+        (void) nanosleep(&ts, NULL);
+    }
+    (*n)++;
+}
+
+/*
+ * Buffer channel between two pipeline stages
+ *  filled buffers flow forward  drained ones flow back  both are SPSC
+ *  a channel owns a fixed set of buffers  so producer waits once all in flight
+ */
+#define CHAN_NSEG           128         /* Max datagrams per buffer */
+
+struct chan_buf {
+    size_t used;
+    uint32_t nseg;
+    uint32_t seg[CHAN_NSEG];            /* Datagram lengths  receive channel only */
+    char data[0];
+} __attribute__ ((aligned (8)));
+
+struct chan {
+    const char *name;
+    struct spsc fwd;
+    struct spsc ret;
+    size_t bufsz;
+    volatile int closed;
+
+    /* Statistics  updated by producer */
+    uint64_t nbuf;                      /* Buffers pushed */
+    uint64_t bytes;                     /* Bytes pushed */
+    uint64_t depth_max;                 /* Max buffers queued seen */
+    uint64_t depth_sum;                 /* Sum of depths seen on push */
+    uint64_t stalls;                    /* Times producer waited for a buffer */
+};
+
+/**
+ * @nbuf        number of buffers  power of 2
+ * @return      0 if success  -1 otherwise
+ */
+static inline int chan_init(struct chan *ch, const char *name, size_t nbuf, size_t bufsz)
+{
+    struct chan_buf *b;
+    size_t i;
+
+    ch->name = name;
+    ch->bufsz = bufsz;
+    ch->closed = 0;
+    ch->nbuf = ch->bytes = ch->depth_max = ch->depth_sum = ch->stalls = 0;
+
+    if (spsc_init(&ch->fwd, nbuf) != 0 || spsc_init(&ch->ret, nbuf) != 0) return -1;
+
+    for (i = 0; i < nbuf; i++) {
+        b = malloc(sizeof(*b) + bufsz);
+        if (b == NULL) return -1;
+        (void) spsc_push(&ch->ret, b);
+    }
+
+    return 0;
+}
+
+/**
+ * Take an empty buffer  called by producer  waits if all in flight
+ */
+static inline struct chan_buf *chan_get(struct chan *ch)
+{
+    struct chan_buf *b;
+    uint32_t n = 0;
+
+    while ((b = spsc_pop(&ch->ret)) == NULL) {
+        if (n == 0) ch->stalls++;
+        spsc_backoff(&n);
+    }
+
+    b->used = 0;
+    b->nseg = 0;
+    return b;
+}
+
+/**
+ * Hand a filled buffer to consumer  never fails since a channel holds
+ *  no more buffers than the queue capacity
+ */
+static inline void chan_put(struct chan *ch, struct chan_buf *b)
+{
+    size_t depth;
+
+    (void) spsc_push(&ch->fwd, b);
+
+    depth = spsc_depth(&ch->fwd);
+    if (depth > ch->depth_max) ch->depth_max = depth;
+    ch->depth_sum += depth;
+    ch->nbuf++;
+    ch->bytes += b->used;
+}
+
+/**
+ * Take a filled buffer  called by consumer
+ * @return      NULL once the channel closed and drained
+ */
+static inline struct chan_buf *chan_recv(struct chan *ch)
+{
+    struct chan_buf *b;
+    uint32_t n = 0;
+
+    while ((b = spsc_pop(&ch->fwd)) == NULL) {
+        /* Check closed before popping again  so nothing pushed before close is missed */
+        if (__atomic_load_n(&ch->closed, __ATOMIC_ACQUIRE)) return spsc_pop(&ch->fwd);
+        spsc_backoff(&n);
+    }
+
+    return b;
+}
+
+/**
+ * chan_recv() giving up after a while
+ * @ns          max nanoseconds to wait  UINT64_MAX waits forever
+ * @timedout    set to nonzero if gave up
+ * @return      NULL if timed out  or the channel closed and drained
+ */
+static inline struct chan_buf *chan_recv_timed(struct chan *ch, uint64_t ns, int *timedout)
+{
+    struct chan_buf *b;
+    struct timespec t0;
+    struct timespec t1;
+    uint32_t n = 0;
+
+    *timedout = 0;
+    if (ns == UINT64_MAX) return chan_recv(ch);
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &t0);
+    while ((b = spsc_pop(&ch->fwd)) == NULL) {
+        if (__atomic_load_n(&ch->closed, __ATOMIC_ACQUIRE)) return spsc_pop(&ch->fwd);
+
+        (void) clock_gettime(CLOCK_MONOTONIC, &t1);
+        if ((uint64_t) (t1.tv_sec - t0.tv_sec) * 1000000000ull + (uint64_t) t1.tv_nsec - (uint64_t) t0.tv_nsec >= ns) {
+            *timedout = 1;
+            return NULL;
+        }
+        spsc_backoff(&n);
+    }
+
+    return b;
+}
+
+/**
+ * Give a drained buffer back to producer
+ */
+static inline void chan_done(struct chan *ch, struct chan_buf *b)
+{
+    (void) spsc_push(&ch->ret, b);
+}
+
+static inline void chan_close(struct chan *ch)
+{
+    __atomic_store_n(&ch->closed, 1, __ATOMIC_RELEASE);
+}
+
+#endif /* SPSC_H */
+
@@ -17,12 +17,19 @@ kern_return_t bsd_kext_log_start(kmod_info_t *ki, void *d)
 
     log_sysctl_register();
 
-    r = kauth_register();
+    r = log_kctl_init();
     if (r) goto out_exit;
 
+    r = kauth_register();
+    if (r) {
+        log_kctl_fini();
+        goto out_exit;
+    }
+
     r = log_kctl_register();
     if (r) {
         kauth_deregister();
+        log_kctl_fini();
         goto out_exit;
     }
 
@@ -39,6 +46,8 @@ kern_return_t bsd_kext_log_stop(kmod_info_t *ki, void *d)
     r = log_kctl_deregister();
     if (r == KERN_SUCCESS) {
         kauth_deregister();
+        /* All log_printf() callers gone since kauth deregistered */
+        log_kctl_fini();
         log_sysctl_deregister();
         util_massert();
     }
@@ -0,0 +1,105 @@
+/*
+ * Created 200111
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "evfilter.h"
+
+#define SORT_FN(name, type)                                         \
+static void name(type *a, uint32_t n)                               \
+{                                                                   \
+    uint32_t i, j;                                                  \
+    type v;                                                         \
+    for (i = 1; i < n; i++) {                                       \
+        v = a[i];                                                   \
+        for (j = i; j > 0 && a[j - 1] > v; j--) a[j] = a[j - 1];    \
+        a[j] = v;                                                   \
+    }                                                               \
+}
+
+#define SEARCH_FN(name, type)                                       \
+static int name(const type *a, uint32_t n, type v)                  \
+{                                                                   \
+    uint32_t lo = 0;                                                \
+    uint32_t hi = n;                                                \
+    uint32_t mid;                                                   \
+    while (lo < hi) {                                               \
+        mid = lo + (hi - lo) / 2;                                   \
+        if (a[mid] == v) return 1;                                  \
+        if (a[mid] < v) lo = mid + 1; else hi = mid;                \
+    }                                                               \
+    return 0;                                                       \
+}
+
+SORT_FN(sort_pid, int32_t)
+SORT_FN(sort_uid, uint32_t)
+SEARCH_FN(search_pid, int32_t)
+SEARCH_FN(search_uid, uint32_t)
+
+/**
+ * Validate a filter came from a client  and prepare it for evfilter_match()
+ * @return      0 if success  -1 if it's malformed
+ */
+int evfilter_prepare(struct evfilter *f)
+{
+    uint32_t i;
+
+    if (f->npid > EVFILTER_NPID || f->nuid > EVFILTER_NUID || f->npath > EVFILTER_NPATH) return -1;
+    if (f->flags & ~(EVFILTER_F_PID_EXCLUDE | EVFILTER_F_UID_EXCLUDE)) return -1;
+
+    for (i = 0; i < f->npath; i++) {
+        if (memchr(f->paths[i], '\0', EVFILTER_PATH_MAX) == NULL) return -1;
+    }
+
+    sort_pid(f->pids, f->npid);
+    sort_uid(f->uids, f->nuid);
+
+    return 0;
+}
+
+static int path_match(const struct evfilter *f, const char *path)
+{
+    const char *end;
+    uint32_t i;
+    size_t n;
+
+    for (i = 0; i < f->npath; i++) {
+        /* Bounded  f may be rewritten while we're reading */
+        end = memchr(f->paths[i], '\0', EVFILTER_PATH_MAX);
+        n = end != NULL ? (size_t) (end - f->paths[i]) : EVFILTER_PATH_MAX;
+        if (strncmp(path, f->paths[i], n) == 0) return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @return      1 if the event passes the filter  0 if filtered out
+ *              path prefixes are skipped if the event has no path(yet)
+ */
+int evfilter_match(const struct evfilter *f, const struct evfilter_event *ev)
+{
+    uint32_t mask;
+    uint32_t n;
+
+    if (ev->scope < EVFILTER_NSCOPE) {
+        mask = f->action_mask[ev->scope];
+        if (mask != 0 && !(mask & ev->action)) return 0;
+    }
+
+    n = f->npid < EVFILTER_NPID ? f->npid : EVFILTER_NPID;
+    if (n != 0 && search_pid(f->pids, n, ev->pid) == !!(f->flags & EVFILTER_F_PID_EXCLUDE)) return 0;
+
+    n = f->nuid < EVFILTER_NUID ? f->nuid : EVFILTER_NUID;
+    if (n != 0 && search_uid(f->uids, n, ev->uid) == !!(f->flags & EVFILTER_F_UID_EXCLUDE)) return 0;
+
+    if (f->npath != 0 && (ev->path != NULL || ev->path2 != NULL)) {
+        if (!(ev->path != NULL && path_match(f, ev->path)) &&
+            !(ev->path2 != NULL && path_match(f, ev->path2))) return 0;
+    }
+
+    return 1;
+}
+
@@ -0,0 +1,59 @@
+/*
+ * Created 200111
+ *
+ * Event filters pushed down by clients  evaluated before any formatting work
+ *
+ * This file has no kernel dependency  it's shared by kext and log daemon
+ */
+
+#ifndef EVFILTER_H
+#define EVFILTER_H
+
+#include <stdint.h>
+
+#define EVFILTER_NPID           16
+#define EVFILTER_NUID           8
+#define EVFILTER_NPATH          4
+#define EVFILTER_PATH_MAX       128     /* Including trailing `\0' */
+#define EVFILTER_NSCOPE         8
+
+/* pids[] is an exclude set  otherwise an include set */
+#define EVFILTER_F_PID_EXCLUDE  0x1
+/* uids[] is an exclude set  otherwise an include set */
+#define EVFILTER_F_UID_EXCLUDE  0x2
+
+/*
+ * An empty set(or zero mask) never filters anything out
+ *
+ * Path prefixes only apply to events carry a path
+ *  an event passes if any of its paths starts with any prefix
+ */
+struct evfilter {
+    uint32_t flags;
+    uint32_t npid;
+    uint32_t nuid;
+    uint32_t npath;
+    /* Indexed by scope  bit i denotes action i  vnode scope uses action bits as-is */
+    uint32_t action_mask[EVFILTER_NSCOPE];
+    int32_t pids[EVFILTER_NPID];
+    uint32_t uids[EVFILTER_NUID];
+    char paths[EVFILTER_NPATH][EVFILTER_PATH_MAX];
+};
+
+/*
+ * An event to filter  paths may be NULL if unavailable
+ */
+struct evfilter_event {
+    uint32_t scope;
+    uint32_t action;        /* Action bits  see: action_mask */
+    int32_t pid;
+    uint32_t uid;
+    const char *path;
+    const char *path2;
+};
+
+int evfilter_prepare(struct evfilter *);
+int evfilter_match(const struct evfilter *, const struct evfilter_event *);
+
+#endif /* EVFILTER_H */
+
@@ -0,0 +1,398 @@
+/*
+ * Created 200106
+ */
+
+#include <stdint.h>
+#include <string.h>
+#ifdef KERNEL
+#include <libkern/libkern.h>    /* snprintf() */
+#else
+#include <stdio.h>
+#endif
+
+#include "fmtpack.h"
+
+#define ARG_NONE        0       /* `%%' or unsupported conversion */
+#define ARG_INT         1
+#define ARG_WIDE        2
+#define ARG_PTR         3
+#define ARG_STR         4
+#define ARG_DBL         5
+
+#define LEN_NONE        0
+#define LEN_SHORT       1       /* h hh */
+#define LEN_WIDE        2       /* l ll q z j t */
+#define LEN_LDBL        3       /* L */
+
+/*
+ * A parsed conversion specification
+ *  %[flags][width][.precision][length]conversion
+ */
+struct fmtspec {
+    const char *lmod;           /* Start of length modifier */
+    const char *end;            /* One past conversion character */
+    int width_star;
+    int prec_star;
+    int len;
+    int type;
+    char conv;
+    char lmodc;                 /* First length modifier character */
+};
+
+/**
+ * Parse a conversion specification
+ * @p       points to a `%'
+ */
+static void fmt_parse(const char *p, struct fmtspec *sp)
+{
+    (void) memset(sp, 0, sizeof(*sp));
+
+    p++;
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'') p++;
+
+    if (*p == '*') {
+        sp->width_star = 1;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') p++;
+    }
+
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            sp->prec_star = 1;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') p++;
+        }
+    }
+
+    sp->lmod = p;
+    sp->lmodc = *p;
+    switch (*p) {
+    case 'h':
+        sp->len = LEN_SHORT;
+        p += p[1] == 'h' ? 2 : 1;
+        break;
+    case 'l':
+        sp->len = LEN_WIDE;
+        p += p[1] == 'l' ? 2 : 1;
+        break;
+    case 'q':
+    case 'z':
+    case 'j':
+    case 't':
+        sp->len = LEN_WIDE;
+        p++;
+        break;
+    case 'L':
+        sp->len = LEN_LDBL;
+        p++;
+        break;
+    default:
+        sp->lmodc = '\0';
+        break;
+    }
+
+    sp->conv = *p;
+    switch (*p) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+        sp->type = sp->len == LEN_WIDE ? ARG_WIDE : ARG_INT;
+        break;
+    case 'c':
+        sp->type = ARG_INT;
+        break;
+    case 'p':
+        sp->type = ARG_PTR;
+        break;
+    case 's':
+        sp->type = ARG_STR;
+        break;
+#ifndef KERNEL
+    /* Kernel printf() never support floating point */
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        sp->type = ARG_DBL;
+        break;
+#endif
+    default:
+        sp->type = ARG_NONE;
+        break;
+    }
+
+    /* Never step over the terminator */
+    sp->end = *p != '\0' ? p + 1 : p;
+}
+
+static inline void put(uint8_t *buf, size_t size, size_t *n, const void *v, size_t len)
+{
+    if (*n + len <= size) (void) memcpy(buf + *n, v, len);
+    *n += len;
+}
+
+static inline void put32(uint8_t *buf, size_t size, size_t *n, uint32_t v)
+{
+    put(buf, size, n, &v, sizeof(v));
+}
+
+static inline void put64(uint8_t *buf, size_t size, size_t *n, uint64_t v)
+{
+    put(buf, size, n, &v, sizeof(v));
+}
+
+/**
+ * Pack arguments of a format string
+ * @buf     output buffer  may be NULL if size is zero
+ * @size    output buffer size
+ * @fmt     printf-style format string
+ * @ap      arguments
+ * @return  number of bytes needed to pack all arguments
+ *          if it's larger than size  content of buf is unspecified
+ */
+size_t fmtpack_encode(void *buf, size_t size, const char *fmt, va_list ap)
+{
+    uint8_t *out = (uint8_t *) buf;
+    struct fmtspec sp;
+    const char *p = fmt;
+    const char *s;
+    size_t n = 0;
+    size_t len;
+    uint64_t v;
+#ifndef KERNEL
+    double d;
+#endif
+
+    while (*p != '\0') {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+
+        fmt_parse(p, &sp);
+        p = sp.end;
+
+        if (sp.width_star) put32(out, size, &n, (uint32_t) va_arg(ap, int));
+        if (sp.prec_star) put32(out, size, &n, (uint32_t) va_arg(ap, int));
+
+        switch (sp.type) {
+        case ARG_INT:
+            put32(out, size, &n, (uint32_t) va_arg(ap, int));
+            break;
+        case ARG_WIDE:
+            switch (sp.lmodc) {
+            case 'z':
+                v = (uint64_t) va_arg(ap, size_t);
+                break;
+            case 'j':
+                v = (uint64_t) va_arg(ap, intmax_t);
+                break;
+            case 't':
+                v = (uint64_t) va_arg(ap, ptrdiff_t);
+                break;
+            case 'l':
+                v = sp.lmod[1] == 'l' ? (uint64_t) va_arg(ap, long long) : (uint64_t) va_arg(ap, long);
+                break;
+            default:
+                v = (uint64_t) va_arg(ap, long long);
+                break;
+            }
+            put64(out, size, &n, v);
+            break;
+        case ARG_PTR:
+            put64(out, size, &n, (uint64_t) (uintptr_t) va_arg(ap, void *));
+            break;
+        case ARG_STR:
+            s = va_arg(ap, const char *);
+            if (s == NULL) {
+                put32(out, size, &n, FMTPACK_NULLSTR);
+            } else {
+                len = strlen(s);
+                put32(out, size, &n, (uint32_t) len);
+                put(out, size, &n, s, len + 1);
+            }
+            break;
+#ifndef KERNEL
+        case ARG_DBL:
+            if (sp.len == LEN_LDBL) {
+                d = (double) va_arg(ap, long double);
+            } else {
+                d = va_arg(ap, double);
+            }
+            put(out, size, &n, &d, sizeof(d));
+            break;
+#endif
+        default:
+            break;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Cursor over packed arguments
+ */
+struct argcur {
+    const uint8_t *p;
+    size_t left;
+};
+
+static inline int get(struct argcur *c, void *v, size_t len)
+{
+    if (c->left < len) return -1;
+    (void) memcpy(v, c->p, len);
+    c->p += len;
+    c->left -= len;
+    return 0;
+}
+
+/*
+ * Output cursor  keeps counting even if the buffer exhausted
+ *  like what snprintf() do
+ */
+struct outcur {
+    char *buf;
+    size_t size;
+    size_t n;
+};
+
+static inline void emit(struct outcur *o, const char *s, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++, o->n++) {
+        if (o->n + 1 < o->size) o->buf[o->n] = s[i];
+    }
+}
+
+#define EMITF(o, spec, ...) do {                                    \
+    char __dummy;                                                   \
+    int __r = snprintf((o)->n < (o)->size ? (o)->buf + (o)->n : &__dummy,   \
+                        (o)->n < (o)->size ? (o)->size - (o)->n : 0,        \
+                        spec, ##__VA_ARGS__);                       \
+    if (__r < 0) return -1;                                         \
+    (o)->n += (size_t) __r;                                         \
+} while (0)
+
+/*
+ * Emit a single conversion with optional `*' width and precision
+ */
+#define EMIT_CONV(o, sp, spec, w, pr, val) do {                     \
+    if ((sp)->width_star && (sp)->prec_star) {                      \
+        EMITF(o, spec, w, pr, val);                                 \
+    } else if ((sp)->width_star) {                                  \
+        EMITF(o, spec, w, val);                                     \
+    } else if ((sp)->prec_star) {                                   \
+        EMITF(o, spec, pr, val);                                    \
+    } else {                                                        \
+        EMITF(o, spec, val);                                        \
+    }                                                               \
+} while (0)
+
+/**
+ * Render packed arguments into a string
+ * @out     output buffer  always NUL-terminated if size is positive
+ * @size    output buffer size
+ * @fmt     the format string used to pack arguments
+ * @args    packed arguments
+ * @argsz   size of packed arguments
+ * @return  number of characters would have been written(excluding `\0')
+ *          -1 if packed arguments malformed
+ */
+int fmtpack_render(char *out, size_t size, const char *fmt, const void *args, size_t argsz)
+{
+    struct outcur o = {out, size, 0};
+    struct argcur c = {(const uint8_t *) args, argsz};
+    struct fmtspec sp;
+    const char *p = fmt;
+    const char *q;
+    char spec[32];
+    size_t i;
+    int32_t w = 0;
+    int32_t pr = 0;
+    int32_t iv;
+    uint64_t v;
+    uint32_t len;
+    const char *s;
+#ifndef KERNEL
+    double d;
+#endif
+
+    while (*p != '\0') {
+        for (q = p; *q != '\0' && *q != '%'; q++) continue;
+        emit(&o, p, (size_t) (q - p));
+        if (*q == '\0') break;
+
+        p = q;
+        fmt_parse(p, &sp);
+
+        if (sp.type == ARG_NONE || (size_t) (sp.end - p) + 2 > sizeof(spec)) {
+            if (sp.conv == '%') {
+                emit(&o, "%", 1);
+            } else {
+                /* Unsupported conversion  print it verbatim */
+                emit(&o, p, (size_t) (sp.end - p));
+            }
+            p = sp.end;
+            continue;
+        }
+
+        if (sp.width_star && get(&c, &w, sizeof(w)) != 0) return -1;
+        if (sp.prec_star && get(&c, &pr, sizeof(pr)) != 0) return -1;
+
+        /*
+         * Rebuild the specification  normalize length modifier
+         *  since kernel-only `q' isn't recognized everywhere
+         */
+        i = (size_t) (sp.lmod - p);
+        (void) memcpy(spec, p, i);
+        if (sp.type == ARG_WIDE) {
+            spec[i++] = 'l';
+            spec[i++] = 'l';
+        } else if (sp.type == ARG_INT && sp.len == LEN_SHORT) {
+            for (q = sp.lmod; q < sp.end - 1; q++) spec[i++] = *q;
+        }
+        spec[i++] = sp.conv;
+        spec[i] = '\0';
+
+        switch (sp.type) {
+        case ARG_INT:
+            if (get(&c, &iv, sizeof(iv)) != 0) return -1;
+            EMIT_CONV(&o, &sp, spec, w, pr, iv);
+            break;
+        case ARG_WIDE:
+            if (get(&c, &v, sizeof(v)) != 0) return -1;
+            EMIT_CONV(&o, &sp, spec, w, pr, (long long) v);
+            break;
+        case ARG_PTR:
+            if (get(&c, &v, sizeof(v)) != 0) return -1;
+            EMIT_CONV(&o, &sp, spec, w, pr, (void *) (uintptr_t) v);
+            break;
+        case ARG_STR:
+            if (get(&c, &len, sizeof(len)) != 0) return -1;
+            if (len == FMTPACK_NULLSTR) {
+                s = "(null)";
+            } else {
+                if (c.left < (size_t) len + 1 || c.p[len] != '\0') return -1;
+                s = (const char *) c.p;
+                c.p += len + 1;
+                c.left -= len + 1;
+            }
+            EMIT_CONV(&o, &sp, spec, w, pr, s);
+            break;
+#ifndef KERNEL
+        case ARG_DBL:
+            if (get(&c, &d, sizeof(d)) != 0) return -1;
+            EMIT_CONV(&o, &sp, spec, w, pr, d);
+            break;
+#endif
+        default:
+            break;
+        }
+
+        p = sp.end;
+    }
+
+    if (size != 0) out[o.n < size ? o.n : size - 1] = '\0';
+
+    return (int) o.n;
+}
+
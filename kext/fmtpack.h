@@ -0,0 +1,30 @@
+/*
+ * Created 200106
+ *
+ * Deferred printf-style formatting
+ *  kext packs raw arguments of a format string  user space renders them
+ *
+ * This file has no kernel dependency  it's shared by kext and log daemon
+ */
+
+#ifndef FMTPACK_H
+#define FMTPACK_H
+
+#include <stddef.h>
+#include <stdarg.h>
+
+/*
+ * Packed argument layout(native byte order  no alignment):
+ *  char, short, int and `*' width/precision    4 bytes
+ *  long, long long, size_t, intmax_t, pointer  8 bytes
+ *  double(user space only)                     8 bytes
+ *  string  4 bytes length followed by bytes and a trailing `\0'
+ *          NULL string has length FMTPACK_NULLSTR and no bytes
+ */
+#define FMTPACK_NULLSTR         0xffffffffu
+
+size_t fmtpack_encode(void *, size_t, const char *, va_list);
+int fmtpack_render(char *, size_t, const char *, const void *, size_t);
+
+#endif /* FMTPACK_H */
+
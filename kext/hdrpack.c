@@ -0,0 +1,194 @@
+/*
+ * Created 200112
+ */
+
+#include "hdrpack.h"
+
+static inline size_t put_varint(uint8_t *p, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t) v;
+
+    return n;
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/**
+ * @return      0 if success  -1 if truncated or overlong
+ */
+static inline int get_varint(const uint8_t *p, size_t len, size_t *i, uint64_t *v)
+{
+    uint64_t r = 0;
+    uint32_t shift = 0;
+    uint8_t b;
+
+    do {
+        if (*i >= len || shift > 63) return -1;
+        b = p[(*i)++];
+        r |= (uint64_t) (b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    *v = r;
+    return 0;
+}
+
+/**
+ * Encode pid and tid of a record with a thread dictionary
+ * @return      bytes written
+ */
+static size_t dict_encode(struct hdrpack_dict *d, const struct kextlog_msghdr *msg, uint8_t *p)
+{
+    /* Fibonacci hashing  low bits of a tid hardly spread */
+    uint32_t i = (uint32_t) ((msg->tid * 0x9e3779b97f4a7c15ull) >> 58);
+    size_t n;
+
+    if (d->tid[i] == msg->tid && d->pid[i] == msg->pid) {
+        p[0] = (uint8_t) (i << 1);
+        return 1;
+    }
+
+    d->tid[i] = msg->tid;
+    d->pid[i] = msg->pid;
+
+    p[0] = (uint8_t) (i << 1 | 1);
+    n = 1;
+    n += put_varint(p + n, zigzag(msg->pid));
+    n += put_varint(p + n, msg->tid);
+    return n;
+}
+
+/**
+ * Encode a record  header along with its message buffer
+ * @dict        thread dictionary  NULL if not used
+ * @out         at least HDRPACK_MAX + msg->size bytes
+ * @return      bytes written
+ */
+size_t hdrpack_encode(
+        struct hdrpack_state *st,
+        struct hdrpack_dict *dict,
+        const struct kextlog_msghdr *msg,
+        void *out)
+{
+    uint8_t *p = (uint8_t *) out;
+    size_t n = 0;
+
+    p[n++] = (uint8_t) ((msg->flags & 0x1f) << 3 | (msg->level & 0x7));
+    n += put_varint(p + n, msg->size);
+    n += put_varint(p + n, msg->scope);
+    if (dict != NULL) {
+        n += dict_encode(dict, msg, p + n);
+    } else {
+        n += put_varint(p + n, zigzag(msg->pid));
+        n += put_varint(p + n, zigzag((int64_t) (msg->tid - st->tid)));
+    }
+    n += put_varint(p + n, zigzag((int64_t) (msg->timestamp - st->timestamp)));
+    n += put_varint(p + n, zigzag((int64_t) (msg->seq - st->seq - 1)));
+
+    (void) memcpy(p + n, msg->buffer, msg->size);
+
+    st->tid = msg->tid;
+    st->timestamp = msg->timestamp;
+    st->seq = msg->seq;
+
+    return n + msg->size;
+}
+
+/**
+ * Decode pid and tid of a record with a thread dictionary
+ * @v           (OUT) zigzag pid and tid delta  as if there's no dictionary
+ * @return      0 if success  -1 if malformed
+ */
+static int dict_decode(
+        struct hdrpack_dict *d,
+        const struct hdrpack_state *st,
+        const uint8_t *p,
+        size_t len,
+        size_t *i,
+        uint64_t *v)
+{
+    uint64_t ref;
+    uint64_t tid;
+    uint32_t k;
+
+    if (get_varint(p, len, i, &ref) != 0 || (ref >> 1) >= HDRPACK_DICT_SIZE) return -1;
+    k = (uint32_t) (ref >> 1);
+
+    if (ref & 1) {
+        if (get_varint(p, len, i, &v[0]) != 0 || get_varint(p, len, i, &tid) != 0) return -1;
+        d->pid[k] = (int32_t) unzigzag(v[0]);
+        d->tid[k] = tid;
+    }
+
+    v[0] = zigzag(d->pid[k]);
+    v[1] = zigzag((int64_t) (d->tid[k] - st->tid));
+    return 0;
+}
+
+/**
+ * Decode a record
+ * @dict        thread dictionary  NULL if not used
+ * @hdr         decoded header  _padding is filled with the magic
+ * @body        points to message buffer within in
+ * @return      bytes consumed  -1 if malformed
+ */
+int hdrpack_decode(
+        struct hdrpack_state *st,
+        struct hdrpack_dict *dict,
+        const void *in,
+        size_t len,
+        struct kextlog_msghdr *hdr,
+        const char **body)
+{
+    const uint8_t *p = (const uint8_t *) in;
+    size_t i = 0;
+    uint64_t v[6];
+    int k;
+
+    if (len == 0) return -1;
+    hdr->level = p[i] & 0x7;
+    hdr->flags = p[i] >> 3;
+    i++;
+
+    for (k = 0; k < 6; k++) {
+        /* Fields 2 and 3 are pid and tid delta */
+        if (k == 2 && dict != NULL) {
+            if (dict_decode(dict, st, p, len, &i, v + k) != 0) return -1;
+            k++;
+            continue;
+        }
+        if (get_varint(p, len, &i, &v[k]) != 0) return -1;
+    }
+
+    if (v[0] > len - i || v[0] > INT32_MAX) return -1;
+
+    hdr->size = (uint32_t) v[0];
+    hdr->scope = (uint32_t) v[1];
+    hdr->pid = (int32_t) unzigzag(v[2]);
+    hdr->tid = st->tid + (uint64_t) unzigzag(v[3]);
+    hdr->timestamp = st->timestamp + (uint64_t) unzigzag(v[4]);
+    hdr->seq = st->seq + 1 + (uint64_t) unzigzag(v[5]);
+    hdr->_padding = _KEXTLOG_PADDING_MAGIC;
+    *body = (const char *) p + i;
+
+    st->tid = hdr->tid;
+    st->timestamp = hdr->timestamp;
+    st->seq = hdr->seq;
+
+    return (int) (i + hdr->size);
+}
+
@@ -0,0 +1,86 @@
+/*
+ * Created 200112
+ *
+ * Compact record header encoding(wire format v2)
+ *  fields are varint packed  timestamp  tid and seq are delta encoded
+ *  against the previous record of the same batch
+ *
+ * This file has no kernel dependency  it's shared by kext and log daemon
+ */
+
+#ifndef HDRPACK_H
+#define HDRPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "kextlog.h"
+
+/*
+ * Encoded record layout:
+ *  1 byte      flags << 3 | level  flags must fit in 5 bits
+ *  varint      size
+ *  varint      scope
+ *  zigzag      pid
+ *  zigzag      tid delta
+ *  zigzag      timestamp delta
+ *  zigzag      seq delta minus one  i.e. zero for consecutive records
+ *  size bytes  message buffer
+ *
+ * Each batch(datagram or stream frame) starts from a zeroed state
+ *  so a lost batch never corrupts its following ones
+ *
+ * With a thread dictionary(wire format V3)  pid and tid delta are replaced by
+ *  varint      slot << 1 | define
+ *  zigzag      pid  only if define
+ *  varint      tid  only if define
+ * A record whose thread already sits in its slot only refers to the slot
+ *  otherwise it defines the slot  decoder mirrors definitions it sees
+ */
+#define HDRPACK_MAX             48      /* Max encoded header size */
+
+/*
+ * Thread dictionary  lives as long as a connection
+ * Encoder picks a slot by tid hash  decoder never needs to know how
+ * Both ends start zeroed  and encoder must be reset once a batch lost
+ *  so no record refers to a definition never arrived
+ */
+#define HDRPACK_DICT_SIZE       64      /* Power of 2  slot << 1 fits in a byte */
+
+struct hdrpack_dict {
+    uint64_t tid[HDRPACK_DICT_SIZE];
+    int32_t pid[HDRPACK_DICT_SIZE];
+};
+
+struct hdrpack_state {
+    uint64_t tid;
+    uint64_t timestamp;
+    uint64_t seq;
+};
+
+static inline void hdrpack_reset(struct hdrpack_state *st)
+{
+    st->tid = 0;
+    st->timestamp = 0;
+    st->seq = (uint64_t) -1;
+}
+
+static inline void hdrpack_dict_reset(struct hdrpack_dict *d)
+{
+    (void) memset(d, 0, sizeof(*d));
+}
+
+size_t hdrpack_encode(struct hdrpack_state *, struct hdrpack_dict *, const struct kextlog_msghdr *, void *);
+int hdrpack_decode(struct hdrpack_state *, struct hdrpack_dict *, const void *, size_t, struct kextlog_msghdr *, const char **);
+
+/*
+ * OR flags into an encoded record  only KEXTLOG_FLAG_MSG_DROPPED used
+ */
+static inline void hdrpack_or_flags(void *rec, uint32_t flags)
+{
+    *(uint8_t *) rec |= (uint8_t) ((flags & 0x1f) << 3);
+}
+
+#endif /* HDRPACK_H */
+
@@ -0,0 +1,105 @@
+/*
+ * Created 200110
+ *
+ * Bucket layout(S = HIST_SUB  B = HIST_SUB_BITS):
+ *  [0, S)          one bucket per value
+ *  [2^e, 2^(e+1))  S buckets of width 2^(e-B)  for e in [B, HIST_MAX_BITS)
+ */
+
+#include "hist.h"
+
+static inline uint32_t msb64(uint64_t v)
+{
+    return 63u - (uint32_t) __builtin_clzll(v);
+}
+
+/**
+ * @return  index of the bucket a value falls into
+ */
+uint32_t hist_bucket(uint64_t v)
+{
+    uint32_t e;
+
+    if (v < HIST_SUB) return (uint32_t) v;
+
+    e = msb64(v);
+    if (e >= HIST_MAX_BITS) return HIST_NBUCKET - 1;
+
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + (uint32_t) ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/**
+ * @return  smallest value of a bucket
+ */
+uint64_t hist_bucket_low(uint32_t i)
+{
+    uint32_t e;
+
+    if (i < HIST_SUB) return i;
+
+    e = i / HIST_SUB + HIST_SUB_BITS - 1;
+    return (1ULL << e) + (uint64_t) (i % HIST_SUB) * (1ULL << (e - HIST_SUB_BITS));
+}
+
+/**
+ * @return  largest value of a bucket  UINT64_MAX for the last one
+ */
+uint64_t hist_bucket_high(uint32_t i)
+{
+    if (i >= HIST_NBUCKET - 1) return UINT64_MAX;
+    return hist_bucket_low(i + 1) - 1;
+}
+
+/**
+ * Record a value  safe to call concurrently
+ */
+void hist_record(struct hist *h, uint64_t v)
+{
+    (void) __atomic_add_fetch(&h->count[hist_bucket(v)], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add counts of src into dst  dst must not be updated concurrently
+ */
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+    uint32_t i;
+    for (i = 0; i < HIST_NBUCKET; i++) {
+        dst->count[i] += __atomic_load_n(&src->count[i], __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t hist_total(const struct hist *h)
+{
+    uint64_t n = 0;
+    uint32_t i;
+    for (i = 0; i < HIST_NBUCKET; i++) n += h->count[i];
+    return n;
+}
+
+/**
+ * Get the value at a quantile  i.e. num/den of all recorded values are at or below it
+ * @return  upper bound of the bucket where the quantile falls in
+ *          zero if the histogram is empty
+ */
+uint64_t hist_quantile(const struct hist *h, uint64_t num, uint64_t den)
+{
+    uint64_t total = hist_total(h);
+    uint64_t rank;
+    uint64_t n = 0;
+    uint32_t i;
+
+    if (total == 0 || den == 0) return 0;
+
+    /* rank = ceil(total * num / den)  at least 1 */
+    rank = (total / den) * num + ((total % den) * num + den - 1) / den;
+    if (rank == 0) rank = 1;
+
+    for (i = 0; i < HIST_NBUCKET; i++) {
+        n += h->count[i];
+        if (n >= rank) return hist_bucket_high(i);
+    }
+
+    return hist_bucket_high(HIST_NBUCKET - 1);
+}
+
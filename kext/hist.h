@@ -0,0 +1,35 @@
+/*
+ * Created 200110
+ *
+ * Log-linear(HDR-style) histogram of 64-bit values
+ *  each power of 2 is split into HIST_SUB linear sub-buckets
+ *  which bounds the relative error of a bucket to 1 / HIST_SUB
+ *
+ * This file has no kernel dependency  it's shared by kext and log daemon
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS       3
+#define HIST_SUB            (1u << HIST_SUB_BITS)
+/* Values at or beyond 2^HIST_MAX_BITS fall into the last bucket */
+#define HIST_MAX_BITS       32
+#define HIST_NBUCKET        ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+    volatile uint64_t count[HIST_NBUCKET];
+};
+
+uint32_t hist_bucket(uint64_t);
+uint64_t hist_bucket_low(uint32_t);
+uint64_t hist_bucket_high(uint32_t);
+void hist_record(struct hist *, uint64_t);
+void hist_merge(struct hist *, const struct hist *);
+uint64_t hist_total(const struct hist *);
+uint64_t hist_quantile(const struct hist *, uint64_t, uint64_t);
+
+#endif /* HIST_H */
+
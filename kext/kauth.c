@@ -14,6 +14,31 @@
 #include "utils.h"
 #include "log_kctl.h"
 
+/**
+ * @return      mask of clients want the event  zero if none
+ *              see: log_evfilter() and KEXTLOG_SUBS
+ */
+static inline uint32_t kauth_wanted(
+        uint32_t scope,
+        kauth_action_t act,
+        uid_t uid,
+        int pid,
+        const char *path,
+        const char *path2)
+{
+    struct evfilter_event ev;
+
+    ev.scope = scope;
+    /* Vnode scope actions are bit masks already */
+    ev.action = scope == KEXTLOG_SCOPE_VNODE ? (uint32_t) act : (act < 32 ? 1u << act : 0);
+    ev.pid = pid;
+    ev.uid = uid;
+    ev.path = path;
+    ev.path2 = path2;
+
+    return log_evfilter(&ev);
+}
+
 static inline const char *vtype_string(enum vtype vt)
 {
     static const char *vtypes[] = {
@@ -88,6 +113,17 @@ static inline const char *generic_action_str(kauth_action_t act)
     return "(?)";
 }
 
+/* Log call sites below belong to generic scope */
+#undef KEXTLOG_SCOPE
+#define KEXTLOG_SCOPE       KEXTLOG_SCOPE_GENERIC
+
+/*
+ * Messages of kauth callbacks only go to clients want the event
+ *  each callback keeps result of kauth_wanted() in `wanted'
+ */
+#undef KEXTLOG_SUBS
+#define KEXTLOG_SUBS        wanted
+
 static int generic_scope_cb(
         kauth_cred_t cred,
         void *idata,
@@ -100,13 +136,18 @@ static int generic_scope_cb(
     uid_t uid;
     int pid;
     char pcomm[MAXCOMLEN + 1];
+    uint32_t wanted = 0;
 
     if (kcb_get() < 0) goto out_put;
 
     UNUSED(idata, arg0, arg1, arg2, arg3);
 
+    if (!log_enabled(KEXTLOG_LEVEL_INFO, KEXTLOG_SCOPE)) goto out_put;
+
     uid = kauth_cred_getuid(cred);
     pid = proc_selfpid();
+    wanted = kauth_wanted(KEXTLOG_SCOPE, act, uid, pid, NULL, NULL);
+    if (wanted == 0) goto out_put;
     proc_selfname(pcomm, sizeof(pcomm));
 
     log_info("generic  act: %#x(%s) uid: %u pid: %d %s",
@@ -117,6 +158,10 @@ out_put:
     return KAUTH_RESULT_DEFER;
 }
 
+/* Log call sites below belong to process scope */
+#undef KEXTLOG_SCOPE
+#define KEXTLOG_SCOPE       KEXTLOG_SCOPE_PROCESS
+
 static inline const char *process_action_str(kauth_action_t act)
 {
     switch (act) {
@@ -140,6 +185,7 @@ static int process_scope_cb(
     uid_t uid;
     int pid;
     char pcomm[MAXCOMLEN + 1];
+    uint32_t wanted = 0;
 
     proc_t proc;
     int pid2;
@@ -150,8 +196,15 @@ static int process_scope_cb(
 
     UNUSED(idata, arg2, arg3);
 
+    /* CANSIGNAL logs at INFO  others at WARNING */
+    if (!log_enabled(act == KAUTH_PROCESS_CANSIGNAL ? KEXTLOG_LEVEL_INFO : KEXTLOG_LEVEL_WARNING, KEXTLOG_SCOPE)) {
+        goto out_put;
+    }
+
     uid = kauth_cred_getuid(cred);
     pid = proc_selfpid();
+    wanted = kauth_wanted(KEXTLOG_SCOPE, act, uid, pid, NULL, NULL);
+    if (wanted == 0) goto out_put;
     proc_selfname(pcomm, sizeof(pcomm));
 
     switch (act) {
@@ -184,6 +237,10 @@ out_put:
     return KAUTH_RESULT_DEFER;
 }
 
+/* Log call sites below belong to vnode scope */
+#undef KEXTLOG_SCOPE
+#define KEXTLOG_SCOPE       KEXTLOG_SCOPE_VNODE
+
 #define GET_TYPE_STR     0
 #define GET_TYPE_LEN     1
 
@@ -339,6 +396,7 @@ static int vnode_scope_cb(
     uid_t uid;
     int pid;
     char pcomm[MAXCOMLEN + 1];
+    uint32_t wanted = 0;
     char *str;
     enum vtype vt;
 
@@ -353,8 +411,14 @@ static int vnode_scope_cb(
     vp = (vnode_t) arg1;
     dvp = (vnode_t) arg2;           /* may NULLVP(alias of NULL) */
 
+    /* Path lookup serves the INFO message only  so does its failure ERROR */
+    if (!log_enabled(KEXTLOG_LEVEL_INFO, KEXTLOG_SCOPE)) goto out_put;
+
     uid = kauth_cred_getuid(cred);
     pid = proc_selfpid();
+    /* Filter what we can before the costly path lookup */
+    wanted = kauth_wanted(KEXTLOG_SCOPE, act, uid, pid, NULL, NULL);
+    if (wanted == 0) goto out_put;
     proc_selfname(pcomm, sizeof(pcomm));
 
     vpath = make_vnode_path(vp);
@@ -365,6 +429,13 @@ static int vnode_scope_cb(
         goto out_put;
     }
 
+    /* Path prefixes narrow clients down */
+    wanted = kauth_wanted(KEXTLOG_SCOPE, act, uid, pid, vpath.path, NULL);
+    if (wanted == 0) {
+        util_mfree(vpath.path);
+        goto out_put;
+    }
+
     str = vn_act_str(act, vp);
     log_info("vnode  act: %#x(%s) vp: %p %d %s %s dvp: %p uid: %u pid: %d %s",
           act, str, vp, vt, vtype_string(vt), vpath.path, dvp, uid, pid, pcomm);
@@ -376,6 +447,10 @@ out_put:
     return KAUTH_RESULT_DEFER;
 }
 
+/* Log call sites below belong to fileop scope */
+#undef KEXTLOG_SCOPE
+#define KEXTLOG_SCOPE       KEXTLOG_SCOPE_FILEOP
+
 static inline const char *fileop_action_str(kauth_action_t act)
 {
     switch (act) {
@@ -402,6 +477,52 @@ static inline const char *fileop_action_str(kauth_action_t act)
     return "?";
 }
 
+static inline int fileop_known(kauth_action_t act)
+{
+    return fileop_action_str(act)[0] != '?';
+}
+
+/**
+ * @return      first path argument of a file operation  NULL if none
+ */
+static inline const char *fileop_path(kauth_action_t act, uintptr_t arg0, uintptr_t arg1)
+{
+    switch (act) {
+    case KAUTH_FILEOP_RENAME:
+    case KAUTH_FILEOP_EXCHANGE:
+    case KAUTH_FILEOP_LINK:
+        return (const char *) arg0;
+    case KAUTH_FILEOP_OPEN:
+    case KAUTH_FILEOP_CLOSE:
+    case KAUTH_FILEOP_EXEC:
+    case KAUTH_FILEOP_DELETE:
+#if OS_VER_MIN_REQ >= __MAC_10_14
+    case KAUTH_FILEOP_WILL_RENAME:
+#endif
+        return (const char *) arg1;
+    }
+    return NULL;
+}
+
+/**
+ * @return      second path argument of a file operation  NULL if none
+ */
+static inline const char *fileop_path2(kauth_action_t act, uintptr_t arg1, uintptr_t arg2)
+{
+    switch (act) {
+    case KAUTH_FILEOP_RENAME:
+    case KAUTH_FILEOP_EXCHANGE:
+    case KAUTH_FILEOP_LINK:
+        return (const char *) arg1;
+#if OS_VER_MIN_REQ >= __MAC_10_14
+    case KAUTH_FILEOP_WILL_RENAME:
+        return (const char *) arg2;
+#endif
+    }
+    UNUSED(arg2);
+    return NULL;
+}
+
 /*
  * [sic Technical Note TN2127 Kernel Authorization#File Operation Scope]
  *
@@ -431,6 +552,7 @@ static int fileop_scope_cb(
     uid_t uid;
     int pid;
     char pcomm[MAXCOMLEN + 1];
+    uint32_t wanted = 0;
 
     vnode_t vp;
     const char *path1;
@@ -441,8 +563,15 @@ static int fileop_scope_cb(
 
     UNUSED(idata, arg3);
 
+    /* Known actions log at INFO  unknown ones warned */
+    if (!log_enabled(fileop_known(act) ? KEXTLOG_LEVEL_INFO : KEXTLOG_LEVEL_WARNING, KEXTLOG_SCOPE)) {
+        goto out_put;
+    }
+
     uid = kauth_cred_getuid(cred);
     pid = proc_selfpid();
+    wanted = kauth_wanted(KEXTLOG_SCOPE, act, uid, pid, fileop_path(act, arg0, arg1), fileop_path2(act, arg1, arg2));
+    if (wanted == 0) goto out_put;
     proc_selfname(pcomm, sizeof(pcomm));
 
     switch (act) {
@@ -525,6 +654,12 @@ out_put:
     return KAUTH_RESULT_DEFER;
 }
 
+#undef KEXTLOG_SCOPE
+#define KEXTLOG_SCOPE       KEXTLOG_SCOPE_NONE
+
+#undef KEXTLOG_SUBS
+#define KEXTLOG_SUBS        0
+
 static const char *scope_name[] = {
     KAUTH_SCOPE_GENERIC,
     KAUTH_SCOPE_PROCESS,
@@ -558,7 +693,7 @@ kern_return_t kauth_register(void)
 
         if (scope_ref[i] == NULL) {
             r = KERN_FAILURE;
-            log_error("kauth_listen_scope() fail  scope: %s", scope_name[i]);
+            log_error_sleep("kauth_listen_scope() fail  scope: %s", scope_name[i]);
             kauth_deregister();
             break;
         }
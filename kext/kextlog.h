@@ -12,23 +12,85 @@
 
 #define KEXTLOG_KCTL_NAME           "net.trineo.kext.bsd_kext_log.kctl"
 #define KEXTLOG_KCTL_SOCKTYPE       SOCK_DGRAM
+/* Same as above  yet a SOCK_STREAM one  see: struct kextlog_frame */
+#define KEXTLOG_KCTL_STREAM_NAME    "net.trineo.kext.bsd_kext_log.kctl.stream"
 
 #define KEXTLOG_LEVEL_TRACE         0
 #define KEXTLOG_LEVEL_DEBUG         1
 #define KEXTLOG_LEVEL_INFO          2
 #define KEXTLOG_LEVEL_WARNING       3
 #define KEXTLOG_LEVEL_ERROR         4
+#define KEXTLOG_NLEVEL              (KEXTLOG_LEVEL_ERROR + 1)
+
+/*
+ * Subsystems a message originated from
+ */
+#define KEXTLOG_SCOPE_NONE          0
+#define KEXTLOG_SCOPE_GENERIC       1       /* KAuth generic scope */
+#define KEXTLOG_SCOPE_PROCESS       2       /* KAuth process scope */
+#define KEXTLOG_SCOPE_VNODE         3       /* KAuth vnode scope */
+#define KEXTLOG_SCOPE_FILEOP        4       /* KAuth file operation scope */
+#define KEXTLOG_SCOPE_MAX           5
+#define KEXTLOG_SCOPE_ALL           ((1u << KEXTLOG_SCOPE_MAX) - 1)
+
+/* Max number of clients connected at the same time */
+#define KEXTLOG_SUB_MAX             4
+
+/*
+ * Socket options of log kctl  i.e. setsockopt(fd, SYSPROTO_CONTROL, opt, ...)
+ */
+#define KEXTLOG_SOCKOPT_FILTER      1   /* struct kextlog_filter */
+#define KEXTLOG_SOCKOPT_EVFILTER    2   /* struct evfilter  zero length clears it */
+#define KEXTLOG_SOCKOPT_WIRE        3   /* uint32_t KEXTLOG_WIRE_V* */
+#define KEXTLOG_SOCKOPT_COMPRESS    4   /* uint32_t  nonzero to compress batches */
+#define KEXTLOG_SOCKOPT_START       5   /* No data  start receiving records */
+
+/*
+ * A client connected gets no record until it sets KEXTLOG_SOCKOPT_START
+ *  so nothing(drop reports and flight recorder replay included) is sent
+ *  in a format it's still negotiating
+ * KEXTLOG_SOCKOPT_WIRE and KEXTLOG_SOCKOPT_COMPRESS are only accepted before
+ *  that  EBUSY afterwards
+ * A client set neither of them is started anyway KEXTLOG_HOLD_MS after connect
+ *  so clients predate the option keep working
+ */
+#define KEXTLOG_HOLD_MS             200
+
+/*
+ * Wire format of records  a client gets V1 until it asks for another one
+ * An old kext rejects KEXTLOG_SOCKOPT_WIRE with ENOPROTOOPT  client should stay V1
+ */
+#define KEXTLOG_WIRE_V1             1   /* struct kextlog_msghdr followed by buffer */
+#define KEXTLOG_WIRE_V2             2   /* Compact header  see kext/hdrpack.h */
+#define KEXTLOG_WIRE_V3             3   /* V2 with a per-connection thread dictionary */
+
+/*
+ * Per-client message filter  a client receives everything by default
+ * Messages are formatted once  and enqueued only to clients want them
+ */
+struct kextlog_filter {
+    uint32_t level_min;     /* KEXTLOG_LEVEL_ERROR + 1 mutes the client */
+    uint32_t scope_mask;    /* Bit i denotes KEXTLOG_SCOPE i */
+};
 
 /*
  * Indicate direct-previous messages dropped due to failure
  */
 #define KEXTLOG_FLAG_MSG_DROPPED    0x1
 #define KEXTLOG_FLAG_MSG_TRUNCATED  0x2
+/* Message body is a struct kextlog_binmsg with packed arguments */
+#define KEXTLOG_FLAG_MSG_BINARY     0x4
+/* Message body is a struct kextlog_binmsg with a format string */
+#define KEXTLOG_FLAG_FMT_DEFINE     0x8
+/* Message body is a struct kextlog_dropmsg */
+#define KEXTLOG_FLAG_DROP_REPORT    0x10
+/* Wire format V2 packs flags into 5 bits  don't go beyond 0x10 */
 
 #define _KEXTLOG_PADDING_MAGIC      0x65636166  /* Little-endian 'face' */
 
 struct kextlog_msghdr {
     int32_t pid;
+    uint32_t scope;         /* KEXTLOG_SCOPE_* */
     uint64_t tid;
 
     uint64_t timestamp;     /* always be mach_absolute_time() */
@@ -38,6 +100,12 @@ struct kextlog_msghdr {
     uint32_t size;          /* Size of message buffer */
     uint32_t _padding;
 
+    /*
+     * Stamped right before a record leaves the kext  increased by one per record
+     *  a gap denotes records lost on their way to user space
+     */
+    uint64_t seq;
+
     /*
      * Zero size must be given to silence
      *  -Wgnu-variable-sized-type-not-at-end for nested structs
@@ -45,5 +113,54 @@ struct kextlog_msghdr {
     char buffer[0];
 } __attribute__ ((aligned (8)));
 
+/*
+ * SOCK_STREAM kctl precedes each batch of records with a frame header
+ *  a reader lost its way scans forward for the magic  and checks
+ *  records in the frame add up to len before trusting it
+ *
+ * A client asked for KEXTLOG_SOCKOPT_COMPRESS gets frames on SOCK_DGRAM too
+ *  one frame per datagram  payload of a frame with nonzero raw_len is
+ *  a lzpack block(see kext/lzpack.h) of raw_len bytes of records
+ */
+#define KEXTLOG_FRAME_MAGIC         0x666c786b  /* Little-endian 'kxlf' */
+
+struct kextlog_frame {
+    uint32_t magic;
+    uint32_t len;           /* Bytes of payload follow */
+    uint32_t cnt;           /* Number of records follow */
+    uint32_t raw_len;       /* Bytes of records decompressed  zero if not compressed */
+};
+
+/*
+ * Body of binary messages(deferred formatting)
+ *
+ * KEXTLOG_FLAG_MSG_BINARY
+ *  data is printf-style arguments packed by fmtpack_encode()
+ *  see: fmtpack.h
+ *
+ * fmt_id is opaque  it identifies a format string as long as kext loaded
+ *
+ * KEXTLOG_FLAG_FMT_DEFINE
+ *  data is the NUL-terminated format string of fmt_id
+ *  a format always defined before the first binary message refers to it
+ *  definitions are valid through the whole connection
+ */
+struct kextlog_binmsg {
+    uint64_t fmt_id;
+    char data[0];
+};
+
+/*
+ * Body of drop reports(KEXTLOG_FLAG_DROP_REPORT)
+ *  messages dropped since kext loaded  indexed by level
+ *  messages never reached user space in any way are counted
+ *  including those lost before a seq stamped
+ *
+ * A report is sent once a client connected  and whenever a count changes
+ */
+struct kextlog_dropmsg {
+    uint64_t dropped[KEXTLOG_NLEVEL];
+};
+
 #endif /* KEXTLOG_H */
 
@@ -9,14 +9,28 @@
 #include <libkern/OSAtomic.h>
 #include <mach/mach_time.h>
 #include <sys/vm.h>
+#include <sys/sysctl.h>
+#include <kern/thread.h>
+#include <kern/cpu_number.h>
+#include <pexpert/pexpert.h>
 
 #include "log_kctl.h"
 #include "utils.h"
 #include "kextlog.h"
 #include "log_sysctl.h"
+#include "ringbuf.h"
+#include "fmtpack.h"
+#include "mpool.h"
+#include "hist.h"
+#include "evfilter.h"
+#include "hdrpack.h"
+#include "lzpack.h"
 
 static errno_t log_kctl_connect( kern_ctl_ref, struct sockaddr_ctl *, void **);
 static errno_t log_kctl_disconnect(kern_ctl_ref, u_int32_t, void *);
+static errno_t log_kctl_setopt(kern_ctl_ref, u_int32_t, void *, int, void *, size_t);
+static errno_t log_kctl_getopt(kern_ctl_ref, u_int32_t, void *, int, void *, size_t *);
+static inline void log_consumer_kick(void);
 
 #define SOCK2FLAG(t)        ((t) == SOCK_STREAM ? CTL_FLAG_REG_SOCK_STREAM : 0)
 
@@ -26,6 +40,7 @@ static errno_t log_kctl_disconnect(kern_ctl_ref, u_int32_t, void *);
  *      #define CTL_SENDSIZE (2 * 1024)     //  data into kernel
  *      #define CTL_RECVSIZE (8 * 1024)     //  data to user space
  *  above denoted default send/recv buffer size
+ *  ctl_recvsize is filled from kextlog.kctl.recvsize before registration
  *
  * see: xnu/bsd/kern/kern_control.c#ctl_getenqueuespace
  */
@@ -39,161 +54,1942 @@ static struct kern_ctl_reg kctlreg = {
     log_kctl_connect,                   /* ctl_connect */
     log_kctl_disconnect,                /* ctl_disconnect */
     NULL,                               /* ctl_send */
-    NULL,                               /* ctl_setopt */
-    NULL,                               /* ctl_getopt */
+    log_kctl_setopt,                    /* ctl_setopt */
+    log_kctl_getopt,                    /* ctl_getopt */
+};
+
+/* Records are framed  see: struct kextlog_frame */
+static struct kern_ctl_reg kctlreg_stream = {
+    KEXTLOG_KCTL_STREAM_NAME,           /* ctl_name */
+    0,                                  /* ctl_id */
+    0,                                  /* ctl_unit */
+    SOCK2FLAG(SOCK_STREAM),             /* ctl_flags */
+    0,                                  /* ctl_sendsize */
+    0,                                  /* ctl_recvsize */
+    log_kctl_connect,                   /* ctl_connect */
+    log_kctl_disconnect,                /* ctl_disconnect */
+    NULL,                               /* ctl_send */
+    log_kctl_setopt,                    /* ctl_setopt */
+    log_kctl_getopt,                    /* ctl_getopt */
 };
 
 static kern_ctl_ref kctlref = NULL;
-static volatile u_int32_t kctlunit = 0;     /* Active unit is positive */
+static kern_ctl_ref kctlref_stream = NULL;
+
+#define FMTDICT_SIZE                512     /* Power of 2 */
+#define FMTDICT_PROBE               16
+
+/*
+ * A connected client
+ *
+ * unit and filter are written by kctl callbacks
+ *  the rest belongs to the consumer thread  and reset once it sees a new connection
+ */
+struct kextlog_sub {
+    volatile UInt32 claimed;            /* Nonzero if the slot is taken */
+    volatile u_int32_t unit;            /* Published after ref and stream set */
+    volatile uint32_t gen;              /* Bumped on each connect  units are reused */
+    kern_ctl_ref ref;
+    int stream;                         /* Nonzero if it's a SOCK_STREAM one */
+    volatile uint32_t level_min;
+    volatile uint32_t scope_mask;       /* Bit i denotes KEXTLOG_SCOPE i */
+    volatile uint32_t wire;             /* KEXTLOG_WIRE_V*  see: KEXTLOG_SOCKOPT_WIRE */
+    volatile uint32_t compress;         /* Nonzero to frame and compress batches */
+    volatile UInt32 state;              /* SUB_HELD etc. */
+    uint64_t hold_deadline;             /* In mach absolute time  see: KEXTLOG_HOLD_MS */
+
+    /* Event filter  see: KEXTLOG_SOCKOPT_EVFILTER */
+    volatile uint32_t evf_on;
+    volatile uint32_t evf_seq;          /* Odd while evf being rewritten */
+    struct evfilter evf;
+
+    u_int32_t cunit;                    /* Unit consumer states belong to */
+    uint32_t cgen;                      /* Connection consumer states belong to */
+    kern_ctl_ref cref;
+    int cstream;
+    int ccompress;                      /* Taken once started  see: KEXTLOG_SOCKOPT_START */
+    uint32_t cwire;                     /* Wire format of records batched */
+    struct hdrpack_state pack;          /* Delta base of V2 records batched */
+    struct hdrpack_dict dict;           /* Thread dictionary of V3 */
+
+    /*
+     * Consecutive records are coalesced into one batch  which costs a single
+     *  ctl_enqueuedata() call  wire framing is unchanged since user space
+     *  already parses multiple records per read
+     */
+    uint32_t batch_len;
+    uint32_t batch_cnt;
+    uint64_t batch_deadline;            /* In mach absolute time */
+
+    /* Sequence number of next record sent to the subscriber */
+    uint64_t send_seq;
+
+    /* Cumulative drop counts last reported */
+    uint64_t reported[KEXTLOG_NLEVEL];
+    int report;                         /* Nonzero to report regardless */
+
+    /* Format ids already defined to the subscriber  zero denotes an empty slot */
+    uint64_t fmtdict[FMTDICT_SIZE];
+
+    uint8_t batch_buf[KEXTLOG_BATCH_MAX] __attribute__ ((aligned (8)));
+};
+
+/* Subscriber states  see: KEXTLOG_SOCKOPT_START */
+#define SUB_HELD                    0   /* Gets no record yet */
+#define SUB_NEGOTIATED              1   /* Held until started  wire format or compression set */
+#define SUB_STARTED                 2
+
+static struct kextlog_sub subs[KEXTLOG_SUB_MAX];
+static volatile SInt32 nsub = 0;        /* Connected subscribers */
+static uint32_t nsub_synced = 0;        /* Subscribers consumer knows of */
+static uint32_t nsub_held = 0;          /* Subscribers yet to start within KEXTLOG_HOLD_MS */
+
+/* Nonzero if records of the wire format are packed by hdrpack */
+#define wire_packed(w)              ((w) >= KEXTLOG_WIRE_V2)
+
+#define SUB_BIT(sub)                (1u << (uint32_t) ((sub) - subs))
+#define SUB_ALL                     ((1u << KEXTLOG_SUB_MAX) - 1)
+
+#define sub_foreach(sub) \
+    for ((sub) = subs; (sub) < subs + KEXTLOG_SUB_MAX; (sub)++) if ((sub)->cunit != 0)
+
+/*
+ * XXX: kctl can be connected in the interim of kext loading
+ * You may happen to take further logic to
+ *  prevent client from connecting in such case
+ */
+static errno_t log_kctl_connect(
+        kern_ctl_ref ref,
+        struct sockaddr_ctl *sac,
+        void **unitinfo)
+{
+    struct kextlog_sub *sub;
+    uint64_t hold;
+
+    BUILD_BUG_ON(sizeof(u_int32_t) != sizeof(UInt32));
+
+    kassert(ref == kctlref || ref == kctlref_stream);
+    kassert_nonnull(unitinfo);
+
+    for (sub = subs; sub < subs + KEXTLOG_SUB_MAX; sub++) {
+        if (sub->claimed == 0 && OSCompareAndSwap(0, 1, &sub->claimed)) break;
+    }
+
+    if (sub == subs + KEXTLOG_SUB_MAX) {
+        *unitinfo = NULL;
+        LOG_WARN("Log kctl has %d subscribers already  skip", KEXTLOG_SUB_MAX);
+        return EISCONN;
+    }
+
+    /* Wants everything until it sets a filter */
+    sub->ref = ref;
+    sub->stream = ref == kctlref_stream;
+    sub->level_min = KEXTLOG_LEVEL_TRACE;
+    sub->scope_mask = KEXTLOG_SCOPE_ALL;
+    sub->wire = KEXTLOG_WIRE_V1;
+    sub->compress = 0;
+    sub->evf_on = 0;
+    sub->state = SUB_HELD;
+    nanoseconds_to_absolutetime((uint64_t) KEXTLOG_HOLD_MS * 1000000, &hold);
+    sub->hold_deadline = mach_absolute_time() + hold;
+    /*
+     * A reconnect may get the same unit back before consumer ever sees
+     *  the slot vacant  DGRAM and STREAM kctl number units independently
+     */
+    sub->gen++;
+    /* Consumer may pick up the slot once unit published */
+    OSMemoryBarrier();
+    sub->unit = sac->sc_unit;
+    *unitinfo = sub;
+    (void) OSIncrementAtomic(&nsub);
+    log_level_update();
+
+    LOG_DBG("Log kctl connected  unit: %u slot: %ld", sac->sc_unit, (long) (sub - subs));
+
+    return 0;
+}
+
+static errno_t log_kctl_disconnect(
+        kern_ctl_ref ref,
+        u_int32_t unit,
+        void *unitinfo)
+{
+    struct kextlog_sub *sub = (struct kextlog_sub *) unitinfo;
+
+    UNUSED(ref);
+
+    /* Refused clients */
+    if (sub == NULL) return 0;
+
+    if (OSCompareAndSwap(unit, 0, &sub->unit)) {
+        sub->claimed = 0;
+        (void) OSDecrementAtomic(&nsub);
+        log_level_update();
+        LOG_DBG("Log kctl client disconnected  unit: %u", unit);
+    }
+    return 0;
+}
+
+/**
+ * Replace event filter of a subscriber  seqlock-style
+ *  setopt calls of a socket are serialized by the socket lock
+ * @return      0 if success  EINVAL if the filter is malformed
+ */
+static errno_t log_sub_set_evfilter(struct kextlog_sub *sub, const void *data, size_t len)
+{
+    static struct evfilter evf;     /* Too large for kernel stack */
+    static volatile UInt32 busy = 0;
+    errno_t e = 0;
+
+    if (data == NULL || len == 0) {
+        sub->evf_on = 0;
+        return 0;
+    }
+    if (len != sizeof(evf)) return EINVAL;
+
+    /* Staging buffer is shared by all subscribers */
+    while (!OSCompareAndSwap(0, 1, &busy)) continue;
+
+    (void) memcpy(&evf, data, sizeof(evf));
+    if (evfilter_prepare(&evf) != 0) {
+        e = EINVAL;
+        goto out_unlock;
+    }
+
+    (void) OSIncrementAtomic((volatile SInt32 *) &sub->evf_seq);
+    OSMemoryBarrier();
+    (void) memcpy(&sub->evf, &evf, sizeof(evf));
+    OSMemoryBarrier();
+    (void) OSIncrementAtomic((volatile SInt32 *) &sub->evf_seq);
+    sub->evf_on = 1;
+
+out_unlock:
+    busy = 0;
+    return e;
+}
+
+#define EVFILTER_RETRY      4
+
+/**
+ * Check an event against event filters of all subscribers
+ *  called from kauth callbacks  before any formatting work
+ * @return      mask of subscribers want the event  see: KEXTLOG_SUBS
+ *              zero if none of them  all bits set if no subscriber connected
+ */
+uint32_t log_evfilter(const struct evfilter_event *ev)
+{
+    const struct kextlog_sub *sub;
+    uint32_t mask = 0;
+    uint32_t seq;
+    int ok = 1;
+    int i;
+
+    if (nsub == 0) return SUB_ALL;
+
+    for (sub = subs; sub < subs + KEXTLOG_SUB_MAX; sub++) {
+        if (sub->unit == 0 || !(sub->scope_mask & (1u << ev->scope))) continue;
+
+        if (sub->evf_on) {
+            for (i = 0; i < EVFILTER_RETRY; i++) {
+                seq = sub->evf_seq;
+                if (seq & 1) continue;
+                OSMemoryBarrier();
+                ok = evfilter_match(&sub->evf, ev);
+                OSMemoryBarrier();
+                if (sub->evf_seq == seq) break;
+            }
+            /* Filter keeps changing  let it pass */
+            if (i < EVFILTER_RETRY && !ok) continue;
+        }
+
+        mask |= SUB_BIT(sub);
+    }
+
+    if (mask == 0) log_stat_inc(evfiltered);
+    return mask;
+}
+
+/*
+ * Subscriber filters  see: KEXTLOG_SOCKOPT_*
+ */
+static errno_t log_kctl_setopt(
+        kern_ctl_ref ref,
+        u_int32_t unit,
+        void *unitinfo,
+        int opt,
+        void *data,
+        size_t len)
+{
+    struct kextlog_sub *sub = (struct kextlog_sub *) unitinfo;
+    struct kextlog_filter *f = (struct kextlog_filter *) data;
+
+    UNUSED(ref);
+
+    if (sub == NULL || sub->unit != unit) return ENOTCONN;
+    if (opt == KEXTLOG_SOCKOPT_EVFILTER) return log_sub_set_evfilter(sub, data, len);
+    if (opt == KEXTLOG_SOCKOPT_START) {
+        /* Wire format and compression visible to consumer before it starts */
+        OSMemoryBarrier();
+        sub->state = SUB_STARTED;
+        log_consumer_kick();
+        LOG_DBG("Log kctl started  unit: %u", unit);
+        return 0;
+    }
+    if (opt == KEXTLOG_SOCKOPT_WIRE || opt == KEXTLOG_SOCKOPT_COMPRESS) {
+        if (data == NULL || len != sizeof(uint32_t)) return EINVAL;
+        if (opt == KEXTLOG_SOCKOPT_WIRE &&
+                (*(uint32_t *) data < KEXTLOG_WIRE_V1 || *(uint32_t *) data > KEXTLOG_WIRE_V3)) return EINVAL;
+        /* Consumer never sent a record to the client yet  nor will it auto start */
+        if (!OSCompareAndSwap(SUB_HELD, SUB_NEGOTIATED, &sub->state) && sub->state != SUB_NEGOTIATED) return EBUSY;
+
+        if (opt == KEXTLOG_SOCKOPT_WIRE) {
+            sub->wire = *(uint32_t *) data;
+            LOG_DBG("Log kctl wire format set  unit: %u version: %u", unit, sub->wire);
+        } else {
+            sub->compress = *(uint32_t *) data != 0;
+            LOG_DBG("Log kctl compression set  unit: %u compress: %u", unit, sub->compress);
+        }
+        return 0;
+    }
+    if (opt != KEXTLOG_SOCKOPT_FILTER) return ENOPROTOOPT;
+    if (data == NULL || len != sizeof(*f)) return EINVAL;
+    if (f->level_min > KEXTLOG_LEVEL_ERROR + 1) return EINVAL;
+
+    sub->level_min = f->level_min;
+    sub->scope_mask = f->scope_mask & KEXTLOG_SCOPE_ALL;
+    log_level_update();
+
+    LOG_DBG("Log kctl filter set  unit: %u level: %u scope: %#x", unit, f->level_min, f->scope_mask);
+    return 0;
+}
+
+static errno_t log_kctl_getopt(
+        kern_ctl_ref ref,
+        u_int32_t unit,
+        void *unitinfo,
+        int opt,
+        void *data,
+        size_t *len)
+{
+    struct kextlog_sub *sub = (struct kextlog_sub *) unitinfo;
+    struct kextlog_filter f;
+
+    UNUSED(ref);
+
+    if (sub == NULL || sub->unit != unit) return ENOTCONN;
+    kassert_nonnull(len);
+
+    if (opt == KEXTLOG_SOCKOPT_EVFILTER) {
+        /* Reports an empty filter if none set */
+        if (data != NULL) {
+            if (*len < sizeof(sub->evf)) return EINVAL;
+            if (sub->evf_on) {
+                (void) memcpy(data, &sub->evf, sizeof(sub->evf));
+            } else {
+                (void) memset(data, 0, sizeof(sub->evf));
+            }
+        }
+        *len = sizeof(sub->evf);
+        return 0;
+    }
+    if (opt == KEXTLOG_SOCKOPT_WIRE || opt == KEXTLOG_SOCKOPT_COMPRESS) {
+        if (data != NULL) {
+            if (*len < sizeof(uint32_t)) return EINVAL;
+            *(uint32_t *) data = opt == KEXTLOG_SOCKOPT_WIRE ? sub->wire : sub->compress;
+        }
+        *len = sizeof(uint32_t);
+        return 0;
+    }
+    if (opt != KEXTLOG_SOCKOPT_FILTER) return ENOPROTOOPT;
+
+    f.level_min = sub->level_min;
+    f.scope_mask = sub->scope_mask;
+
+    /* NULL data queries option size */
+    if (data != NULL) {
+        if (*len < sizeof(f)) return EINVAL;
+        (void) memcpy(data, &f, sizeof(f));
+    }
+    *len = sizeof(f);
+    return 0;
+}
+
+/**
+ * @return      kctl receive buffer size  boot-arg overrides the default
+ */
+static uint32_t log_kctl_recvsize(void)
+{
+    uint32_t size = KEXTLOG_RECVSIZE;
+
+    if (PE_parse_boot_argn(KEXTLOG_RECVSIZE_BOOTARG, &size, sizeof(size))) {
+        if (size < KEXTLOG_RECVSIZE_MIN) size = KEXTLOG_RECVSIZE_MIN;
+        if (size > KEXTLOG_RECVSIZE_MAX) size = KEXTLOG_RECVSIZE_MAX;
+    }
+
+    return size;
+}
+
+kern_return_t log_kctl_register(void)
+{
+    errno_t e;
+
+    log_conf.recvsize = log_kctl_recvsize();
+    /* Reserve set before boot-arg parsed may exceed a smaller buffer */
+    if (log_conf.lane_reserve > KEXTLOG_LANE_RESERVE_MAX(log_conf.recvsize)) {
+        log_conf.lane_reserve = KEXTLOG_LANE_RESERVE_MAX(log_conf.recvsize);
+    }
+    kctlreg.ctl_recvsize = log_conf.recvsize;
+    kctlreg_stream.ctl_recvsize = log_conf.recvsize;
+
+    e = ctl_register(&kctlreg, &kctlref);
+    if (e != 0) {
+        LOG_ERR("ctl_register() fail  name: %s errno: %d", KEXTLOG_KCTL_NAME, e);
+        goto out_exit;
+    }
+    LOG_DBG("kctl %s registered  ref: %p recvsize: %u", KEXTLOG_KCTL_NAME, kctlref, log_conf.recvsize);
+
+    e = ctl_register(&kctlreg_stream, &kctlref_stream);
+    if (e != 0) {
+        LOG_ERR("ctl_register() fail  name: %s errno: %d", KEXTLOG_KCTL_STREAM_NAME, e);
+        (void) ctl_deregister(kctlref);
+        goto out_exit;
+    }
+    LOG_DBG("kctl %s registered  ref: %p", KEXTLOG_KCTL_STREAM_NAME, kctlref_stream);
+
+out_exit:
+    return e ? KERN_FAILURE : KERN_SUCCESS;
+}
+
+kern_return_t log_kctl_deregister(void)
+{
+    errno_t e = 0;
+    /* ctl_deregister(NULL) returns EINVAL */
+    e = ctl_deregister(kctlref_stream);
+    if (e != 0) {
+        LOG_ERR("ctl_deregister() fail  ref: %p errno: %d", kctlref_stream, e);
+        goto out_exit;
+    }
+    LOG_DBG("kctl %s deregistered  ref: %p", KEXTLOG_KCTL_STREAM_NAME, kctlref_stream);
+
+    e = ctl_deregister(kctlref);
+    if (e != 0) {
+        LOG_ERR("ctl_deregister() fail  ref: %p errno: %d", kctlref, e);
+        /* Keep both or neither registered */
+        if (ctl_register(&kctlreg_stream, &kctlref_stream) != 0) {
+            LOG_ERR("cannot register kctl %s again", KEXTLOG_KCTL_STREAM_NAME);
+        }
+        goto out_exit;
+    }
+    LOG_DBG("kctl %s deregistered  ref: %p", KEXTLOG_KCTL_NAME, kctlref);
+
+out_exit:
+    return e ? KERN_FAILURE : KERN_SUCCESS;
+}
+
+/*
+ * Per-CPU latency histograms of log_printf() phases  in nanoseconds
+ *  allocated along with rings  phases before that are not recorded
+ */
+struct kextlog_latency {
+    struct hist h[KEXTLOG_LAT_NPHASE];
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+static void *lat_mem = NULL;
+static struct kextlog_latency * volatile lat = NULL;
+static uint32_t lat_nshard = 0;
+
+/**
+ * @return      timestamp to start a phase  zero if latency disabled
+ */
+static inline uint64_t lat_begin(void)
+{
+    return log_conf.latency && lat != NULL ? mach_absolute_time() : 0;
+}
+
+/**
+ * Record a phase started at t0
+ * @return      end timestamp of the phase  thus next phase can start from it
+ *              zero if the phase not recorded
+ */
+static inline uint64_t lat_end(uint32_t phase, uint64_t t0)
+{
+    struct kextlog_latency *l = lat;
+    uint64_t t1;
+    uint64_t ns;
+
+    if (t0 == 0 || l == NULL) return 0;
+
+    t1 = mach_absolute_time();
+    absolutetime_to_nanoseconds(t1 - t0, &ns);
+    hist_record(&l[(uint32_t) cpu_number() % lat_nshard].h[phase], ns);
+    return t1;
+}
+
+/**
+ * Merge latency histograms of all CPUs
+ * @out         (OUT) merged histogram
+ */
+void log_latency_read(uint32_t phase, struct hist *out)
+{
+    struct kextlog_latency *l = lat;
+    uint32_t i;
+
+    kassertf(phase < KEXTLOG_LAT_NPHASE, "Bad latency phase %u", phase);
+    kassert_nonnull(out);
+
+    (void) memset(out, 0, sizeof(*out));
+    if (l == NULL) return;
+
+    for (i = 0; i < lat_nshard; i++) hist_merge(out, &l[i].h[phase]);
+}
+
+#define MSG_BUFSZ       4096
+
+/*
+ * Fallback buffers of log_syslog()  one per CPU
+ *  a busy buffer is never waited  neighbours are probed instead
+ *  and a small stack buffer is the last resort
+ */
+#define KEXTLOG_SYSLOG_BUFSZ        1024
+#define KEXTLOG_SYSLOG_STACKSZ      256
+#define KEXTLOG_SYSLOG_PROBE        4
+
+struct kextlog_syslog_buf {
+    volatile UInt32 busy;
+    char buf[KEXTLOG_SYSLOG_BUFSZ];
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+static struct kextlog_syslog_buf syslog_bufs[KEXTLOG_NCPU_MAX];
+
+/**
+ * Print a formatted message to system message buffer
+ */
+static void log_syslog_str(uint32_t level, const char *str)
+{
+    kassert_nonnull(str);
+
+    switch (level) {
+    case KEXTLOG_LEVEL_TRACE:
+        LOG_TRACE("%s", str);
+        break;
+    case KEXTLOG_LEVEL_DEBUG:
+        LOG_DBG("%s", str);
+        break;
+    case KEXTLOG_LEVEL_INFO:
+        LOG("%s", str);
+        break;
+    case KEXTLOG_LEVEL_WARNING:
+        LOG_WARN("%s", str);
+        break;
+    case KEXTLOG_LEVEL_ERROR:
+        LOG_ERR("%s", str);
+        break;
+    default:
+        panicf("unswitched log level %u", level);
+    }
+}
+
+/**
+ * Print message to system message buffer(last resort)
+ * The message may truncated if it's far too large
+ *
+ * Never blocks nor spins  callers on different CPUs don't contend
+ */
+static void log_syslog(uint32_t level, const char *fmt, va_list ap)
+{
+    struct kextlog_syslog_buf *b = NULL;
+    char stackbuf[KEXTLOG_SYSLOG_STACKSZ];
+    uint32_t cpu;
+    uint32_t i;
+    uint64_t t0;
+    Boolean ok;
+
+    kassert_nonnull(fmt);
+
+    t0 = lat_begin();
+    cpu = (uint32_t) cpu_number();
+    for (i = 0; i < KEXTLOG_SYSLOG_PROBE; i++) {
+        b = &syslog_bufs[(cpu + i) % KEXTLOG_NCPU_MAX];
+        if (b->busy == 0 && OSCompareAndSwap(0, 1, &b->busy)) break;
+        log_stat_inc(syslog_contended);
+    }
+    (void) lat_end(KEXTLOG_LAT_SPIN, t0);
+
+    if (i < KEXTLOG_SYSLOG_PROBE) {
+        (void) vsnprintf(b->buf, sizeof(b->buf), fmt, ap);
+        log_syslog_str(level, b->buf);
+
+        ok = OSCompareAndSwap(1, 0, &b->busy);
+        kassertf(ok, "OSCompareAndSwap() 1 to 0 fail  val: %#x", b->busy);
+    } else {
+        /* All probed buffers busy  a truncated message is better than a stall */
+        log_stat_inc(syslog_stackbuf);
+        (void) vsnprintf(stackbuf, sizeof(stackbuf), fmt, ap);
+        log_syslog_str(level, stackbuf);
+    }
+}
+
+/*
+ * Each CPU has its own lock-free MPSC ring  log_printf() callers only
+ *  contend with threads running on the same CPU
+ *
+ * Rings are drained by a single consumer thread  which is the only one
+ *  calls ctl_enqueuedata()
+ *
+ * Each CPU has one ring per priority lane  so a flood of low level messages
+ *  can never take ring space of high level ones
+ * High lane is drained first  order across lanes is not preserved
+ */
+#define KEXTLOG_RING_SIZE           16384   /* Per-CPU ring size  power of 2 */
+#define KEXTLOG_DRAIN_QUOTA         64      /* Max records per ring per pass */
+#define KEXTLOG_CONSUMER_TIMEOUT    10      /* Consumer idle sleep in ms */
+/* Drop-oldest policy evicts records beyond this ring usage */
+#define KEXTLOG_EVICT_WATERMARK     (KEXTLOG_RING_SIZE / 4 * 3)
+
+#define CONSUMER_STOPPED            0
+#define CONSUMER_RUNNING            1
+#define CONSUMER_STOPPING           2
+
+static void *ring_mem = NULL;
+static void *ring_data = NULL;
+static struct ringbuf *rings = NULL;     /* nring rings of each lane */
+static uint32_t nring = 0;
+
+/**
+ * @return      current CPU's ring of a lane
+ */
+static inline struct ringbuf *log_ring(uint32_t lane)
+{
+    return &rings[lane * nring + (uint32_t) cpu_number() % nring];
+}
+
+/*
+ * Per-CPU size-class pools for messages overflowed the stack buffer
+ *  heap is used only when the pool of a size class runs out
+ *
+ * A block can be freed from any CPU  it always goes back to its own pool
+ */
+static const struct {
+    uint32_t bsize;
+    uint32_t nblock;                /* Blocks per CPU */
+} pool_class[KEXTLOG_POOL_NCLASS] = {
+    {256, 16},
+    {512, 8},
+    {1024, 4},
+    {4096, 2},
+};
+
+struct kextlog_pools {
+    struct mpool mp[KEXTLOG_POOL_NCLASS];
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+static void *pool_mem = NULL;
+static void *pool_data = NULL;
+static struct kextlog_pools *pools = NULL;
+
+static volatile UInt32 consumer_state = CONSUMER_STOPPED;
+/* Nonzero if consumer has been(or will be) woken up */
+static volatile UInt32 consumer_kick = 0;
+/*
+ * Subscribers whose messages dropped since their last successful enqueue
+ *  bit i denotes subs[i]  producers drop messages for all of them
+ */
+static volatile UInt32 last_dropped = 0;
+
+/**
+ * @submask     subscribers the record goes to  zero if all  see: log_stamp()
+ * @return      nonzero if the subscriber wants the record
+ */
+static inline int sub_wants(const struct kextlog_sub *sub, const struct kextlog_msghdr *msg, uint32_t submask)
+{
+    return msg->level >= sub->level_min && (sub->scope_mask & (1u << msg->scope)) &&
+            (submask == 0 || (submask & SUB_BIT(sub)));
+}
+
+static inline void fmtdict_reset(struct kextlog_sub *sub)
+{
+    (void) memset(sub->fmtdict, 0, sizeof(sub->fmtdict));
+}
+
+/**
+ * Catch up with connects and disconnects  consumer private states of
+ *  a subscriber are reset if its slot taken by another connection
+ * A subscriber not started yet is seen as disconnected  see: KEXTLOG_SOCKOPT_START
+ */
+static void log_sub_sync(void)
+{
+    struct kextlog_sub *sub;
+    u_int32_t unit;
+    uint32_t gen;
+    uint64_t now = 0;
+
+    nsub_synced = 0;
+    nsub_held = 0;
+    for (sub = subs; sub < subs + KEXTLOG_SUB_MAX; sub++) {
+        unit = sub->unit;
+        /* Pairs with the barrier of log_kctl_connect() */
+        OSMemoryBarrier();
+        gen = sub->gen;
+        if (unit != 0 && sub->state != SUB_STARTED) {
+            /* Client predates KEXTLOG_SOCKOPT_START  if it negotiated nothing in time */
+            if (now == 0) now = mach_absolute_time();
+            if (now < sub->hold_deadline) nsub_held++;
+            if (now < sub->hold_deadline || !OSCompareAndSwap(SUB_HELD, SUB_STARTED, &sub->state)) unit = 0;
+        }
+        if (unit != 0) nsub_synced++;
+        if (unit == sub->cunit && (unit == 0 || gen == sub->cgen)) continue;
+
+        /* Records batched for the previous connection have nowhere to go */
+        sub->cunit = unit;
+        sub->cgen = gen;
+        sub->cref = sub->ref;
+        sub->cstream = sub->stream;
+        /* Pairs with the barrier of KEXTLOG_SOCKOPT_START */
+        OSMemoryBarrier();
+        sub->ccompress = sub->compress != 0;
+        sub->batch_len = 0;
+        sub->batch_cnt = 0;
+        sub->send_seq = 0;
+        sub->report = 1;
+        fmtdict_reset(sub);
+        hdrpack_dict_reset(&sub->dict);
+        (void) OSBitAndAtomic(~SUB_BIT(sub), &last_dropped);
+    }
+}
+
+/*
+ * Format id of a binary record is offset of its format string from an anchor
+ *  in kext image  so no kernel address ever leaks into user space(KASLR)
+ * Format strings live as long as the kext  thus an id is stable and unique
+ *  and never zero since the anchor itself is no format
+ */
+static const char fmt_anchor[1] = "";
+
+static inline uint64_t fmt_id_of(const char *fmt)
+{
+    return (uint64_t) ((uintptr_t) fmt - (uintptr_t) fmt_anchor);
+}
+
+static inline const char *fmt_of_id(uint64_t id)
+{
+    return (const char *) ((uintptr_t) fmt_anchor + (uintptr_t) id);
+}
+
+/**
+ * @return      1 if the format newly defined  0 if it's already defined
+ */
+static int fmtdict_insert(struct kextlog_sub *sub, uint64_t id)
+{
+    /* Knuth's multiplicative hash  low 3 bits of an id hardly vary */
+    uint32_t h = (uint32_t) (id >> 3) * 2654435761u;
+    uint64_t *slot;
+    uint32_t i;
+
+    for (i = 0; i < FMTDICT_PROBE; i++) {
+        slot = &sub->fmtdict[(h + i) & (FMTDICT_SIZE - 1)];
+        if (*slot == id) return 0;
+        if (*slot == 0) {
+            *slot = id;
+            return 1;
+        }
+    }
+
+    /* Table crowded  define it every time */
+    return 1;
+}
+
+/**
+ * Undo the latest fmtdict_insert()
+ * No id inserted afterwards probed past its slot  so it's safe to empty
+ *  the slot in an open-addressing table without tombstones
+ */
+static void fmtdict_erase(struct kextlog_sub *sub, uint64_t id)
+{
+    uint32_t h = (uint32_t) (id >> 3) * 2654435761u;
+    uint64_t *slot;
+    uint32_t i;
+
+    for (i = 0; i < FMTDICT_PROBE; i++) {
+        slot = &sub->fmtdict[(h + i) & (FMTDICT_SIZE - 1)];
+        if (*slot == id) {
+            *slot = 0;
+            break;
+        }
+        if (*slot == 0) break;
+    }
+}
+
+/**
+ * Print a record to system message buffer  binary record rendered in place
+ * @buffer      message buffer  not necessarily follows msg
+ */
+static void log_consumer_syslog(const struct kextlog_msghdr *msg, const char *buffer)
+{
+    static char buf[MSG_BUFSZ];
+    struct kextlog_binmsg *bin;
+    const char *fmt;
+
+    if (msg->flags & KEXTLOG_FLAG_MSG_BINARY) {
+        bin = (struct kextlog_binmsg *) buffer;
+        fmt = fmt_of_id(bin->fmt_id);
+        if (fmtpack_render(buf, sizeof(buf), fmt, bin->data, msg->size - sizeof(*bin)) < 0) {
+            (void) snprintf(buf, sizeof(buf), "(malformed binary message) %s", fmt);
+        }
+        log_syslog_str(msg->level, buf);
+    } else {
+        log_syslog_str(msg->level, buffer);
+    }
+}
+
+/**
+ * Push records into a SOCK_STREAM kctl along with a frame header
+ *  both or neither are enqueued  since we're the only writer
+ *  free space checked can only grow
+ * @return      0 if success  errno otherwise
+ */
+static errno_t log_consumer_send_frame(kern_ctl_ref ref, u_int32_t unit, void *data, uint32_t len, uint32_t cnt)
+{
+    struct kextlog_frame frame = {KEXTLOG_FRAME_MAGIC, len, cnt, 0};
+    size_t space = 0;
+    errno_t e;
+
+    e = ctl_getenqueuespace(ref, unit, &space);
+    if (e != 0) return e;
+    if (space < sizeof(frame) + len) return ENOBUFS;
+
+    e = ctl_enqueuedata(ref, unit, &frame, sizeof(frame), CTL_DATA_NOWAKEUP);
+    if (e != 0) return e;
+    log_stat_inc(frames);
+
+    /* Should never fail  reader resynchronizes on the dangling header if it does */
+    return ctl_enqueuedata(ref, unit, data, len, 0);
+}
+
+/*
+ * Batch compression  see: KEXTLOG_SOCKOPT_COMPRESS
+ * Owned by the consumer thread  frame header and payload are staged
+ *  together  so a single ctl_enqueuedata() pushes both or neither
+ */
+#define KEXTLOG_LZ_MIN              256     /* Smaller batches hardly compress */
+
+static struct lzpack_ctx lz_ctx;
+static uint8_t lz_buf[sizeof(struct kextlog_frame) + KEXTLOG_RING_SIZE] __attribute__ ((aligned (8)));
+
+/**
+ * Push records into a compressing subscriber  always framed
+ *  records are sent as is if compression doesn't save a byte
+ * @return      0 if success  errno otherwise
+ */
+static errno_t log_consumer_send_lz(kern_ctl_ref ref, u_int32_t unit, int stream, void *data, uint32_t len, uint32_t cnt)
+{
+    struct kextlog_frame *frame = (struct kextlog_frame *) lz_buf;
+    size_t n = 0;
+    errno_t e;
+
+    kassert_le(len, sizeof(lz_buf) - sizeof(*frame), "%u", "%zu");
+
+    /* Output capped below len  so the block is always smaller */
+    if (len >= KEXTLOG_LZ_MIN) n = lzpack_compress(&lz_ctx, data, len, frame + 1, len - 1);
+
+    if (n == 0) {
+        if (stream) return log_consumer_send_frame(ref, unit, data, len, cnt);
+        (void) memcpy(frame + 1, data, len);
+        frame->len = len;
+        frame->raw_len = 0;
+    } else {
+        frame->len = (uint32_t) n;
+        frame->raw_len = len;
+    }
+    frame->magic = KEXTLOG_FRAME_MAGIC;
+    frame->cnt = cnt;
+
+    e = ctl_enqueuedata(ref, unit, frame, sizeof(*frame) + frame->len, 0);
+    if (e == 0) {
+        log_stat_inc(frames);
+        if (n != 0) {
+            log_stat_add(lz_raw, len);
+            log_stat_add(lz_packed, n);
+        }
+    }
+    return e;
+}
+
+/**
+ * Push one or more consecutive records into user space
+ * @sub         subscriber to push to
+ * @data        records to send
+ * @len         total length of records
+ * @cnt         number of records
+ */
+static void log_consumer_send(struct kextlog_sub *sub, void *data, uint32_t len, uint32_t cnt)
+{
+    kern_ctl_ref ref = sub->cref;
+    u_int32_t unit = sub->cunit;
+    struct kextlog_msghdr *msg = (struct kextlog_msghdr *) data;
+    struct kextlog_msghdr hdr;
+    struct hdrpack_state st;
+    static struct hdrpack_dict scratch;
+    const char *buffer;
+    uint32_t bit = SUB_BIT(sub);
+    uint32_t i;
+    int n;
+    errno_t e;
+
+    kassert_nonnull(data);
+    kassert_gt(cnt, 0, "%u", "%u");
+
+    if (unit == 0) {
+        e = ENOTCONN;
+    } else {
+        if ((last_dropped & bit) && (OSBitAndAtomic(~bit, &last_dropped) & bit)) {
+            if (wire_packed(sub->cwire)) {
+                hdrpack_or_flags(data, KEXTLOG_FLAG_MSG_DROPPED);
+            } else {
+                msg->flags |= KEXTLOG_FLAG_MSG_DROPPED;
+            }
+        }
+        /* Message buffer's `\0' will also push into user space */
+        if (sub->ccompress) {
+            e = log_consumer_send_lz(ref, unit, sub->cstream, data, len, cnt);
+        } else if (sub->cstream) {
+            e = log_consumer_send_frame(ref, unit, data, len, cnt);
+        } else {
+            e = ctl_enqueuedata(ref, unit, data, len, 0);
+        }
+    }
+
+    if (e == 0) {
+        if (cnt > 1) log_stat_inc(batch);
+        return;
+    }
+
+    (void) OSBitOrAtomic(bit, &last_dropped);
+    if (unit != 0) {
+        LOG_ERR("ctl_enqueuedata() fail  ref: %p unit: %u len: %u cnt: %u errno: %d", ref, unit, len, cnt, e);
+    }
+
+    /* Format and thread definitions may lost along with the records */
+    fmtdict_reset(sub);
+    hdrpack_dict_reset(&sub->dict);
+
+    hdrpack_reset(&st);
+    /* Threads of records are of no use here  a scratch dictionary will do */
+    hdrpack_dict_reset(&scratch);
+    for (i = 0; i < cnt; i++) {
+        if (wire_packed(sub->cwire)) {
+            n = hdrpack_decode(&st, sub->cwire == KEXTLOG_WIRE_V3 ? &scratch : NULL, msg, len, &hdr, &buffer);
+            kassertf(n > 0, "Malformed V2 record  len: %u", len);
+        } else {
+            kassert_le(sizeof(*msg) + msg->size, len, "%zu", "%u");
+            hdr = *msg;
+            buffer = msg->buffer;
+            n = (int) (sizeof(*msg) + msg->size);
+        }
+
+        if (hdr.flags & KEXTLOG_FLAG_DROP_REPORT) {
+            /*
+             * A report is about drops  counting or syslog it as a dropped
+             *  message feeds back into the next report  just resend it
+             */
+            sub->report = 1;
+        } else if (!(hdr.flags & KEXTLOG_FLAG_FMT_DEFINE)) {
+            log_stat_inc(enqueue_failure);
+            log_stat_inc(dropped[hdr.level]);
+            /* Other subscribers may still have it */
+            if (nsub_synced <= 1) {
+                log_stat_inc(syslog);
+                log_consumer_syslog(&hdr, buffer);
+            }
+        }
+
+        len -= (uint32_t) n;
+        msg = (struct kextlog_msghdr *) ((char *) msg + n);
+    }
+}
+
+static void log_batch_flush(struct kextlog_sub *sub)
+{
+    if (sub->batch_len != 0) {
+        log_consumer_send(sub, sub->batch_buf, sub->batch_len, sub->batch_cnt);
+        sub->batch_len = 0;
+        sub->batch_cnt = 0;
+    }
+}
+
+/*
+ * Staging buffer of an oversized V2 record  a packed record is never
+ *  longer than its V1 one  which always fits in a ring
+ */
+static uint8_t pack_buf[KEXTLOG_RING_SIZE];
+
+/**
+ * Pack a record for a V2 or V3 subscriber
+ * @return      bytes written
+ */
+static inline size_t log_consumer_pack(struct kextlog_sub *sub, struct hdrpack_state *st, const struct kextlog_msghdr *msg, void *out)
+{
+    size_t n;
+
+    n = hdrpack_encode(st, sub->cwire == KEXTLOG_WIRE_V3 ? &sub->dict : NULL, msg, out);
+    log_stat_add(v2_raw, sizeof(*msg) + msg->size);
+    log_stat_add(v2_packed, n);
+    return n;
+}
+
+/**
+ * Queue a record for a subscriber  msg is left intact except its seq
+ *  V2 records are packed on the fly  see: hdrpack.h
+ */
+static void log_consumer_push(struct kextlog_sub *sub, struct kextlog_msghdr *msg, uint32_t len)
+{
+    uint32_t bsize = log_conf.batch_size;
+    uint32_t flags;
+    uint64_t latency;
+    struct hdrpack_state st;
+    size_t n;
+
+    BUILD_BUG_ON(HDRPACK_MAX > sizeof(struct kextlog_msghdr));
+    kassertf(sizeof(*msg) + msg->size == len, "Message size mismatch  %zu vs %u", sizeof(*msg) + msg->size, len);
+
+    /* A batch never mixes wire formats */
+    if (sub->cwire != sub->wire) {
+        log_batch_flush(sub);
+        sub->cwire = sub->wire;
+        hdrpack_dict_reset(&sub->dict);
+    }
+
+    /* Batching disabled or the record is oversized */
+    if (len > bsize) {
+        log_batch_flush(sub);
+        msg->seq = sub->send_seq++;
+        if (wire_packed(sub->cwire)) {
+            kassert_le(len, sizeof(pack_buf), "%u", "%zu");
+            hdrpack_reset(&st);
+            n = log_consumer_pack(sub, &st, msg, pack_buf);
+            log_consumer_send(sub, pack_buf, (uint32_t) n, 1);
+            return;
+        }
+        /* Sent in place  drop flag of this subscriber must not leak to others */
+        flags = msg->flags;
+        log_consumer_send(sub, msg, len, 1);
+        msg->flags = flags;
+        return;
+    }
+
+    if (sub->batch_len + len > bsize) log_batch_flush(sub);
+
+    if (sub->batch_len == 0) {
+        nanoseconds_to_absolutetime((uint64_t) log_conf.batch_latency * 1000000, &latency);
+        sub->batch_deadline = mach_absolute_time() + latency;
+        hdrpack_reset(&sub->pack);
+    }
+
+    msg->seq = sub->send_seq++;
+
+    if (wire_packed(sub->cwire)) {
+        n = log_consumer_pack(sub, &sub->pack, msg, sub->batch_buf + sub->batch_len);
+        sub->batch_len += (uint32_t) n;
+    } else {
+        (void) memcpy(sub->batch_buf + sub->batch_len, msg, len);
+        sub->batch_len += len;
+    }
+    sub->batch_cnt++;
+
+    if (sub->batch_len >= bsize) log_batch_flush(sub);
+}
+
+/**
+ * Send drop reports to new subscribers  and to all if any drop count changed
+ */
+static void log_consumer_report(void)
+{
+    struct {
+        struct kextlog_msghdr hdr;
+        struct kextlog_dropmsg drop;
+    } rec;
+    struct kextlog_sub *sub;
+    uint32_t i;
+
+    if (nsub_synced == 0) return;
+
+    for (i = 0; i < KEXTLOG_NLEVEL; i++) {
+        rec.drop.dropped[i] = log_stat_sum(KEXTLOG_STAT_OFF(dropped[i]));
+    }
+
+    rec.hdr.pid = 0;
+    rec.hdr.scope = KEXTLOG_SCOPE_NONE;
+    rec.hdr.tid = 0;
+    rec.hdr.timestamp = mach_absolute_time();
+    rec.hdr.level = KEXTLOG_LEVEL_INFO;
+    rec.hdr.flags = KEXTLOG_FLAG_DROP_REPORT;
+    rec.hdr.size = sizeof(rec.drop);
+    rec.hdr._padding = _KEXTLOG_PADDING_MAGIC;
+    rec.hdr.seq = 0;
+
+    sub_foreach(sub) {
+        if (!sub->report && memcmp(sub->reported, rec.drop.dropped, sizeof(sub->reported)) == 0) continue;
+
+        sub->report = 0;
+        (void) memcpy(sub->reported, rec.drop.dropped, sizeof(sub->reported));
+        log_consumer_push(sub, &rec.hdr, sizeof(rec));
+    }
+}
+
+#define KEXTLOG_FMTDEF_SIZE         512
+
+struct kextlog_fmtdef {
+    struct kextlog_msghdr hdr;
+    struct kextlog_binmsg bin;
+    char fmt[KEXTLOG_FMTDEF_SIZE];
+};
+
+/**
+ * Make sure format of a binary record defined to current client
+ * @return      0 if the format defined  -1 if it's too long to define
+ */
+static int log_consumer_define(struct kextlog_sub *sub, const struct kextlog_msghdr *msg)
+{
+    static struct kextlog_fmtdef def;
+    struct kextlog_binmsg *bin = (struct kextlog_binmsg *) msg->buffer;
+    const char *fmt;
+    size_t n;
+
+    if (!fmtdict_insert(sub, bin->fmt_id)) return 0;
+
+    fmt = fmt_of_id(bin->fmt_id);
+    n = strlcpy(def.fmt, fmt, sizeof(def.fmt));
+    if (n >= sizeof(def.fmt)) {
+        /* Never defined to client  its records must be rendered here */
+        fmtdict_erase(sub, bin->fmt_id);
+        return -1;
+    }
+
+    def.hdr.pid = msg->pid;
+    def.hdr.scope = msg->scope;
+    def.hdr.tid = msg->tid;
+    def.hdr.timestamp = msg->timestamp;
+    def.hdr.level = msg->level;
+    def.hdr.flags = KEXTLOG_FLAG_FMT_DEFINE;
+    def.hdr.size = (uint32_t) (sizeof(def.bin) + n + 1);
+    def.hdr._padding = _KEXTLOG_PADDING_MAGIC;
+    def.hdr.seq = 0;
+    def.bin.fmt_id = bin->fmt_id;
+
+    log_consumer_push(sub, &def.hdr, sizeof(def.hdr) + def.hdr.size);
+    return 0;
+}
+
+/**
+ * Render a binary record into a text one  used if its format cannot be defined
+ */
+static void log_consumer_render(struct kextlog_sub *sub, const struct kextlog_msghdr *msg)
+{
+    static struct {
+        struct kextlog_msghdr hdr;
+        char buffer[MSG_BUFSZ];
+    } txt;
+    struct kextlog_binmsg *bin = (struct kextlog_binmsg *) msg->buffer;
+    const char *fmt = fmt_of_id(bin->fmt_id);
+    int len;
+
+    txt.hdr = *msg;
+    txt.hdr.flags &= ~KEXTLOG_FLAG_MSG_BINARY;
+
+    len = fmtpack_render(txt.buffer, sizeof(txt.buffer), fmt, bin->data, msg->size - sizeof(*bin));
+    if (len < 0) {
+        len = snprintf(txt.buffer, sizeof(txt.buffer), "(malformed binary message) %s", fmt);
+    }
+    if (len >= (int) sizeof(txt.buffer)) {
+        len = sizeof(txt.buffer) - 1;
+        txt.hdr.flags |= KEXTLOG_FLAG_MSG_TRUNCATED;
+    }
+    txt.hdr.size = (uint32_t) len + 1;
+
+    log_consumer_push(sub, &txt.hdr, sizeof(txt.hdr) + txt.hdr.size);
+}
+
+/**
+ * Hand a record to every subscriber wants it  formatted once for all
+ */
+static void log_consumer_forward(struct kextlog_msghdr *msg, uint32_t len)
+{
+    /* Taken before the first push stamps seq */
+    uint32_t submask = (uint32_t) msg->seq;
+    struct kextlog_sub *sub;
+
+    sub_foreach(sub) {
+        if (!sub_wants(sub, msg, submask)) continue;
+
+        if ((msg->flags & KEXTLOG_FLAG_MSG_BINARY) && log_consumer_define(sub, msg) != 0) {
+            log_consumer_render(sub, msg);
+        } else {
+            log_consumer_push(sub, msg, len);
+        }
+    }
+}
+
+/*
+ * Flight recorder  keeps the newest records while no client connected
+ *  replayed in order once a client connects
+ *
+ * Owned by the consumer thread  which is its only producer and consumer
+ */
+static void *flight_data = NULL;
+static struct ringbuf flight;
+static volatile uint32_t flight_size = 0;   /* Zero if disabled */
+
+/**
+ * @return      effective flight recorder size of a configured one
+ */
+static uint32_t log_flight_size(uint32_t size)
+{
+    if (size < KEXTLOG_FLIGHT_SIZE_MIN) return 0;
+    if (size > KEXTLOG_FLIGHT_SIZE_MAX) size = KEXTLOG_FLIGHT_SIZE_MAX;
+    /* Round down to power of 2 */
+    return 1u << (31 - __builtin_clz(size));
+}
+
+/**
+ * Drop the oldest record of flight recorder
+ * @return      0 if success  ENOENT if it's empty
+ */
+static int log_flight_drop(void)
+{
+    struct kextlog_msghdr *msg;
+
+    msg = (struct kextlog_msghdr *) ringbuf_peek(&flight, NULL);
+    if (msg == NULL) return ENOENT;
+
+    log_stat_inc(flight_overwritten);
+    log_stat_inc(dropped[msg->level]);
+    ringbuf_consume(&flight);
+    return 0;
+}
+
+/**
+ * Apply kextlog.flight.size  records in the old recorder are dropped
+ */
+static void log_flight_resize(void)
+{
+    uint32_t size = log_flight_size(log_conf.flight_size);
+    void *data = NULL;
+    int e;
+
+    if (size == flight_size) return;
+
+    if (size != 0) {
+        data = util_malloc0(size, M_WAITOK | M_NULL);
+        if (data == NULL) {
+            LOG_ERR("cannot allocate flight recorder  size: %u", size);
+            /* Revert so we won't retry in each round */
+            log_conf.flight_size = flight_size;
+            return;
+        }
+    }
+
+    if (flight_size != 0) {
+        while (log_flight_drop() == 0) continue;
+        util_mfree(flight_data);
+    }
+
+    flight_data = data;
+    flight_size = size;
+    if (size != 0) {
+        e = ringbuf_init(&flight, data, size);
+        kassert_eq(e, 0, "%d", "%d");
+    }
+
+    LOG_DBG("flight recorder resized to %u bytes", size);
+}
+
+/**
+ * Save a record into flight recorder  oldest records are overwritten if full
+ */
+static void log_flight_store(const struct kextlog_msghdr *msg, uint32_t len)
+{
+    void *p;
+
+    while ((p = ringbuf_reserve(&flight, len)) == NULL) {
+        if (log_flight_drop() != 0) {
+            /* Larger than the whole recorder */
+            log_stat_inc(flight_overwritten);
+            log_stat_inc(dropped[msg->level]);
+            return;
+        }
+    }
+
+    (void) memcpy(p, msg, len);
+    /* Subscribers it was filtered for are gone  replay it to all */
+    ((struct kextlog_msghdr *) p)->seq = 0;
+    ringbuf_commit(&flight, p);
+    log_stat_inc(flight_stored);
+}
+
+/**
+ * Forward all records in flight recorder to the client
+ * @return      number of records replayed
+ */
+static uint32_t log_flight_replay(void)
+{
+    struct kextlog_msghdr *msg;
+    uint32_t len;
+    uint32_t n = 0;
+
+    while ((msg = (struct kextlog_msghdr *) ringbuf_peek(&flight, &len)) != NULL) {
+        log_consumer_forward(msg, len);
+        ringbuf_consume(&flight);
+        n++;
+    }
+
+    if (n != 0) {
+        log_stat_add(flight_replayed, n);
+        LOG_DBG("%u records replayed from flight recorder", n);
+    }
+
+    return n;
+}
+
+/**
+ * @return      bytes records of a lane may still take in kctl receive buffer
+ *              of the most backlogged subscriber
+ *              high lane always keeps kextlog.lane.reserve bytes to itself
+ */
+static size_t log_lane_budget(uint32_t lane)
+{
+    struct kextlog_sub *sub;
+    size_t budget = SIZE_MAX;
+    size_t space;
+    size_t reserve;
+    uint32_t lane_reserve = lane != KEXTLOG_LANE_HIGH ? log_conf.lane_reserve : 0;
+
+    /* Drop-oldest keeps records in rings  rather than overrun kctl */
+    if (lane_reserve == 0 && log_conf.backpressure != KEXTLOG_BP_DROP_OLDEST) return SIZE_MAX;
+
+    sub_foreach(sub) {
+        if (ctl_getenqueuespace(sub->cref, sub->cunit, &space) != 0) continue;
+        reserve = sub->batch_len + lane_reserve;
+        if (sub->cstream || sub->ccompress) reserve += sizeof(struct kextlog_frame);
+        space = space > reserve ? space - reserve : 0;
+        if (space < budget) budget = space;
+    }
+
+    return budget;
+}
+
+/**
+ * Drain per-CPU rings of a lane in round-robin fashion
+ * @return      number of records drained
+ */
+static uint32_t log_consumer_drain_lane(uint32_t lane)
+{
+    struct ringbuf *rb;
+    struct kextlog_msghdr *msg;
+    size_t budget = log_lane_budget(lane);
+    uint32_t len;
+    uint32_t i, j;
+    uint32_t n = 0;
+
+    for (i = 0; i < nring; i++) {
+        rb = &rings[lane * nring + i];
+        for (j = 0; j < KEXTLOG_DRAIN_QUOTA; j++) {
+            msg = (struct kextlog_msghdr *) ringbuf_peek(rb, &len);
+            if (msg == NULL) break;
+
+            if (nsub_synced == 0 && flight_size != 0) {
+                log_flight_store(msg, len);
+            } else if (nsub_synced == 0) {
+                /* Leave it to a client about to start  see: KEXTLOG_SOCKOPT_START */
+                if (nsub_held != 0) break;
+
+                /* Nobody to take it  syslog it as log_vprintf() does without clients */
+                log_stat_inc(dropped[msg->level]);
+                log_stat_inc(syslog);
+                log_consumer_syslog(msg, msg->buffer);
+            } else if (len > budget) {
+                /* Leave it in the ring  oldest records get evicted once it fills up */
+                if (log_conf.backpressure == KEXTLOG_BP_DROP_OLDEST) break;
+
+                /* Drop it here  rather than let it crowd out high lane in kctl */
+                last_dropped = SUB_ALL;
+                log_stat_inc(lane_dropped[lane]);
+                log_stat_inc(dropped[msg->level]);
+            } else {
+                if (budget != SIZE_MAX) budget -= len;
+                log_consumer_forward(msg, len);
+            }
+            ringbuf_consume(rb);
+        }
+        n += j;
+    }
+
+    return n;
+}
+
+/**
+ * Drop-oldest policy  discard oldest records of rings nearly full
+ *  so producers still find room for new ones
+ */
+static void log_consumer_evict(void)
+{
+    struct ringbuf *rb;
+    struct kextlog_msghdr *msg;
+    uint32_t len;
+    uint32_t i;
+
+    if (log_conf.backpressure != KEXTLOG_BP_DROP_OLDEST || nsub_synced == 0) return;
+
+    for (i = 0; i < KEXTLOG_NLANE * nring; i++) {
+        rb = &rings[i];
+        while (ringbuf_used(rb) > KEXTLOG_EVICT_WATERMARK) {
+            msg = (struct kextlog_msghdr *) ringbuf_peek(rb, &len);
+            if (msg == NULL) break;
+
+            last_dropped = SUB_ALL;
+            log_stat_inc(bp_evicted);
+            log_stat_inc(dropped[msg->level]);
+            ringbuf_consume(rb);
+        }
+    }
+}
+
+/*
+ * Number of producers sleeping for ring space  see: log_backpressure_wait()
+ */
+static volatile SInt32 bp_waiters = 0;
+
+static inline void log_backpressure_wakeup(void)
+{
+    if (bp_waiters != 0) wakeup((void *) &bp_waiters);
+}
+
+/**
+ * Drain all per-CPU rings  high lane first
+ * @return      number of records drained
+ */
+static uint32_t log_consumer_drain(void)
+{
+    uint32_t n = 0;
+    uint32_t lane;
+
+    for (lane = 0; lane < KEXTLOG_NLANE; lane++) n += log_consumer_drain_lane(lane);
+
+    return n;
+}
+
+/**
+ * @return      how long the consumer may sleep before next batch deadline
+ */
+static struct timespec log_consumer_timeout(void)
+{
+    uint32_t ms = log_conf.batch_size != 0 ? log_conf.batch_latency : KEXTLOG_CONSUMER_TIMEOUT;
+    struct kextlog_sub *sub;
+    uint64_t deadline = UINT64_MAX;
+    uint64_t now;
+    uint64_t ns;
+
+    sub_foreach(sub) {
+        if (sub->batch_len != 0 && sub->batch_deadline < deadline) deadline = sub->batch_deadline;
+    }
+
+    if (deadline != UINT64_MAX) {
+        now = mach_absolute_time();
+        ns = 0;
+        if (deadline > now) absolutetime_to_nanoseconds(deadline - now, &ns);
+    } else {
+        ns = (uint64_t) ms * 1000000;
+    }
+
+    /* Zero timeout in msleep() means sleep forever */
+    if (ns == 0) ns = 1;
+
+    return (struct timespec) {(time_t) (ns / 1000000000), (long) (ns % 1000000000)};
+}
+
+static void log_consumer(void *arg, wait_result_t wr)
+{
+    struct kextlog_sub *sub;
+    struct timespec ts;
+    uint64_t now;
+    uint32_t n;
+    Boolean ok;
+
+    UNUSED(arg, wr);
+
+    while (consumer_state == CONSUMER_RUNNING) {
+        if (flight_size != log_flight_size(log_conf.flight_size)) log_flight_resize();
+
+        log_sub_sync();
+        log_consumer_report();
+
+        /* Records in flight recorder are older than any in rings */
+        n = nsub_synced != 0 && flight_size != 0 ? log_flight_replay() : 0;
+        n += log_consumer_drain();
+        log_consumer_evict();
+        if (n != 0) log_backpressure_wakeup();
+
+        now = mach_absolute_time();
+        sub_foreach(sub) {
+            if (sub->batch_len != 0 && now >= sub->batch_deadline) log_batch_flush(sub);
+        }
+
+        if (n != 0) continue;
+
+        consumer_kick = 0;
+        /* Recheck since producers may commit before kick cleared */
+        if (log_consumer_drain() != 0) continue;
+
+        /*
+         * A wakeup may slip in between the recheck and msleep()
+         *  the timeout bounds latency of such lost wakeup
+         */
+        ts = log_consumer_timeout();
+        (void) msleep((void *) &consumer_kick, NULL, PSOCK, "kextlog_consumer", &ts);
+    }
+
+    while (log_consumer_drain() != 0) continue;
+    sub_foreach(sub) log_batch_flush(sub);
+    log_backpressure_wakeup();
+
+    ok = OSCompareAndSwap(CONSUMER_STOPPING, CONSUMER_STOPPED, &consumer_state);
+    kassertf(ok, "consumer state %u", consumer_state);
+    wakeup((void *) &consumer_state);
+}
+
+static inline void log_consumer_kick(void)
+{
+    if (consumer_kick == 0 && OSCompareAndSwap(0, 1, &consumer_kick)) {
+        wakeup((void *) &consumer_kick);
+    }
+}
+
+static uint32_t log_ncpu(void)
+{
+    int ncpu = 0;
+    size_t sz = sizeof(ncpu);
 
-/*
- * XXX: kctl can be connected in the interim of kext loading
- * You may happen to take further logic to
- *  prevent client from connecting in such case
+    if (sysctlbyname("hw.ncpu", &ncpu, &sz, NULL, 0) != 0 || ncpu <= 0) {
+        LOG_WARN("cannot get hw.ncpu  fallback to one ring");
+        ncpu = 1;
+    }
+
+    return ncpu < KEXTLOG_NCPU_MAX ? (uint32_t) ncpu : KEXTLOG_NCPU_MAX;
+}
+
+/**
+ * Allocate per-CPU message pools
+ * Pools are optional  messages go to heap if allocation failed
  */
-static errno_t log_kctl_connect(
-        kern_ctl_ref ref,
-        struct sockaddr_ctl *sac,
-        void **unitinfo)
+static void log_pool_init(void)
 {
-    errno_t e = 0;
+    uint32_t percpu = 0;
+    uint32_t off;
+    uint32_t i, c;
+    int e;
 
-    BUILD_BUG_ON(sizeof(u_int32_t) != sizeof(UInt32));
+    kassert_null(pools);
 
-    kassert(ref == kctlref);
+    for (c = 0; c < KEXTLOG_POOL_NCLASS; c++) {
+        percpu += pool_class[c].bsize * pool_class[c].nblock;
+    }
 
-    if (OSCompareAndSwap(0, sac->sc_unit, (UInt32 *) &kctlunit)) {
-        kassert_nonnull(unitinfo);
-        *unitinfo = NULL;
-        LOG_DBG("Log kctl connected  unit: %u", sac->sc_unit);
-    } else {
-        e = EISCONN;
-        LOG_WARN("Log kctl already connected  skip");
+    pool_mem = util_malloc0(nring * sizeof(*pools) + CACHE_LINE_SIZE, M_WAITOK | M_NULL | M_ZERO);
+    pool_data = util_malloc0(nring * percpu, M_WAITOK | M_NULL);
+    if (pool_mem == NULL || pool_data == NULL) {
+        LOG_WARN("cannot allocate message pools  %u bytes per CPU", percpu);
+        util_mfree(pool_data);
+        util_mfree(pool_mem);
+        pool_data = pool_mem = NULL;
+        return;
     }
 
-    return e;
+    pools = (struct kextlog_pools *) (((uintptr_t) pool_mem + CACHE_LINE_SIZE - 1) & ~((uintptr_t) CACHE_LINE_SIZE - 1));
+    for (i = 0; i < nring; i++) {
+        off = i * percpu;
+        for (c = 0; c < KEXTLOG_POOL_NCLASS; c++) {
+            e = mpool_init(&pools[i].mp[c], (uint8_t *) pool_data + off, pool_class[c].bsize, pool_class[c].nblock);
+            kassert_eq(e, 0, "%d", "%d");
+            off += pool_class[c].bsize * pool_class[c].nblock;
+        }
+    }
 }
 
-static errno_t log_kctl_disconnect(
-        kern_ctl_ref ref,
-        u_int32_t unit,
-        void *unitinfo)
+static void log_pool_fini(void)
 {
-    UNUSED(ref);
-    if (OSCompareAndSwap(unit, 0, &kctlunit)) {
-        kassert(unitinfo == NULL);
-        LOG_DBG("Log kctl client disconnected  unit: %u", unit);
-    } else {
-        /* Refused clients */
+    uint32_t i, c;
+
+    if (pools == NULL) return;
+
+    for (i = 0; i < nring; i++) {
+        for (c = 0; c < KEXTLOG_POOL_NCLASS; c++) {
+            kassertf(pools[i].mp[c].inuse == 0, "Pool %u/%u still has %u blocks in use",
+                        i, pool_class[c].bsize, pools[i].mp[c].inuse);
+        }
     }
-    return 0;
+
+    pools = NULL;
+    util_mfree(pool_data);
+    util_mfree(pool_mem);
+    pool_data = pool_mem = NULL;
 }
 
-kern_return_t log_kctl_register(void)
+/**
+ * Allocate a message buffer which overflowed the stack buffer
+ * @mpp     (OUT) pool the buffer taken from  NULL if it's from heap
+ * @return  the buffer  NULL if out of memory
+ */
+static void *log_msg_alloc(size_t size, struct mpool **mpp)
 {
-    errno_t e = ctl_register(&kctlreg, &kctlref);
-    if (e == 0) {
-        LOG_DBG("kctl %s registered  ref: %p", KEXTLOG_KCTL_NAME, kctlref);
+    struct kextlog_statistics *st;
+    struct mpool *mp;
+    uint64_t hw;
+    uint32_t i, c;
+    void *p;
+
+    kassert_nonnull(mpp);
+    *mpp = NULL;
+
+    for (c = 0; c < KEXTLOG_POOL_NCLASS && size > pool_class[c].bsize; c++) continue;
+
+    if (c < KEXTLOG_POOL_NCLASS && pools != NULL) {
+        i = (uint32_t) cpu_number() % nring;
+        mp = &pools[i].mp[c];
+        p = mpool_get(mp);
+        if (p != NULL) {
+            log_stat_inc(pool_hit[c]);
+            /* High-water mark goes to counters of the pool's CPU */
+            st = &log_stat[i];
+            hw = mp->hiwat;
+            while (hw > st->pool_hiwat[c]) {
+                (void) OSCompareAndSwap64(st->pool_hiwat[c], hw, &st->pool_hiwat[c]);
+            }
+            *mpp = mp;
+            return p;
+        }
+        log_stat_inc(pool_miss[c]);
+    }
+
+    p = util_malloc0(size, M_WAITOK | M_NULL);
+    if (p != NULL) log_stat_inc(heapmsg);
+    return p;
+}
+
+static inline void log_msg_free(void *p, struct mpool *mp)
+{
+    if (mp != NULL) {
+        mpool_put(mp, p);
     } else {
-        LOG_ERR("ctl_register() fail  errno: %d", e);
+        /* util_mfree(NULL, type) do nop */
+        util_mfree(p);
     }
-    return e ? KERN_FAILURE : KERN_SUCCESS;
 }
 
-kern_return_t log_kctl_deregister(void)
+/**
+ * Allocate per-CPU rings and start the consumer thread
+ * Must be called before log_kctl_register()
+ */
+kern_return_t log_kctl_init(void)
 {
-    errno_t e = 0;
-    /* ctl_deregister(NULL) returns EINVAL */
-    e = ctl_deregister(kctlref);
-    if (e == 0) {
-        LOG_DBG("kctl %s deregistered  ref: %p", KEXTLOG_KCTL_NAME, kctlref);
+    kern_return_t r;
+    thread_t thread;
+    uint32_t i;
+    int e;
+
+    kassert_null(rings);
+
+    log_ratelimit_update();
+
+    nring = log_ncpu();
+
+    /* Over-allocate so rings can be aligned to cache line */
+    ring_mem = util_malloc0(KEXTLOG_NLANE * nring * sizeof(*rings) + CACHE_LINE_SIZE, M_WAITOK | M_NULL | M_ZERO);
+    ring_data = util_malloc0(KEXTLOG_NLANE * nring * KEXTLOG_RING_SIZE, M_WAITOK | M_NULL);
+    if (ring_mem == NULL || ring_data == NULL) {
+        LOG_ERR("cannot allocate %u rings", nring);
+        r = KERN_RESOURCE_SHORTAGE;
+        goto out_free;
+    }
+
+    rings = (struct ringbuf *) (((uintptr_t) ring_mem + CACHE_LINE_SIZE - 1) & ~((uintptr_t) CACHE_LINE_SIZE - 1));
+    for (i = 0; i < KEXTLOG_NLANE * nring; i++) {
+        e = ringbuf_init(&rings[i], (uint8_t *) ring_data + i * KEXTLOG_RING_SIZE, KEXTLOG_RING_SIZE);
+        kassert_eq(e, 0, "%d", "%d");
+    }
+
+    log_pool_init();
+
+    lat_nshard = nring;
+    lat_mem = util_malloc0(nring * sizeof(*lat) + CACHE_LINE_SIZE, M_WAITOK | M_NULL | M_ZERO);
+    if (lat_mem != NULL) {
+        lat = (struct kextlog_latency *) (((uintptr_t) lat_mem + CACHE_LINE_SIZE - 1) & ~((uintptr_t) CACHE_LINE_SIZE - 1));
     } else {
-        LOG_ERR("ctl_deregister() fail  ref: %p errno: %d", kctlref, e);
+        LOG_WARN("cannot allocate latency histograms  latency won't be recorded");
     }
-    return e ? KERN_FAILURE : KERN_SUCCESS;
+
+    consumer_state = CONSUMER_RUNNING;
+    r = kernel_thread_start(log_consumer, NULL, &thread);
+    if (r != KERN_SUCCESS) {
+        LOG_ERR("kernel_thread_start() fail  r: %d", r);
+        consumer_state = CONSUMER_STOPPED;
+        goto out_free;
+    }
+    thread_deallocate(thread);
+
+    LOG_DBG("%u rings allocated  consumer started", KEXTLOG_NLANE * nring);
+
+out_exit:
+    return r;
+
+out_free:
+    log_pool_fini();
+    lat = NULL;
+    util_mfree(lat_mem);
+    lat_mem = NULL;
+    rings = NULL;
+    util_mfree(ring_data);
+    util_mfree(ring_mem);
+    ring_data = ring_mem = NULL;
+    goto out_exit;
 }
 
-#define MSG_BUFSZ       4096
+/**
+ * Stop the consumer thread and free per-CPU rings
+ * Must be called after all log_printf() callers gone
+ */
+void log_kctl_fini(void)
+{
+    struct timespec ts = {0, KEXTLOG_CONSUMER_TIMEOUT * 1000000};
+
+    if (rings == NULL) return;
+
+    if (OSCompareAndSwap(CONSUMER_RUNNING, CONSUMER_STOPPING, &consumer_state)) {
+        wakeup((void *) &consumer_kick);
+        while (consumer_state != CONSUMER_STOPPED) {
+            (void) msleep((void *) &consumer_state, NULL, PWAIT, "kextlog_fini", &ts);
+        }
+    }
+
+    log_pool_fini();
+    lat = NULL;
+    util_mfree(lat_mem);
+    lat_mem = NULL;
+    rings = NULL;
+    util_mfree(ring_data);
+    util_mfree(ring_mem);
+    ring_data = ring_mem = NULL;
+
+    if (flight_size != 0) {
+        while (log_flight_drop() == 0) continue;
+        util_mfree(flight_data);
+        flight_data = NULL;
+        flight_size = 0;
+    }
+
+    LOG_DBG("consumer stopped  %u rings freed", KEXTLOG_NLANE * nring);
+}
 
 /**
- * Print message to system message buffer(last resort)
- * The message may truncated if it's far too large
+ * Block-with-timeout policy  sleep until current CPU's ring of a lane
+ *  has room for a full-sized message  or kextlog.backpressure.timeout expired
+ * Caller must be able to sleep  see: log_printf_sleep()
  */
-static inline void log_syslog(uint32_t level, const char *fmt, va_list ap)
+static void log_backpressure_wait(uint32_t lane)
 {
-    static char buf[MSG_BUFSZ];
-    static volatile uint32_t spin_lock = 0;
-    Boolean ok;
+    uint32_t need = (uint32_t) sizeof(struct kextlog_msghdr) + log_conf.msg_max + RINGBUF_HDRSZ;
+    uint64_t timeout;
+    uint64_t deadline;
+    uint64_t now;
+    uint64_t ns;
+    struct timespec ts;
+    int blocked = 0;
 
-    kassert_nonnull(fmt);
+    nanoseconds_to_absolutetime((uint64_t) log_conf.bp_timeout * 1000000, &timeout);
+    deadline = mach_absolute_time() + timeout;
 
-    /* vsnprintf, printf should fast  thus spin lock do no hurts? */
-    while (!OSCompareAndSwap(0, 1, &spin_lock)) continue;
+    /* CPU may change after each sleep */
+    while (KEXTLOG_RING_SIZE - ringbuf_used(log_ring(lane)) < need) {
+        now = mach_absolute_time();
+        if (now >= deadline || consumer_state != CONSUMER_RUNNING) {
+            log_stat_inc(bp_timeout);
+            break;
+        }
 
-    (void) vsnprintf(buf, MSG_BUFSZ, fmt, ap);
-    switch (level) {
-    case KEXTLOG_LEVEL_TRACE:
-        LOG_TRACE("%s", buf);
-        break;
-    case KEXTLOG_LEVEL_DEBUG:
-        LOG_DBG("%s", buf);
-        break;
-    case KEXTLOG_LEVEL_INFO:
-        LOG("%s", buf);
-        break;
-    case KEXTLOG_LEVEL_WARNING:
-        LOG_WARN("%s", buf);
-        break;
-    case KEXTLOG_LEVEL_ERROR:
-        LOG_ERR("%s", buf);
-        break;
-    default:
-        panicf("unswitched log level %u", level);
+        if (!blocked) {
+            blocked = 1;
+            log_stat_inc(bp_blocked);
+        }
+
+        absolutetime_to_nanoseconds(deadline - now, &ns);
+        if (ns == 0) ns = 1;
+        ts = (struct timespec) {(time_t) (ns / 1000000000), (long) (ns % 1000000000)};
+
+        (void) OSIncrementAtomic(&bp_waiters);
+        log_consumer_kick();
+        (void) msleep((void *) &bp_waiters, NULL, PSOCK, "kextlog_backpressure", &ts);
+        (void) OSDecrementAtomic(&bp_waiters);
     }
+}
+
+static inline void enqueue_kick(const struct ringbuf *rb)
+{
+    uint32_t bsize = log_conf.batch_size;
 
-    ok = OSCompareAndSwap(1, 0, &spin_lock);
-    kassertf(ok, "OSCompareAndSwap() 1 to 0 fail  val: %#x", spin_lock);
+    /* In batch mode  let the latency timer pick up small amount of records */
+    if (bsize == 0 || ringbuf_used(rb) >= bsize) log_consumer_kick();
 }
 
+/**
+ * Push a formatted message into current CPU's ring
+ * @return      0 if success  ENOBUFS if the ring is full
+ */
 static int enqueue_log(struct kextlog_msghdr *msg, size_t len)
 {
-    static uint8_t last_dropped = 0;
-    static volatile uint32_t spin_lock = 0;
-
-    kern_ctl_ref ref = kctlref;
-    u_int32_t unit = kctlunit;
-    errno_t e;
-    Boolean ok;
+    struct ringbuf *rb;
+    uint64_t t0;
+    void *p;
 
     kassert_nonnull(msg);
     kassertf(sizeof(*msg) + msg->size == len, "Message size mismatch  %zu vs %zu", sizeof(*msg) + msg->size, len);
 
-    /* TODO: use mutex instead of busy spin lock? */
-    while (!OSCompareAndSwap(0, 1, &spin_lock)) continue;
-
-    if (unit == 0) {
-        e = ENOTCONN;
-        goto out_unlock;
+    t0 = lat_begin();
+    rb = log_ring(KEXTLOG_LANE(msg->level));
+    p = ringbuf_reserve(rb, (uint32_t) len);
+    if (p == NULL) {
+        (void) lat_end(KEXTLOG_LAT_ENQUEUE, t0);
+        last_dropped = SUB_ALL;
+        log_stat_inc(ring_full);
+        log_stat_inc(lane_dropped[KEXTLOG_LANE(msg->level)]);
+        /* Let drop-oldest consumer make room for following ones */
+        log_consumer_kick();
+        return ENOBUFS;
     }
 
-    if (last_dropped) {
-        last_dropped = 0;
-        msg->flags |= KEXTLOG_FLAG_MSG_DROPPED;
+    (void) memcpy(p, msg, len);
+    ringbuf_commit(rb, p);
+    (void) lat_end(KEXTLOG_LAT_ENQUEUE, t0);
+    log_stat_add(bytes_enqueued, len);
+    log_stat_inc(messages[msg->level]);
+    enqueue_kick(rb);
+
+    return 0;
+}
+
+volatile uint32_t log_level_threshold[KEXTLOG_SCOPE_MAX] = {KEXTLOG_LEVEL_TRACE};
+
+/**
+ * Recompute effective level thresholds  call after log_conf.level_min changed
+ * A scope's threshold is the stricter one of its own and the global one
+ */
+void log_level_update(void)
+{
+    /*
+     * Connect  disconnect  setopt and sysctl may update concurrently
+     *  an unserialized caller could store thresholds computed from stale
+     *  filters after a fresher one  which hides messages a subscriber wants
+     */
+    static volatile UInt32 busy = 0;
+    uint32_t global;
+    uint32_t lv;
+    uint32_t want;
+    int i, j;
+
+    while (!OSCompareAndSwap(0, 1, &busy)) continue;
+
+    global = log_conf.level_min[KEXTLOG_SCOPE_NONE];
+    for (i = KEXTLOG_SCOPE_NONE; i < KEXTLOG_SCOPE_MAX; i++) {
+        lv = log_conf.level_min[i];
+        if (lv < global) lv = global;
+
+        /* Nobody is interested in messages below what any subscriber wants */
+        if (nsub != 0) {
+            want = KEXTLOG_LEVEL_ERROR + 1;
+            for (j = 0; j < KEXTLOG_SUB_MAX; j++) {
+                if (subs[j].unit != 0 && (subs[j].scope_mask & (1u << i)) && subs[j].level_min < want) {
+                    want = subs[j].level_min;
+                }
+            }
+            if (lv < want) lv = want;
+        }
+
+        log_level_threshold[i] = lv;
     }
 
-    /* Message buffer's `\0' will also push into user space */
-    e = ctl_enqueuedata(ref, unit, msg, len, 0);
+    OSMemoryBarrier();
+    busy = 0;
+}
 
-out_unlock:
-    if (e != 0) last_dropped = 1;
-    ok = OSCompareAndSwap(1, 0, &spin_lock);
-    kassertf(ok, "OSCompareAndSwap() 1 to 0 fail  val: %#x", spin_lock);
+/**
+ * Account a message skipped by level threshold
+ */
+void log_filtered(uint32_t level)
+{
+    kassertf(level <= KEXTLOG_LEVEL_ERROR, "Bad log level %u", level);
+    log_stat_inc(filtered[level]);
+}
 
-    if (e != 0) {
-        LOG_ERR("ctl_enqueuedata() fail  ref: %p unit: %u len: %zu errno: %d", ref, unit, len, e);
+/*
+ * Buckets of per-process rate limit  keyed by call site and pid
+ * Colliding keys share a bucket  which only makes limit stricter
+ */
+#define RL_PID_TABLE_SIZE           1024    /* Power of 2 */
+
+static struct ratelimit rl_pid_table[RL_PID_TABLE_SIZE];
+static volatile uint64_t rl_interval = 0;   /* Token refill interval in abs time */
+
+/**
+ * Recompute token refill interval  call after log_conf.ratelimit_rate changed
+ */
+void log_ratelimit_update(void)
+{
+    uint64_t interval;
+    uint32_t rate = log_conf.ratelimit_rate;
+
+    kassert_gt(rate, 0, "%u", "%u");
+    nanoseconds_to_absolutetime(1000000000ULL / rate, &interval);
+    rl_interval = interval != 0 ? interval : 1;
+}
+
+/**
+ * Take a token from rate limit bucket of a call site
+ * Once the limit lifts  a record of suppressed count will be emitted first
+ * @return      1 if the message allowed  0 if suppressed
+ */
+int log_ratelimit(struct kextlog_site *site)
+{
+    uint32_t mode = log_conf.ratelimit_mode;
+    struct ratelimit *rl;
+    uint32_t h;
+    uint32_t n;
+    int pid = -1;
+
+    kassert_nonnull(site);
+
+    if (mode == KEXTLOG_RATELIMIT_OFF) return 1;
+
+    if (mode == KEXTLOG_RATELIMIT_PID) {
+        pid = proc_selfpid();
+        h = (uint32_t) ((uintptr_t) site >> 3) ^ ((uint32_t) pid * 2654435761u);
+        rl = &rl_pid_table[h & (RL_PID_TABLE_SIZE - 1)];
+    } else {
+        rl = &site->rl;
     }
 
-    return e;
+    if (!ratelimit_check(rl, mach_absolute_time(), rl_interval, log_conf.ratelimit_burst)) {
+        log_stat_inc(ratelimited);
+        return 0;
+    }
+
+    n = ratelimit_take_suppressed(rl);
+    if (n != 0) {
+        if (pid >= 0) {
+            log_printf(site->level, site->scope, "%u messages suppressed  site: %s:%u pid: %d",
+                        n, site->file, site->line, pid);
+        } else {
+            log_printf(site->level, site->scope, "%u messages suppressed  site: %s:%u",
+                        n, site->file, site->line);
+        }
+    }
+
+    return 1;
 }
 
 #define KEXTLOG_STACKMSG_SIZE       128
@@ -203,25 +1999,196 @@ struct kextlog_stackmsg {
     char buffer[KEXTLOG_STACKMSG_SIZE];
 };
 
-void log_printf(uint32_t level, const char *fmt, ...)
+#define KEXTLOG_STACKBIN_SIZE       128
+
+struct kextlog_stackbin {
+    struct kextlog_msghdr hdr;
+    struct kextlog_binmsg bin;
+    char args[KEXTLOG_STACKBIN_SIZE];
+};
+
+/**
+ * @submask     subscribers the message goes to  kept in seq until consumer
+ *              stamps the real one  see: sub_wants()
+ */
+static inline void log_stamp(
+        struct kextlog_msghdr *msgp,
+        uint32_t level,
+        uint32_t scope,
+        uint32_t submask,
+        uint32_t flags,
+        uint32_t size)
+{
+    msgp->pid = proc_pid(current_proc());
+    msgp->scope = scope;
+    msgp->tid = thread_tid(current_thread());
+    msgp->timestamp = mach_absolute_time();
+    msgp->level = level;
+    msgp->flags = flags;
+    msgp->size = size;
+    msgp->_padding = _KEXTLOG_PADDING_MAGIC;
+    /* Stamped by consumer */
+    msgp->seq = submask;
+}
+
+/**
+ * Push a message in binary form  i.e. format id along with raw arguments
+ *  user space daemon is responsible to render it
+ * @return      0 if success  errno otherwise
+ *              ENOBUFS denotes the message cannot be enqueued
+ */
+static int log_binary(uint32_t level, uint32_t scope, uint32_t submask, const char *fmt, va_list ap)
+{
+    struct kextlog_stackbin msg;
+    struct kextlog_msghdr *msgp = &msg.hdr;
+    struct kextlog_binmsg *bin;
+    struct mpool *mp = NULL;
+    va_list ap2;
+    size_t n;
+    size_t n2;
+    uint64_t t0;
+    int e;
+
+    va_copy(ap2, ap);
+
+    t0 = lat_begin();
+    n = fmtpack_encode(msg.args, sizeof(msg.args), fmt, ap);
+    if (n > sizeof(msg.args)) {
+        /* Way too large to fit in a ring  let caller try text message */
+        if (RINGBUF_HDRSZ + sizeof(*msgp) + sizeof(*bin) + n > KEXTLOG_RING_SIZE) {
+            e = EMSGSIZE;
+            goto out_exit;
+        }
+
+        msgp = (struct kextlog_msghdr *) log_msg_alloc(sizeof(*msgp) + sizeof(*bin) + n, &mp);
+        if (msgp == NULL) {
+            log_stat_inc(oom);
+            e = ENOMEM;
+            goto out_exit;
+        }
+
+        bin = (struct kextlog_binmsg *) msgp->buffer;
+        n2 = fmtpack_encode(bin->data, n, fmt, ap2);
+        kassert_eq(n, n2, "%zu", "%zu");
+    } else {
+        log_stat_inc(stackmsg);
+    }
+    (void) lat_end(KEXTLOG_LAT_FORMAT, t0);
+
+    bin = (struct kextlog_binmsg *) msgp->buffer;
+    bin->fmt_id = fmt_id_of(fmt);
+    log_stamp(msgp, level, scope, submask, KEXTLOG_FLAG_MSG_BINARY, (uint32_t) (sizeof(*bin) + n));
+
+    e = enqueue_log(msgp, sizeof(*msgp) + msgp->size);
+
+    if (msgp != &msg.hdr) log_msg_free(msgp, mp);
+
+out_exit:
+    va_end(ap2);
+    return e;
+}
+
+/**
+ * Format a text message straight into ring storage  in a single pass
+ *  space of log_conf.msg_max is reserved  unused tail is handed back on commit
+ * @return      0 if success  ENOBUFS if no room for a full-sized reservation
+ *
+ * Records behind an uncommitted one are invisible to the consumer
+ *  so keep the window between reserve and commit as short as possible
+ */
+static int log_text(uint32_t level, uint32_t scope, uint32_t submask, const char *fmt, va_list ap)
+{
+    struct kextlog_msghdr *msgp;
+    struct ringbuf *rb;
+    uint32_t cap = log_conf.msg_max;
+    uint32_t flags = 0;
+    uint64_t t;
+    int len;
+
+    t = lat_begin();
+    rb = log_ring(KEXTLOG_LANE(level));
+    msgp = (struct kextlog_msghdr *) ringbuf_reserve(rb, (uint32_t) sizeof(*msgp) + cap);
+    t = lat_end(KEXTLOG_LAT_ENQUEUE, t);
+    if (msgp == NULL) return ENOBUFS;
+
+    len = vsnprintf(msgp->buffer, cap, fmt, ap);
+    (void) lat_end(KEXTLOG_LAT_FORMAT, t);
+    if (len >= (int) cap) {
+        len = (int) cap - 1;
+        flags |= KEXTLOG_FLAG_MSG_TRUNCATED;
+        log_stat_inc(truncated);
+    }
+
+    log_stamp(msgp, level, scope, submask, flags, len + 1);
+    ringbuf_commit_len(rb, msgp, (uint32_t) sizeof(*msgp) + len + 1);
+    log_stat_inc(ringmsg);
+    log_stat_add(bytes_enqueued, sizeof(*msgp) + len + 1);
+    log_stat_inc(messages[level]);
+    enqueue_kick(rb);
+
+    return 0;
+}
+
+/**
+ * @scope       scope along with subscriber mask  see: KEXTLOG_SCOPE_SUBS()
+ * @sleepable   caller may sleep  see: log_backpressure_wait()
+ */
+static void log_vprintf(uint32_t level, uint32_t scope, int sleepable, const char *fmt, va_list ap0)
 {
+    uint32_t submask = scope >> KEXTLOG_SUBS_SHIFT;
     struct kextlog_stackmsg msg;
     struct kextlog_msghdr *msgp;
+    struct mpool *mp = NULL;
     int len;
     int len2;
     va_list ap;
     uint32_t msgsz;
     uint32_t flags = 0;
+    uint64_t t0;
+    int e;
+
+    scope &= (1u << KEXTLOG_SUBS_SHIFT) - 1;
 
     kassertf(level >= KEXTLOG_LEVEL_TRACE && level <= KEXTLOG_LEVEL_ERROR, "Bad log level %u", level);
+    kassertf(scope < KEXTLOG_SCOPE_MAX, "Bad log scope %u", scope);
     kassert_nonnull(fmt);
 
     msgp = (struct kextlog_msghdr *) &msg;
 
-    /* Push message to syslog if log kctl not yet ready */
-    if (kctlunit == 0) goto out_sysmbuf;
+    /* log_site() already checked it  yet subscriber filters may change in between */
+    if (level < log_level_threshold[scope]) {
+        log_filtered(level);
+        return;
+    }
+
+    /* Push message to syslog if log kctl not yet ready  unless flight recorder on */
+    if (nsub == 0 && flight_size == 0) goto out_sysmbuf;
 
-    va_start(ap, fmt);
+    if (sleepable && log_conf.backpressure == KEXTLOG_BP_BLOCK) {
+        log_backpressure_wait(KEXTLOG_LANE(level));
+    }
+
+    if (log_conf.binary) {
+        va_copy(ap, ap0);
+        e = log_binary(level, scope, submask, fmt, ap);
+        va_end(ap);
+
+        if (e == 0) return;
+        if (e == ENOBUFS) goto out_enqueue_failure;
+        /* Fallback to text message */
+    }
+
+    va_copy(ap, ap0);
+    e = log_text(level, scope, submask, fmt, ap);
+    va_end(ap);
+    if (e == 0) return;
+
+    /*
+     * Ring too full for a full-sized reservation  format into stack buffer
+     *  and enqueue by copy  long messages need a second formatting pass
+     */
+    t0 = lat_begin();
+    va_copy(ap, ap0);
     /*
      * [sic vsnprintf(3)]
      * vsnprintf() return the number of characters that would have been printed
@@ -232,6 +2199,11 @@ void log_printf(uint32_t level, const char *fmt, ...)
     len = vsnprintf(msg.buffer, sizeof(msg.buffer), fmt, ap);
     va_end(ap);
 
+    if (len >= (int) log_conf.msg_max) {
+        len = (int) log_conf.msg_max - 1;
+        flags |= KEXTLOG_FLAG_MSG_TRUNCATED;
+    }
+
     /* msgsz = sizeof(*msgp) + len + 1; */
     if (__builtin_uadd_overflow(sizeof(*msgp), len, &msgsz) ||
         /* Includes log message trailing `\0' */
@@ -242,16 +2214,16 @@ void log_printf(uint32_t level, const char *fmt, ...)
     }
 
     if (len >= (int) sizeof(msg.buffer)) {
-        msgp = (struct kextlog_msghdr *) util_malloc0(msgsz, M_WAITOK | M_NULL);
+        msgp = (struct kextlog_msghdr *) log_msg_alloc(msgsz, &mp);
         if (msgp != NULL) {
-            va_start(ap, fmt);
+            log_stat_inc(reformat);
+            va_copy(ap, ap0);
             len2 = vsnprintf(msgp->buffer, len + 1, fmt, ap);
             va_end(ap);
 
-            kassert_eq(len, len2, "%d", "%d");
-            (void) OSIncrementAtomic64((SInt64 *) &log_stat.heapmsg);
+            kassertf(len2 >= len, "Message shrunk between formatting passes  %d vs %d", len2, len);
         } else {
-            (void) OSIncrementAtomic64((SInt64 *) &log_stat.oom);
+            log_stat_inc(oom);
 
             msgp = (struct kextlog_msghdr *) &msg;
 out_overflow:
@@ -260,31 +2232,52 @@ out_overflow:
             flags |= KEXTLOG_FLAG_MSG_TRUNCATED;
         }
     } else {
-        (void) OSIncrementAtomic64((SInt64 *) &log_stat.stackmsg);
+        log_stat_inc(stackmsg);
     }
 
-    msgp->pid = proc_pid(current_proc());
-    msgp->tid = thread_tid(current_thread());
-    msgp->timestamp = mach_absolute_time();
-    msgp->level = level;
-    msgp->flags = flags;
-    msgp->size = len + 1;
-    msgp->_padding = _KEXTLOG_PADDING_MAGIC;
+    if (flags & KEXTLOG_FLAG_MSG_TRUNCATED) {
+        log_stat_inc(truncated);
+    }
+    (void) lat_end(KEXTLOG_LAT_FORMAT, t0);
+
+    log_stamp(msgp, level, scope, submask, flags, len + 1);
 
     if (enqueue_log(msgp, msgsz) != 0) {
-        (void) OSIncrementAtomic64((SInt64 *) &log_stat.enqueue_failure);
+out_enqueue_failure:
+        log_stat_inc(enqueue_failure);
+        log_stat_inc(dropped[level]);
 
 out_sysmbuf:
-        (void) OSIncrementAtomic64((SInt64 *) &log_stat.syslog);
+        log_stat_inc(syslog);
 
-        va_start(ap, fmt);
+        va_copy(ap, ap0);
         log_syslog(level, fmt, ap);
         va_end(ap);
     }
 
-    if (msgp != (struct kextlog_msghdr *) &msg) {
-        /* util_mfree(NULL, type) do nop */
-        util_mfree(msgp);
-    }
+    if (msgp != (struct kextlog_msghdr *) &msg) log_msg_free(msgp, mp);
+}
+
+void log_printf(uint32_t level, uint32_t scope, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    log_vprintf(level, scope, 0, fmt, ap);
+    va_end(ap);
+}
+
+/**
+ * Same as log_printf()  yet it may sleep for ring space
+ *  if backpressure policy is KEXTLOG_BP_BLOCK
+ * Never call it from kauth callbacks or with any lock held
+ */
+void log_printf_sleep(uint32_t level, uint32_t scope, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    log_vprintf(level, scope, 1, fmt, ap);
+    va_end(ap);
 }
 
@@ -10,30 +10,147 @@
 #include <sys/systm.h>
 
 #include "kextlog.h"
+#include "ratelimit.h"
+#include "hist.h"
+#include "evfilter.h"
 
+kern_return_t log_kctl_init(void);
+void log_kctl_fini(void);
 kern_return_t log_kctl_register(void);
 kern_return_t log_kctl_deregister(void);
 
-void log_printf(uint32_t, const char *, ...) __printflike(2, 3);
+void log_printf(uint32_t, uint32_t, const char *, ...) __printflike(3, 4);
+void log_printf_sleep(uint32_t, uint32_t, const char *, ...) __printflike(3, 4);
+void log_filtered(uint32_t);
 
-#define log_trace(fmt, ...) \
-    log_printf(KEXTLOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
+/*
+ * Effective minimum log level of each scope  indexed by KEXTLOG_SCOPE_*
+ *  messages below it never reach log_printf()
+ * Subscribers raise it if none of them wants messages below
+ */
+extern volatile uint32_t log_level_threshold[KEXTLOG_SCOPE_MAX];
+
+void log_level_update(void);
+
+void log_latency_read(uint32_t, struct hist *);
+
+uint32_t log_evfilter(const struct evfilter_event *);
+
+/**
+ * @return      nonzero if a message at the level of the scope may be logged
+ *              callers can skip expensive work for its arguments if not
+ */
+static inline int log_enabled(uint32_t level, uint32_t scope)
+{
+    return level >= log_level_threshold[scope];
+}
+
+/*
+ * Scope of log call sites  a source file may redefine it
+ *  before a group of functions belong to another scope
+ */
+#ifndef KEXTLOG_SCOPE
+#define KEXTLOG_SCOPE               KEXTLOG_SCOPE_NONE
+#endif
+
+/*
+ * Subscribers messages of call sites go to  a mask returned by log_evfilter()
+ *  zero means all of them
+ * A source file may redefine it to a variable holding the mask of the event
+ *  being logged  so each subscriber only gets events its filter accepts
+ */
+#ifndef KEXTLOG_SUBS
+#define KEXTLOG_SUBS                0
+#endif
+
+/* Scope argument of log_printf()  scope in low bits  subscriber mask above */
+#define KEXTLOG_SUBS_SHIFT          8
+#define KEXTLOG_SCOPE_SUBS(scope, subs) \
+    ((uint32_t) (scope) | ((uint32_t) (subs) << KEXTLOG_SUBS_SHIFT))
+
+/*
+ * Static descriptor of a log call site
+ *
+ * Every log_*() expansion emits one into a dedicated section
+ *  so all call sites can be enumerated and toggled at runtime
+ *  see: log_site.c
+ */
+struct kextlog_site {
+    const char *file;
+    const char *fmt;
+    uint32_t line;
+    uint32_t level;
+    volatile uint32_t enabled;
+    uint32_t scope;
+    struct ratelimit rl;
+} __attribute__ ((aligned (8)));
+
+int log_ratelimit(struct kextlog_site *);
+void log_ratelimit_update(void);
+
+#define KEXTLOG_SITE_SEGMENT        "__DATA"
+#define KEXTLOG_SITE_SECTION        "__kextlog_sites"
 
+/* TRACE and DEBUG sites are compiled in yet disabled by default in release */
 #ifdef DEBUG
-#define log_debug(fmt, ...) \
-    log_printf(KEXTLOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define KEXTLOG_SITE_ENABLED(lvl)   1
 #else
-#define log_debug(fmt, ...) UNUSED(fmt, ##__VA_ARGS__)
+#define KEXTLOG_SITE_ENABLED(lvl)   ((lvl) > KEXTLOG_LEVEL_DEBUG)
 #endif
 
+/*
+ * A disabled call site costs one branch  arguments won't be evaluated
+ * Messages below level threshold of the scope are counted and skipped
+ *  before any formatting work  so do messages exceeded the rate limit
+ * @fn      log_printf or log_printf_sleep
+ */
+#define log_site_fn(fn, lvl, fmt, ...) do {                         \
+    static struct kextlog_site __kextlog_site                       \
+        __attribute__ ((section (KEXTLOG_SITE_SEGMENT "," KEXTLOG_SITE_SECTION), used)) = { \
+        __FILE__, fmt, __LINE__, lvl, KEXTLOG_SITE_ENABLED(lvl), KEXTLOG_SCOPE, {0, 0, 0}, \
+    };                                                              \
+    if (__builtin_expect(__kextlog_site.enabled, 1)) {              \
+        if ((lvl) >= log_level_threshold[KEXTLOG_SCOPE]) {          \
+            if (log_ratelimit(&__kextlog_site)) {                   \
+                fn(lvl, KEXTLOG_SCOPE_SUBS(KEXTLOG_SCOPE, KEXTLOG_SUBS), fmt, ##__VA_ARGS__); \
+            }                                                       \
+        } else {                                                    \
+            log_filtered(lvl);                                      \
+        }                                                           \
+    }                                                               \
+} while (0)
+
+#define log_site(lvl, fmt, ...) \
+    log_site_fn(log_printf, lvl, fmt, ##__VA_ARGS__)
+
+/* For callers can sleep  see: KEXTLOG_BP_BLOCK */
+#define log_site_sleep(lvl, fmt, ...) \
+    log_site_fn(log_printf_sleep, lvl, fmt, ##__VA_ARGS__)
+
+#define log_trace(fmt, ...) \
+    log_site(KEXTLOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
+
+#define log_debug(fmt, ...) \
+    log_site(KEXTLOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
 #define log_info(fmt, ...) \
-    log_printf(KEXTLOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+    log_site(KEXTLOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
 
 #define log_warning(fmt, ...) \
-    log_printf(KEXTLOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
+    log_site(KEXTLOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
 
 #define log_error(fmt, ...) \
-    log_printf(KEXTLOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+    log_site(KEXTLOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+
+/* Variants of callers can sleep */
+#define log_info_sleep(fmt, ...) \
+    log_site_sleep(KEXTLOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+
+#define log_warning_sleep(fmt, ...) \
+    log_site_sleep(KEXTLOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
+
+#define log_error_sleep(fmt, ...) \
+    log_site_sleep(KEXTLOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
 
 #endif /* LOG_KCTL_H */
 
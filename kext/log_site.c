@@ -0,0 +1,156 @@
+/*
+ * Created 200107
+ *
+ * Call site descriptors are placed in __DATA,__kextlog_sites by log_site()
+ *  ld64 synthesizes section$start/section$end symbols for the bounds
+ */
+
+#include <sys/types.h>
+#include <sys/errno.h>
+#include <libkern/libkern.h>
+
+#include "log_site.h"
+#include "log_kctl.h"
+#include "utils.h"
+
+extern struct kextlog_site kextlog_sites_start
+    __asm("section$start$" KEXTLOG_SITE_SEGMENT "$" KEXTLOG_SITE_SECTION);
+extern struct kextlog_site kextlog_sites_end
+    __asm("section$end$" KEXTLOG_SITE_SEGMENT "$" KEXTLOG_SITE_SECTION);
+
+#define site_begin()        (&kextlog_sites_start)
+#define site_end()          (&kextlog_sites_end)
+
+static const char level_char[] = {'T', 'D', 'I', 'W', 'E'};
+
+static const char *path_basename(const char *path)
+{
+    const char *p = strrchr(path, '/');
+    return p != NULL ? p + 1 : path;
+}
+
+uint32_t log_site_count(void)
+{
+    return (uint32_t) (site_end() - site_begin());
+}
+
+/**
+ * Dump all call sites  one site per line
+ *  <id> <level> <enabled> <file>:<line> <fmt>
+ * @buf     output buffer  always NUL-terminated if size is positive
+ * @return  length of the whole dump(excluding `\0')
+ */
+size_t log_site_dump(char *buf, size_t size)
+{
+    struct kextlog_site *site;
+    size_t n = 0;
+    int len;
+    char dummy;
+
+    BUILD_BUG_ON(ARRAY_SIZE(level_char) != KEXTLOG_LEVEL_ERROR + 1);
+
+    if (size != 0) *buf = '\0';
+
+    for (site = site_begin(); site < site_end(); site++) {
+        kassert_le(site->level, KEXTLOG_LEVEL_ERROR, "%u", "%u");
+        len = snprintf(n < size ? buf + n : &dummy, n < size ? size - n : 0,
+                        "%u %c %u %s:%u %s\n",
+                        (uint32_t) (site - site_begin()), level_char[site->level],
+                        site->enabled, path_basename(site->file), site->line, site->fmt);
+        if (len > 0) n += len;
+    }
+
+    return n;
+}
+
+/**
+ * Enable/disable call sites
+ * @cmd     <selector>=<0|1>  selector can be one of
+ *              *               all sites
+ *              @<level>        sites of a level  level is one of TDIWE
+ *              #<id>           a site by its id
+ *              <file>          sites in a file
+ *              <file>:<line>   a site by its source location
+ * @return  0 if success  EINVAL if malformed  ENOENT if no site matched
+ */
+int log_site_ctl(const char *cmd)
+{
+    struct kextlog_site *site;
+    const char *eq;
+    const char *colon;
+    size_t flen = 0;
+    uint32_t id = 0;
+    uint32_t line = 0;
+    uint32_t level = 0;
+    uint32_t val;
+    uint32_t n = 0;
+    char sel;
+    const char *p;
+
+    kassert_nonnull(cmd);
+
+    eq = strchr(cmd, '=');
+    if (eq == NULL || eq == cmd) return EINVAL;
+    if ((eq[1] != '0' && eq[1] != '1') || (eq[2] != '\0' && eq[2] != '\n')) return EINVAL;
+    val = eq[1] - '0';
+
+    sel = *cmd;
+    switch (sel) {
+    case '*':
+        if (eq != cmd + 1) return EINVAL;
+        break;
+    case '@':
+        if (eq != cmd + 2) return EINVAL;
+        for (level = 0; level < ARRAY_SIZE(level_char); level++) {
+            if (level_char[level] == cmd[1]) break;
+        }
+        if (level == ARRAY_SIZE(level_char)) return EINVAL;
+        break;
+    case '#':
+        if (eq == cmd + 1) return EINVAL;
+        for (p = cmd + 1; p < eq; p++) {
+            if (*p < '0' || *p > '9') return EINVAL;
+            id = id * 10 + (*p - '0');
+        }
+        break;
+    default:
+        sel = 'f';
+        colon = NULL;
+        for (p = cmd; p < eq; p++) {
+            if (*p == ':') colon = p;
+        }
+        flen = (colon != NULL ? colon : eq) - cmd;
+        if (colon != NULL) {
+            if (colon + 1 == eq) return EINVAL;
+            for (p = colon + 1; p < eq; p++) {
+                if (*p < '0' || *p > '9') return EINVAL;
+                line = line * 10 + (*p - '0');
+            }
+        }
+        break;
+    }
+
+    for (site = site_begin(); site < site_end(); site++) {
+        switch (sel) {
+        case '@':
+            if (site->level != level) continue;
+            break;
+        case '#':
+            if ((uint32_t) (site - site_begin()) != id) continue;
+            break;
+        case 'f':
+            p = path_basename(site->file);
+            if (strlen(p) != flen || strncmp(p, cmd, flen) != 0) continue;
+            if (line != 0 && site->line != line) continue;
+            break;
+        }
+
+        site->enabled = val;
+        n++;
+    }
+
+    LOG_DBG("log site ctl: %s  %u sites matched", cmd, n);
+
+    return n != 0 ? 0 : ENOENT;
+}
+
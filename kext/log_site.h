@@ -0,0 +1,17 @@
+/*
+ * Created 200107
+ *
+ * Registry of static log call sites
+ */
+
+#ifndef LOG_SITE_H
+#define LOG_SITE_H
+
+#include <sys/types.h>
+
+uint32_t log_site_count(void);
+size_t log_site_dump(char *, size_t);
+int log_site_ctl(const char *);
+
+#endif /* LOG_SITE_H */
+
@@ -3,8 +3,12 @@
  */
 
 #include <sys/sysctl.h>
+#include <sys/errno.h>
+#include <sys/malloc.h>
 
 #include "log_sysctl.h"
+#include "log_site.h"
+#include "log_kctl.h"
 #include "utils.h"
 
 static SYSCTL_NODE(
@@ -25,57 +29,1354 @@ static SYSCTL_NODE(
     "" /* sysctl node: kextlog.statistics */
 )
 
-struct kextlog_statistics log_stat = {};
+struct kextlog_statistics log_stat[KEXTLOG_NCPU_MAX] = {};
 
-static SYSCTL_QUAD(
+/**
+ * @off     offset of a counter in struct kextlog_statistics
+ * @return  the counter summed over all CPUs
+ */
+uint64_t log_stat_sum(int off)
+{
+    uint64_t val = 0;
+    uint32_t i;
+
+    for (i = 0; i < KEXTLOG_NCPU_MAX; i++) {
+        val += *(volatile uint64_t *) ((uint8_t *) &log_stat[i] + off);
+    }
+
+    return val;
+}
+
+static uint64_t stat_max(int off)
+{
+    uint64_t val = 0;
+    uint64_t v;
+    uint32_t i;
+
+    for (i = 0; i < KEXTLOG_NCPU_MAX; i++) {
+        v = *(volatile uint64_t *) ((uint8_t *) &log_stat[i] + off);
+        if (v > val) val = v;
+    }
+
+    return val;
+}
+
+/**
+ * Read a counter  summed over all CPUs
+ * @arg2        offset of the counter in struct kextlog_statistics
+ */
+static int sysctl_stat_sum(SYSCTL_HANDLER_ARGS)
+{
+    uint64_t val = log_stat_sum(arg2);
+    UNUSED(oidp, arg1);
+    return SYSCTL_OUT(req, &val, sizeof(val));
+}
+
+/**
+ * Read a high-water mark  the max one of all CPUs
+ * @arg2        offset of the counter in struct kextlog_statistics
+ */
+static int sysctl_stat_max(SYSCTL_HANDLER_ARGS)
+{
+    uint64_t val = stat_max(arg2);
+    UNUSED(oidp, arg1);
+    return SYSCTL_OUT(req, &val, sizeof(val));
+}
+
+/**
+ * Read all counters in one call as a struct kextlog_statistics
+ *  counters are summed over all CPUs  high-water marks take the max
+ *
+ * Not an atomic snapshot  yet all counters are sampled back to back
+ *  thus ratios between them are far more meaningful than separate reads
+ */
+static int sysctl_stat_snapshot(SYSCTL_HANDLER_ARGS)
+{
+    struct kextlog_statistics snap;
+    uint64_t *dst = (uint64_t *) &snap;
+    uint32_t k, c;
+
+    UNUSED(oidp, arg1, arg2);
+
+    for (k = 0; k < sizeof(snap) / sizeof(uint64_t); k++) {
+        dst[k] = log_stat_sum((int) (k * sizeof(uint64_t)));
+    }
+    for (c = 0; c < KEXTLOG_POOL_NCLASS; c++) {
+        snap.pool_hiwat[c] = stat_max(KEXTLOG_STAT_OFF(pool_hiwat[c]));
+    }
+
+    return SYSCTL_OUT(req, &snap, sizeof(snap));
+}
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    snapshot,
+    CTLTYPE_OPAQUE | CTLFLAG_RD,
+    NULL,
+    0,
+    sysctl_stat_snapshot,
+    "S,kextlog_statistics",
+    "" /* sysctl nub: kextlog.statistics.snapshot */
+);
+
+static SYSCTL_PROC(
     _kextlog_statistics,
     OID_AUTO,
     syslog,
-    CTLFLAG_RD,
-    (uint64_t *) &log_stat.syslog,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(syslog),
+    sysctl_stat_sum,
+    "QU",
     "" /* sysctl nub: kextlog.statistics.syslog */
 );
 
-static SYSCTL_QUAD(
+static SYSCTL_PROC(
     _kextlog_statistics,
     OID_AUTO,
     heapmsg,
-    CTLFLAG_RD,
-    (uint64_t *) &log_stat.heapmsg,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(heapmsg),
+    sysctl_stat_sum,
+    "QU",
     "" /* sysctl nub: kextlog.statistics.heapmsg */
 );
 
-static SYSCTL_QUAD(
+static SYSCTL_PROC(
     _kextlog_statistics,
     OID_AUTO,
     stackmsg,
-    CTLFLAG_RD,
-    (uint64_t *) &log_stat.stackmsg,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(stackmsg),
+    sysctl_stat_sum,
+    "QU",
     "" /* sysctl nub: kextlog.statistics.stackmsg */
 );
 
-static SYSCTL_QUAD(
+static SYSCTL_PROC(
     _kextlog_statistics,
     OID_AUTO,
     oom,
-    CTLFLAG_RD,
-    (uint64_t *) &log_stat.oom,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(oom),
+    sysctl_stat_sum,
+    "QU",
     "" /* sysctl nub: kextlog.statistics.oom */
 );
 
-static SYSCTL_QUAD(
+static SYSCTL_PROC(
     _kextlog_statistics,
     OID_AUTO,
     enqueue_failure,
-    CTLFLAG_RD,
-    (uint64_t *) &log_stat.enqueue_failure,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(enqueue_failure),
+    sysctl_stat_sum,
+    "QU",
     "" /* sysctl nub: kextlog.statistics.enqueue_failure */
 );
 
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    ring_full,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(ring_full),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.ring_full */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    batch,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(batch),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.batch */
+);
+
+static SYSCTL_NODE(
+    _kextlog,
+    OID_AUTO,
+    batch,
+    CTLFLAG_RW,
+    NULL,
+    "" /* sysctl node: kextlog.batch */
+)
+
+struct kextlog_config log_conf = {
+    KEXTLOG_BATCH_SIZE,
+    KEXTLOG_BATCH_LATENCY,
+    0,
+    {KEXTLOG_LEVEL_TRACE},
+    KEXTLOG_RATELIMIT_OFF,
+    KEXTLOG_RATELIMIT_RATE,
+    KEXTLOG_RATELIMIT_BURST,
+    KEXTLOG_MSG_MAX,
+    1,
+    KEXTLOG_FLIGHT_SIZE,
+    KEXTLOG_LANE_RESERVE,
+    KEXTLOG_RECVSIZE,
+    KEXTLOG_BP_DROP_NEWEST,
+    KEXTLOG_BP_TIMEOUT,
+};
+
+/*
+ * arg1 of sysctl_uint_range() handler
+ */
+struct sysctl_uint_range {
+    volatile uint32_t *ptr;
+    uint32_t min;
+    uint32_t max;
+    void (*hook)(void);     /* Called after value changed  nullable */
+};
+
+/**
+ * Read/write an uint32_t tunable  out-of-range value will be rejected
+ */
+static int sysctl_uint_range(SYSCTL_HANDLER_ARGS)
+{
+    struct sysctl_uint_range *r = (struct sysctl_uint_range *) arg1;
+    uint32_t val = *r->ptr;
+    int e;
+
+    UNUSED(arg2);
+
+    e = sysctl_handle_int(oidp, &val, 0, req);
+    if (e == 0 && req->newptr != USER_ADDR_NULL) {
+        if (val < r->min || val > r->max) {
+            e = EINVAL;
+        } else {
+            *r->ptr = val;
+            if (r->hook != NULL) r->hook();
+        }
+    }
+
+    return e;
+}
+
+static struct sysctl_uint_range batch_size_range = {
+    &log_conf.batch_size, 0, KEXTLOG_BATCH_MAX, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog_batch,
+    OID_AUTO,
+    size,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &batch_size_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.batch.size */
+);
+
+static struct sysctl_uint_range batch_latency_range = {
+    &log_conf.batch_latency, 1, KEXTLOG_BATCH_LATENCY_MAX, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog_batch,
+    OID_AUTO,
+    latency,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &batch_latency_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.batch.latency */
+);
+
+static struct sysctl_uint_range binary_range = {
+    &log_conf.binary, 0, 1, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog,
+    OID_AUTO,
+    binary,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &binary_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.binary */
+);
+
+/*
+ * Minimum log levels  set to KEXTLOG_LEVEL_ERROR + 1 to mute a scope
+ */
+static SYSCTL_NODE(
+    _kextlog,
+    OID_AUTO,
+    level,
+    CTLFLAG_RW,
+    NULL,
+    "" /* sysctl node: kextlog.level */
+)
+
+static struct sysctl_uint_range level_min_range = {
+    &log_conf.level_min[KEXTLOG_SCOPE_NONE], KEXTLOG_LEVEL_TRACE, KEXTLOG_LEVEL_ERROR + 1, log_level_update,
+};
+
+static SYSCTL_PROC(
+    _kextlog_level,
+    OID_AUTO,
+    min,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &level_min_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.level.min */
+);
+
+static struct sysctl_uint_range level_generic_range = {
+    &log_conf.level_min[KEXTLOG_SCOPE_GENERIC], KEXTLOG_LEVEL_TRACE, KEXTLOG_LEVEL_ERROR + 1, log_level_update,
+};
+
+static SYSCTL_PROC(
+    _kextlog_level,
+    OID_AUTO,
+    generic,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &level_generic_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.level.generic */
+);
+
+static struct sysctl_uint_range level_process_range = {
+    &log_conf.level_min[KEXTLOG_SCOPE_PROCESS], KEXTLOG_LEVEL_TRACE, KEXTLOG_LEVEL_ERROR + 1, log_level_update,
+};
+
+static SYSCTL_PROC(
+    _kextlog_level,
+    OID_AUTO,
+    process,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &level_process_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.level.process */
+);
+
+static struct sysctl_uint_range level_vnode_range = {
+    &log_conf.level_min[KEXTLOG_SCOPE_VNODE], KEXTLOG_LEVEL_TRACE, KEXTLOG_LEVEL_ERROR + 1, log_level_update,
+};
+
+static SYSCTL_PROC(
+    _kextlog_level,
+    OID_AUTO,
+    vnode,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &level_vnode_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.level.vnode */
+);
+
+static struct sysctl_uint_range level_fileop_range = {
+    &log_conf.level_min[KEXTLOG_SCOPE_FILEOP], KEXTLOG_LEVEL_TRACE, KEXTLOG_LEVEL_ERROR + 1, log_level_update,
+};
+
+static SYSCTL_PROC(
+    _kextlog_level,
+    OID_AUTO,
+    fileop,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &level_fileop_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.level.fileop */
+);
+
+static SYSCTL_NODE(
+    _kextlog_statistics,
+    OID_AUTO,
+    filtered,
+    CTLFLAG_RD,
+    NULL,
+    "" /* sysctl node: kextlog.statistics.filtered */
+)
+
+static SYSCTL_PROC(
+    _kextlog_statistics_filtered,
+    OID_AUTO,
+    trace,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(filtered[KEXTLOG_LEVEL_TRACE]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.filtered.trace */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_filtered,
+    OID_AUTO,
+    debug,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(filtered[KEXTLOG_LEVEL_DEBUG]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.filtered.debug */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_filtered,
+    OID_AUTO,
+    info,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(filtered[KEXTLOG_LEVEL_INFO]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.filtered.info */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_filtered,
+    OID_AUTO,
+    warning,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(filtered[KEXTLOG_LEVEL_WARNING]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.filtered.warning */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_filtered,
+    OID_AUTO,
+    error,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(filtered[KEXTLOG_LEVEL_ERROR]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.filtered.error */
+);
+
+static SYSCTL_NODE(
+    _kextlog,
+    OID_AUTO,
+    ratelimit,
+    CTLFLAG_RW,
+    NULL,
+    "" /* sysctl node: kextlog.ratelimit */
+)
+
+static struct sysctl_uint_range ratelimit_mode_range = {
+    &log_conf.ratelimit_mode, KEXTLOG_RATELIMIT_OFF, KEXTLOG_RATELIMIT_PID, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog_ratelimit,
+    OID_AUTO,
+    mode,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &ratelimit_mode_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.ratelimit.mode */
+);
+
+static struct sysctl_uint_range ratelimit_rate_range = {
+    &log_conf.ratelimit_rate, 1, KEXTLOG_RATELIMIT_RATE_MAX, log_ratelimit_update,
+};
+
+static SYSCTL_PROC(
+    _kextlog_ratelimit,
+    OID_AUTO,
+    rate,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &ratelimit_rate_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.ratelimit.rate */
+);
+
+static struct sysctl_uint_range ratelimit_burst_range = {
+    &log_conf.ratelimit_burst, 1, KEXTLOG_RATELIMIT_BURST_MAX, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog_ratelimit,
+    OID_AUTO,
+    burst,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &ratelimit_burst_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.ratelimit.burst */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    evfiltered,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(evfiltered),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.evfiltered */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    ratelimited,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(ratelimited),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.ratelimited */
+);
+
+static SYSCTL_NODE(
+    _kextlog_statistics,
+    OID_AUTO,
+    pool,
+    CTLFLAG_RD,
+    NULL,
+    "" /* sysctl node: kextlog.statistics.pool */
+)
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    hit_256,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_hit[0]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.hit_256 */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    miss_256,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_miss[0]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.miss_256 */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    hiwat_256,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_hiwat[0]),
+    sysctl_stat_max,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.hiwat_256 */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    hit_512,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_hit[1]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.hit_512 */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    miss_512,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_miss[1]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.miss_512 */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    hiwat_512,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_hiwat[1]),
+    sysctl_stat_max,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.hiwat_512 */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    hit_1k,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_hit[2]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.hit_1k */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    miss_1k,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_miss[2]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.miss_1k */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    hiwat_1k,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_hiwat[2]),
+    sysctl_stat_max,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.hiwat_1k */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    hit_4k,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_hit[3]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.hit_4k */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    miss_4k,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_miss[3]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.miss_4k */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_pool,
+    OID_AUTO,
+    hiwat_4k,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(pool_hiwat[3]),
+    sysctl_stat_max,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.pool.hiwat_4k */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    ringmsg,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(ringmsg),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.ringmsg */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    truncated,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(truncated),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.truncated */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    reformat,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(reformat),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.reformat */
+);
+
+static struct sysctl_uint_range msg_max_range = {
+    &log_conf.msg_max, KEXTLOG_MSG_MAX_MIN, KEXTLOG_MSG_MAX_MAX, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog,
+    OID_AUTO,
+    msg_max,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &msg_max_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.msg_max */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    bytes_enqueued,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(bytes_enqueued),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.bytes_enqueued */
+);
+
+static SYSCTL_NODE(
+    _kextlog_statistics,
+    OID_AUTO,
+    messages,
+    CTLFLAG_RD,
+    NULL,
+    "" /* sysctl node: kextlog.statistics.messages */
+)
+
+static SYSCTL_PROC(
+    _kextlog_statistics_messages,
+    OID_AUTO,
+    trace,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(messages[KEXTLOG_LEVEL_TRACE]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.messages.trace */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_messages,
+    OID_AUTO,
+    debug,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(messages[KEXTLOG_LEVEL_DEBUG]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.messages.debug */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_messages,
+    OID_AUTO,
+    info,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(messages[KEXTLOG_LEVEL_INFO]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.messages.info */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_messages,
+    OID_AUTO,
+    warning,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(messages[KEXTLOG_LEVEL_WARNING]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.messages.warning */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_messages,
+    OID_AUTO,
+    error,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(messages[KEXTLOG_LEVEL_ERROR]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.messages.error */
+);
+
+static SYSCTL_NODE(
+    _kextlog_statistics,
+    OID_AUTO,
+    dropped,
+    CTLFLAG_RD,
+    NULL,
+    "" /* sysctl node: kextlog.statistics.dropped */
+)
+
+static SYSCTL_PROC(
+    _kextlog_statistics_dropped,
+    OID_AUTO,
+    trace,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(dropped[KEXTLOG_LEVEL_TRACE]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.dropped.trace */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_dropped,
+    OID_AUTO,
+    debug,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(dropped[KEXTLOG_LEVEL_DEBUG]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.dropped.debug */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_dropped,
+    OID_AUTO,
+    info,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(dropped[KEXTLOG_LEVEL_INFO]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.dropped.info */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_dropped,
+    OID_AUTO,
+    warning,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(dropped[KEXTLOG_LEVEL_WARNING]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.dropped.warning */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics_dropped,
+    OID_AUTO,
+    error,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(dropped[KEXTLOG_LEVEL_ERROR]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.dropped.error */
+);
+
+/*
+ * Latency histograms of log_printf() phases
+ *  each nub reads a struct hist(see hist.h) merged over all CPUs
+ */
+static SYSCTL_NODE(
+    _kextlog,
+    OID_AUTO,
+    latency,
+    CTLFLAG_RW,
+    NULL,
+    "" /* sysctl node: kextlog.latency */
+)
+
+static struct sysctl_uint_range latency_enable_range = {
+    &log_conf.latency, 0, 1, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog_latency,
+    OID_AUTO,
+    enable,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &latency_enable_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.latency.enable */
+);
+
+/**
+ * Read a latency histogram
+ * @arg2        one of KEXTLOG_LAT_*
+ */
+static int sysctl_latency(SYSCTL_HANDLER_ARGS)
+{
+    struct hist *h;
+    int e;
+
+    UNUSED(oidp, arg1);
+
+    h = (struct hist *) util_malloc0(sizeof(*h), M_WAITOK | M_NULL);
+    if (h == NULL) return ENOMEM;
+
+    log_latency_read((uint32_t) arg2, h);
+    e = SYSCTL_OUT(req, h, sizeof(*h));
+
+    util_mfree(h);
+    return e;
+}
+
+static SYSCTL_PROC(
+    _kextlog_latency,
+    OID_AUTO,
+    format,
+    CTLTYPE_OPAQUE | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_LAT_FORMAT,
+    sysctl_latency,
+    "S,hist",
+    "" /* sysctl nub: kextlog.latency.format */
+);
+
+static SYSCTL_PROC(
+    _kextlog_latency,
+    OID_AUTO,
+    enqueue,
+    CTLTYPE_OPAQUE | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_LAT_ENQUEUE,
+    sysctl_latency,
+    "S,hist",
+    "" /* sysctl nub: kextlog.latency.enqueue */
+);
+
+static SYSCTL_PROC(
+    _kextlog_latency,
+    OID_AUTO,
+    spin,
+    CTLTYPE_OPAQUE | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_LAT_SPIN,
+    sysctl_latency,
+    "S,hist",
+    "" /* sysctl nub: kextlog.latency.spin */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    syslog_contended,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(syslog_contended),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.syslog_contended */
+);
+
+static SYSCTL_PROC(
+    _kextlog_statistics,
+    OID_AUTO,
+    syslog_stackbuf,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(syslog_stackbuf),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.statistics.syslog_stackbuf */
+);
+
+static SYSCTL_NODE(
+    _kextlog,
+    OID_AUTO,
+    flight,
+    CTLFLAG_RW,
+    NULL,
+    "" /* sysctl node: kextlog.flight */
+)
+
+static struct sysctl_uint_range flight_size_range = {
+    &log_conf.flight_size, 0, KEXTLOG_FLIGHT_SIZE_MAX, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog_flight,
+    OID_AUTO,
+    size,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &flight_size_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.flight.size */
+);
+
+static SYSCTL_PROC(
+    _kextlog_flight,
+    OID_AUTO,
+    stored,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(flight_stored),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.flight.stored */
+);
+
+static SYSCTL_PROC(
+    _kextlog_flight,
+    OID_AUTO,
+    overwritten,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(flight_overwritten),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.flight.overwritten */
+);
+
+static SYSCTL_PROC(
+    _kextlog_flight,
+    OID_AUTO,
+    replayed,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(flight_replayed),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.flight.replayed */
+);
+
+/*
+ * Priority lanes  see: KEXTLOG_LANE_*
+ */
+static SYSCTL_NODE(
+    _kextlog,
+    OID_AUTO,
+    lane,
+    CTLFLAG_RW,
+    NULL,
+    "" /* sysctl node: kextlog.lane */
+)
+
+static struct sysctl_uint_range lane_reserve_range = {
+    &log_conf.lane_reserve, 0, KEXTLOG_LANE_RESERVE_MAX(KEXTLOG_RECVSIZE), NULL,
+};
+
+/**
+ * Read/write kextlog.lane.reserve  capped by kctl receive buffer size
+ *  which is known only after the boot-arg parsed
+ */
+static int sysctl_lane_reserve(SYSCTL_HANDLER_ARGS)
+{
+    lane_reserve_range.max = KEXTLOG_LANE_RESERVE_MAX(log_conf.recvsize);
+    return sysctl_uint_range(oidp, arg1, arg2, req);
+}
+
+static SYSCTL_PROC(
+    _kextlog_lane,
+    OID_AUTO,
+    reserve,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &lane_reserve_range,
+    0,
+    sysctl_lane_reserve,
+    "IU",
+    "" /* sysctl nub: kextlog.lane.reserve */
+);
+
+static SYSCTL_PROC(
+    _kextlog_lane,
+    OID_AUTO,
+    high_dropped,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(lane_dropped[KEXTLOG_LANE_HIGH]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.lane.high_dropped */
+);
+
+static SYSCTL_PROC(
+    _kextlog_lane,
+    OID_AUTO,
+    low_dropped,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(lane_dropped[KEXTLOG_LANE_LOW]),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.lane.low_dropped */
+);
+
+/*
+ * kctl transport  see: KEXTLOG_RECVSIZE
+ */
+static SYSCTL_NODE(
+    _kextlog,
+    OID_AUTO,
+    kctl,
+    CTLFLAG_RW,
+    NULL,
+    "" /* sysctl node: kextlog.kctl */
+)
+
+static SYSCTL_UINT(
+    _kextlog_kctl,
+    OID_AUTO,
+    recvsize,
+    CTLFLAG_RD,
+    (uint32_t *) &log_conf.recvsize,
+    0,
+    "" /* sysctl nub: kextlog.kctl.recvsize */
+);
+
+static SYSCTL_PROC(
+    _kextlog_kctl,
+    OID_AUTO,
+    frames,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(frames),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.kctl.frames */
+);
+
+static SYSCTL_PROC(
+    _kextlog_kctl,
+    OID_AUTO,
+    v2_raw,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(v2_raw),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.kctl.v2_raw */
+);
+
+static SYSCTL_PROC(
+    _kextlog_kctl,
+    OID_AUTO,
+    v2_packed,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(v2_packed),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.kctl.v2_packed */
+);
+
+static SYSCTL_PROC(
+    _kextlog_kctl,
+    OID_AUTO,
+    lz_raw,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(lz_raw),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.kctl.lz_raw */
+);
+
+static SYSCTL_PROC(
+    _kextlog_kctl,
+    OID_AUTO,
+    lz_packed,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(lz_packed),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.kctl.lz_packed */
+);
+
+/*
+ * Backpressure policy  see: KEXTLOG_BP_*
+ */
+static SYSCTL_NODE(
+    _kextlog,
+    OID_AUTO,
+    backpressure,
+    CTLFLAG_RW,
+    NULL,
+    "" /* sysctl node: kextlog.backpressure */
+)
+
+static struct sysctl_uint_range bp_policy_range = {
+    &log_conf.backpressure, KEXTLOG_BP_DROP_NEWEST, KEXTLOG_BP_MAX, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog_backpressure,
+    OID_AUTO,
+    policy,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &bp_policy_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.backpressure.policy */
+);
+
+static struct sysctl_uint_range bp_timeout_range = {
+    &log_conf.bp_timeout, 0, KEXTLOG_BP_TIMEOUT_MAX, NULL,
+};
+
+static SYSCTL_PROC(
+    _kextlog_backpressure,
+    OID_AUTO,
+    timeout,
+    CTLTYPE_INT | CTLFLAG_RW,
+    &bp_timeout_range,
+    0,
+    sysctl_uint_range,
+    "IU",
+    "" /* sysctl nub: kextlog.backpressure.timeout */
+);
+
+static SYSCTL_PROC(
+    _kextlog_backpressure,
+    OID_AUTO,
+    dropped,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(ring_full),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.backpressure.dropped */
+);
+
+static SYSCTL_PROC(
+    _kextlog_backpressure,
+    OID_AUTO,
+    evicted,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(bp_evicted),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.backpressure.evicted */
+);
+
+static SYSCTL_PROC(
+    _kextlog_backpressure,
+    OID_AUTO,
+    blocked,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(bp_blocked),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.backpressure.blocked */
+);
+
+static SYSCTL_PROC(
+    _kextlog_backpressure,
+    OID_AUTO,
+    timedout,
+    CTLTYPE_QUAD | CTLFLAG_RD,
+    NULL,
+    KEXTLOG_STAT_OFF(bp_timeout),
+    sysctl_stat_sum,
+    "QU",
+    "" /* sysctl nub: kextlog.backpressure.timedout */
+);
+
+#define SITE_CMD_MAX        256
+
+/**
+ * Read to list all log call sites  write to toggle them
+ *  see: log_site.c#log_site_ctl
+ */
+static int sysctl_site(SYSCTL_HANDLER_ARGS)
+{
+    char cmd[SITE_CMD_MAX];
+    char *buf;
+    size_t n;
+    int e;
+
+    UNUSED(oidp, arg1, arg2);
+
+    n = log_site_dump(NULL, 0);
+    buf = (char *) util_malloc0(n + 1, M_WAITOK | M_NULL);
+    if (buf == NULL) return ENOMEM;
+
+    (void) log_site_dump(buf, n + 1);
+    e = SYSCTL_OUT(req, buf, n + 1);
+    util_mfree(buf);
+
+    if (e != 0 || req->newptr == USER_ADDR_NULL) return e;
+
+    if (req->newlen >= sizeof(cmd)) return EINVAL;
+    e = SYSCTL_IN(req, cmd, req->newlen);
+    if (e != 0) return e;
+    cmd[req->newlen] = '\0';
+
+    return log_site_ctl(cmd);
+}
+
+static SYSCTL_PROC(
+    _kextlog,
+    OID_AUTO,
+    site,
+    CTLTYPE_STRING | CTLFLAG_RW,
+    NULL,
+    0,
+    sysctl_site,
+    "A",
+    "" /* sysctl nub: kextlog.site */
+);
+
 static struct sysctl_oid *sysctl_entries[] = {
     /* sysctl nodes */
     &sysctl__kextlog,
     &sysctl__kextlog_statistics,
+    &sysctl__kextlog_batch,
+    &sysctl__kextlog_level,
+    &sysctl__kextlog_statistics_filtered,
+    &sysctl__kextlog_ratelimit,
+    &sysctl__kextlog_statistics_pool,
+    &sysctl__kextlog_latency,
+    &sysctl__kextlog_flight,
+    &sysctl__kextlog_lane,
+    &sysctl__kextlog_backpressure,
+    &sysctl__kextlog_kctl,
+    &sysctl__kextlog_statistics_messages,
+    &sysctl__kextlog_statistics_dropped,
 
     /* sysctl nubs */
     &sysctl__kextlog_statistics_syslog,
@@ -83,6 +1384,80 @@ static struct sysctl_oid *sysctl_entries[] = {
     &sysctl__kextlog_statistics_stackmsg,
     &sysctl__kextlog_statistics_oom,
     &sysctl__kextlog_statistics_enqueue_failure,
+    &sysctl__kextlog_statistics_ring_full,
+    &sysctl__kextlog_statistics_batch,
+    &sysctl__kextlog_batch_size,
+    &sysctl__kextlog_batch_latency,
+    &sysctl__kextlog_binary,
+    &sysctl__kextlog_site,
+    &sysctl__kextlog_level_min,
+    &sysctl__kextlog_level_generic,
+    &sysctl__kextlog_level_process,
+    &sysctl__kextlog_level_vnode,
+    &sysctl__kextlog_level_fileop,
+    &sysctl__kextlog_statistics_filtered_trace,
+    &sysctl__kextlog_statistics_filtered_debug,
+    &sysctl__kextlog_statistics_filtered_info,
+    &sysctl__kextlog_statistics_filtered_warning,
+    &sysctl__kextlog_statistics_filtered_error,
+    &sysctl__kextlog_ratelimit_mode,
+    &sysctl__kextlog_ratelimit_rate,
+    &sysctl__kextlog_ratelimit_burst,
+    &sysctl__kextlog_statistics_ratelimited,
+    &sysctl__kextlog_statistics_evfiltered,
+    &sysctl__kextlog_statistics_pool_hit_256,
+    &sysctl__kextlog_statistics_pool_miss_256,
+    &sysctl__kextlog_statistics_pool_hiwat_256,
+    &sysctl__kextlog_statistics_pool_hit_512,
+    &sysctl__kextlog_statistics_pool_miss_512,
+    &sysctl__kextlog_statistics_pool_hiwat_512,
+    &sysctl__kextlog_statistics_pool_hit_1k,
+    &sysctl__kextlog_statistics_pool_miss_1k,
+    &sysctl__kextlog_statistics_pool_hiwat_1k,
+    &sysctl__kextlog_statistics_pool_hit_4k,
+    &sysctl__kextlog_statistics_pool_miss_4k,
+    &sysctl__kextlog_statistics_pool_hiwat_4k,
+    &sysctl__kextlog_statistics_ringmsg,
+    &sysctl__kextlog_statistics_truncated,
+    &sysctl__kextlog_statistics_reformat,
+    &sysctl__kextlog_msg_max,
+    &sysctl__kextlog_statistics_bytes_enqueued,
+    &sysctl__kextlog_statistics_snapshot,
+    &sysctl__kextlog_latency_enable,
+    &sysctl__kextlog_latency_format,
+    &sysctl__kextlog_latency_enqueue,
+    &sysctl__kextlog_latency_spin,
+    &sysctl__kextlog_statistics_syslog_contended,
+    &sysctl__kextlog_statistics_syslog_stackbuf,
+    &sysctl__kextlog_flight_size,
+    &sysctl__kextlog_flight_stored,
+    &sysctl__kextlog_flight_overwritten,
+    &sysctl__kextlog_flight_replayed,
+    &sysctl__kextlog_lane_reserve,
+    &sysctl__kextlog_lane_high_dropped,
+    &sysctl__kextlog_lane_low_dropped,
+    &sysctl__kextlog_kctl_recvsize,
+    &sysctl__kextlog_kctl_frames,
+    &sysctl__kextlog_kctl_v2_raw,
+    &sysctl__kextlog_kctl_v2_packed,
+    &sysctl__kextlog_kctl_lz_raw,
+    &sysctl__kextlog_kctl_lz_packed,
+    &sysctl__kextlog_backpressure_policy,
+    &sysctl__kextlog_backpressure_timeout,
+    &sysctl__kextlog_backpressure_dropped,
+    &sysctl__kextlog_backpressure_evicted,
+    &sysctl__kextlog_backpressure_blocked,
+    &sysctl__kextlog_backpressure_timedout,
+    &sysctl__kextlog_statistics_messages_trace,
+    &sysctl__kextlog_statistics_messages_debug,
+    &sysctl__kextlog_statistics_messages_info,
+    &sysctl__kextlog_statistics_messages_warning,
+    &sysctl__kextlog_statistics_messages_error,
+    &sysctl__kextlog_statistics_dropped_trace,
+    &sysctl__kextlog_statistics_dropped_debug,
+    &sysctl__kextlog_statistics_dropped_info,
+    &sysctl__kextlog_statistics_dropped_warning,
+    &sysctl__kextlog_statistics_dropped_error,
 };
 
 void log_sysctl_register(void)
@@ -5,15 +5,216 @@
 #ifndef LOG_SYSCTL_H
 #define LOG_SYSCTL_H
 
+#include <libkern/OSAtomic.h>
+#include <kern/cpu_number.h>
+
+#include "kextlog.h"
+
+#define KEXTLOG_NCPU_MAX            64
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE             64
+#endif
+
+/*
+ * Batch buffer size  a batch must fit in kctl receive buffer
+ *  see: xnu/bsd/kern/kern_control.c#CTL_RECVSIZE
+ */
+#define KEXTLOG_BATCH_MAX           6144
+#define KEXTLOG_BATCH_SIZE          2048
+#define KEXTLOG_BATCH_LATENCY       10          /* In milliseconds */
+#define KEXTLOG_BATCH_LATENCY_MAX   1000
+
+/*
+ * Hard cap of a text message(including trailing `\0')  longer ones are truncated
+ *  a message of this size is reserved in the ring before formatting
+ */
+#define KEXTLOG_MSG_MAX             2048
+#define KEXTLOG_MSG_MAX_MIN         128
+#define KEXTLOG_MSG_MAX_MAX         4096
+
+/*
+ * Flight recorder size  rounded down to power of 2
+ *  sizes below KEXTLOG_FLIGHT_SIZE_MIN disable it
+ */
+#define KEXTLOG_FLIGHT_SIZE         65536
+#define KEXTLOG_FLIGHT_SIZE_MIN     16384
+#define KEXTLOG_FLIGHT_SIZE_MAX     (16 * 1024 * 1024)
+
+/*
+ * kctl receive buffer size  fixed since kctl registered
+ *  override it by boot-arg kextlog_recvsize=<bytes>
+ * xnu default is 8 KiB  which hardly holds a burst
+ */
+#define KEXTLOG_RECVSIZE            65536
+#define KEXTLOG_RECVSIZE_MIN        8192
+#define KEXTLOG_RECVSIZE_MAX        2097152
+#define KEXTLOG_RECVSIZE_BOOTARG    "kextlog_recvsize"
+
+/*
+ * Priority lanes  high lane is drained ahead of low lane
+ */
+#define KEXTLOG_LANE_HIGH           0   /* WARNING and ERROR */
+#define KEXTLOG_LANE_LOW            1   /* TRACE  DEBUG and INFO */
+#define KEXTLOG_NLANE               2
+#define KEXTLOG_LANE(level)         ((level) >= KEXTLOG_LEVEL_WARNING ? KEXTLOG_LANE_HIGH : KEXTLOG_LANE_LOW)
+
+/*
+ * Backpressure policies  i.e. what to do when a ring is full
+ */
+#define KEXTLOG_BP_DROP_NEWEST      0   /* Drop the message being logged */
+#define KEXTLOG_BP_DROP_OLDEST      1   /* Consumer evicts oldest records */
+#define KEXTLOG_BP_BLOCK            2   /* log_printf_sleep() waits for room */
+#define KEXTLOG_BP_MAX              KEXTLOG_BP_BLOCK
+
+/* Max sleep of KEXTLOG_BP_BLOCK policy in ms */
+#define KEXTLOG_BP_TIMEOUT          10
+#define KEXTLOG_BP_TIMEOUT_MAX      1000
+
+/*
+ * kctl receive buffer bytes low lane records cannot take
+ *  at most half of the buffer  so low lane always has room
+ */
+#define KEXTLOG_LANE_RESERVE        2048
+#define KEXTLOG_LANE_RESERVE_MAX(recvsize)  ((recvsize) / 2)
+
+/* Size classes of per-CPU message pools  256 512 1K 4K */
+#define KEXTLOG_POOL_NCLASS         4
+
+#define KEXTLOG_RATELIMIT_OFF       0
+#define KEXTLOG_RATELIMIT_SITE      1       /* Per call site */
+#define KEXTLOG_RATELIMIT_PID       2       /* Per call site per process */
+
+#define KEXTLOG_RATELIMIT_RATE      1000    /* Messages per second */
+#define KEXTLOG_RATELIMIT_RATE_MAX  1000000
+#define KEXTLOG_RATELIMIT_BURST     100
+#define KEXTLOG_RATELIMIT_BURST_MAX 65536
+
+/*
+ * Phases of log_printf() whose latency are recorded
+ */
+#define KEXTLOG_LAT_FORMAT          0   /* Formatting or argument packing */
+#define KEXTLOG_LAT_ENQUEUE         1   /* Ring reservation and copy */
+#define KEXTLOG_LAT_SPIN            2   /* Acquiring syslog fallback buffer */
+#define KEXTLOG_LAT_NPHASE          3
+
+/*
+ * Runtime tunables
+ */
+struct kextlog_config {
+    /* Flush threshold of a batch in bytes  zero to disable batching */
+    volatile uint32_t batch_size;
+    /* Max time a record may wait in a batch  in milliseconds */
+    volatile uint32_t batch_latency;
+    /* Nonzero to defer formatting to user space */
+    volatile uint32_t binary;
+    /*
+     * Minimum log level  indexed by KEXTLOG_SCOPE_*
+     * KEXTLOG_SCOPE_NONE denotes the global one  which applies to all scopes
+     */
+    volatile uint32_t level_min[KEXTLOG_SCOPE_MAX];
+    /* One of KEXTLOG_RATELIMIT_* */
+    volatile uint32_t ratelimit_mode;
+    /* Sustained messages per second of a rate limit bucket */
+    volatile uint32_t ratelimit_rate;
+    /* Max messages can be emitted in a burst */
+    volatile uint32_t ratelimit_burst;
+    /* Hard cap of a text message in bytes */
+    volatile uint32_t msg_max;
+    /* Nonzero to record latency histograms */
+    volatile uint32_t latency;
+    /* Size of flight recorder in bytes */
+    volatile uint32_t flight_size;
+    /* kctl receive buffer bytes reserved for high lane */
+    volatile uint32_t lane_reserve;
+    /* kctl receive buffer size  read-only */
+    volatile uint32_t recvsize;
+    /* Backpressure policy  see: KEXTLOG_BP_* */
+    volatile uint32_t backpressure;
+    /* Max sleep of KEXTLOG_BP_BLOCK policy in ms */
+    volatile uint32_t bp_timeout;
+};
+
+extern struct kextlog_config log_conf;
+
+/*
+ * Counters are sharded per CPU  each CPU only bumps its own cache line
+ *  they're summed up when read via sysctl
+ *
+ * All fields must be uint64_t  the sysctl snapshot walks it as an array
+ */
 struct kextlog_statistics {
     volatile uint64_t syslog;
     volatile uint64_t heapmsg;
     volatile uint64_t stackmsg;
     volatile uint64_t oom;
     volatile uint64_t enqueue_failure;
-};
+    volatile uint64_t ring_full;
+    volatile uint64_t batch;
+    /* Messages skipped due to level threshold  indexed by level */
+    volatile uint64_t filtered[KEXTLOG_NLEVEL];
+    volatile uint64_t ratelimited;
+    /* Text messages formatted in place in the ring */
+    volatile uint64_t ringmsg;
+    /* Messages truncated */
+    volatile uint64_t truncated;
+    /* Messages formatted twice  only if ring has no room for in-place formatting */
+    volatile uint64_t reformat;
+    /* Per-CPU message pools  indexed by size class */
+    volatile uint64_t pool_hit[KEXTLOG_POOL_NCLASS];
+    volatile uint64_t pool_miss[KEXTLOG_POOL_NCLASS];
+    /* Max blocks ever in use of a single CPU's pool */
+    volatile uint64_t pool_hiwat[KEXTLOG_POOL_NCLASS];
+    /* Bytes(headers included) successfully pushed into rings */
+    volatile uint64_t bytes_enqueued;
+    /* Messages successfully pushed into rings  indexed by level */
+    volatile uint64_t messages[KEXTLOG_NLEVEL];
+    /* Messages failed to reach user space(went to syslog instead)  indexed by level */
+    volatile uint64_t dropped[KEXTLOG_NLEVEL];
+    /* Busy syslog fallback buffers met */
+    volatile uint64_t syslog_contended;
+    /* Syslog messages formatted on stack since all probed buffers busy */
+    volatile uint64_t syslog_stackbuf;
+    /* Records saved into flight recorder while no client connected */
+    volatile uint64_t flight_stored;
+    /* Records overwritten(thus dropped) in flight recorder */
+    volatile uint64_t flight_overwritten;
+    /* Records replayed from flight recorder */
+    volatile uint64_t flight_replayed;
+    /* Messages dropped  indexed by priority lane */
+    volatile uint64_t lane_dropped[KEXTLOG_NLANE];
+    /* Records evicted by drop-oldest policy */
+    volatile uint64_t bp_evicted;
+    /* log_printf_sleep() calls slept for ring space */
+    volatile uint64_t bp_blocked;
+    /* log_printf_sleep() calls gave up waiting */
+    volatile uint64_t bp_timeout;
+    /* KAuth events filtered out by subscribers' event filters */
+    volatile uint64_t evfiltered;
+    /* Frame headers sent to SOCK_STREAM or compressing subscribers */
+    volatile uint64_t frames;
+    /* Bytes of records sent in wire format V2  before and after packing */
+    volatile uint64_t v2_raw;
+    volatile uint64_t v2_packed;
+    /* Bytes of batches compressed  before and after compression */
+    volatile uint64_t lz_raw;
+    volatile uint64_t lz_packed;
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+extern struct kextlog_statistics log_stat[KEXTLOG_NCPU_MAX];
+
+/*
+ * Counter block of current CPU
+ * A thread may migrate in between  it then bumps another CPU's copy
+ *  which only costs a shared cache line  the sum stays correct
+ */
+#define KEXTLOG_STAT_OFF(f)     __builtin_offsetof(struct kextlog_statistics, f)
+
+uint64_t log_stat_sum(int);
 
-extern struct kextlog_statistics log_stat;
+#define log_stat_cpu()          (&log_stat[(uint32_t) cpu_number() % KEXTLOG_NCPU_MAX])
+#define log_stat_add(f, n)      (void) OSAddAtomic64((SInt64) (n), (SInt64 *) &log_stat_cpu()->f)
+#define log_stat_inc(f)         log_stat_add(f, 1)
 
 void log_sysctl_register(void);
 void log_sysctl_deregister(void);
@@ -0,0 +1,203 @@
+/*
+ * Created 200113
+ */
+
+#include <string.h>
+
+#include "lzpack.h"
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    (void) memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZPACK_HASH_BITS);
+}
+
+/**
+ * Write a length continues a saturated nibble
+ * @return      bytes written  0 if no room
+ */
+static inline size_t put_len(uint8_t *p, size_t cap, size_t len)
+{
+    size_t n = 0;
+
+    while (len >= 255) {
+        if (n == cap) return 0;
+        p[n++] = 255;
+        len -= 255;
+    }
+    if (n == cap) return 0;
+    p[n++] = (uint8_t) len;
+
+    return n;
+}
+
+/**
+ * Emit a sequence
+ * @mlen        match length  zero for the last sequence
+ * @return      bytes written  0 if no room
+ */
+static size_t put_seq(
+        uint8_t *op,
+        size_t cap,
+        const uint8_t *lit,
+        size_t nlit,
+        size_t mlen,
+        size_t off)
+{
+    size_t n = 1;
+    size_t k;
+    size_t ml = mlen ? mlen - LZPACK_MINMATCH : 0;
+
+    if (cap == 0) return 0;
+    op[0] = (uint8_t) ((nlit < 15 ? nlit : 15) << 4 | (ml < 15 ? ml : 15));
+
+    if (nlit >= 15) {
+        if ((k = put_len(op + n, cap - n, nlit - 15)) == 0) return 0;
+        n += k;
+    }
+
+    if (cap - n < nlit) return 0;
+    (void) memcpy(op + n, lit, nlit);
+    n += nlit;
+
+    if (mlen == 0) return n;
+
+    if (cap - n < 2) return 0;
+    op[n++] = (uint8_t) off;
+    op[n++] = (uint8_t) (off >> 8);
+
+    if (ml >= 15) {
+        if ((k = put_len(op + n, cap - n, ml - 15)) == 0) return 0;
+        n += k;
+    }
+
+    return n;
+}
+
+/**
+ * Compress a block
+ * @len         input size  at most LZPACK_INPUT_MAX
+ * @cap         output capacity  LZPACK_BOUND(len) always suffices
+ * @return      compressed size  0 if input too large or output doesn't fit
+ */
+size_t lzpack_compress(
+        struct lzpack_ctx *ctx,
+        const void *src,
+        size_t len,
+        void *dst,
+        size_t cap)
+{
+    const uint8_t *s = (const uint8_t *) src;
+    uint8_t *op = (uint8_t *) dst;
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t ref;
+    size_t mlen;
+    size_t n = 0;
+    size_t k;
+    uint32_t v;
+    uint32_t h;
+
+    if (len > LZPACK_INPUT_MAX) return 0;
+
+    /* Stale positions are harmless  candidates are always verified */
+    (void) memset(ctx->table, 0, sizeof(ctx->table));
+
+    while (ip + LZPACK_MINMATCH <= len) {
+        v = read32(s + ip);
+        h = lz_hash(v);
+        ref = ctx->table[h];
+        ctx->table[h] = (uint16_t) ip;
+
+        if (ref >= ip || read32(s + ref) != v) {
+            /* Skip faster over incompressible data */
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        mlen = LZPACK_MINMATCH;
+        while (ip + mlen < len && s[ref + mlen] == s[ip + mlen]) mlen++;
+
+        k = put_seq(op + n, cap - n, s + anchor, ip - anchor, mlen, ip - ref);
+        if (k == 0) return 0;
+        n += k;
+
+        ip += mlen;
+        anchor = ip;
+    }
+
+    k = put_seq(op + n, cap - n, s + anchor, len - anchor, 0, 0);
+    if (k == 0) return 0;
+
+    return n + k;
+}
+
+/**
+ * Read a length continues a saturated nibble
+ * @return      0 if success  -1 if truncated
+ */
+static inline int get_len(const uint8_t *p, size_t len, size_t *i, size_t *v)
+{
+    uint8_t b;
+
+    do {
+        if (*i >= len) return -1;
+        b = p[(*i)++];
+        *v += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+/**
+ * Decompress a block  every access is bounds checked
+ * @cap         output capacity
+ * @return      decompressed size  -1 if malformed or output doesn't fit
+ */
+int lzpack_decompress(const void *src, size_t len, void *dst, size_t cap)
+{
+    const uint8_t *p = (const uint8_t *) src;
+    uint8_t *op = (uint8_t *) dst;
+    size_t i = 0;
+    size_t o = 0;
+    size_t nlit;
+    size_t mlen;
+    size_t off;
+    uint8_t token;
+
+    while (1) {
+        if (i >= len) return -1;
+        token = p[i++];
+
+        nlit = token >> 4;
+        if (nlit == 15 && get_len(p, len, &i, &nlit) != 0) return -1;
+        if (nlit > len - i || nlit > cap - o) return -1;
+        (void) memcpy(op + o, p + i, nlit);
+        i += nlit;
+        o += nlit;
+
+        if (i == len) break;
+
+        if (len - i < 2) return -1;
+        off = (size_t) p[i] | (size_t) p[i + 1] << 8;
+        i += 2;
+        if (off == 0 || off > o) return -1;
+
+        mlen = (token & 0xf);
+        if (mlen == 15 && get_len(p, len, &i, &mlen) != 0) return -1;
+        mlen += LZPACK_MINMATCH;
+        if (mlen > cap - o) return -1;
+
+        /* Overlapped copy  byte by byte */
+        for (; mlen != 0; mlen--, o++) op[o] = op[o - off];
+    }
+
+    return o > INT32_MAX ? -1 : (int) o;
+}
+
@@ -0,0 +1,42 @@
+/*
+ * Created 200113
+ *
+ * Minimal LZ77 block codec(LZ4 alike)  used to compress record batches
+ *
+ * This file has no kernel dependency  it's shared by kext and log daemon
+ */
+
+#ifndef LZPACK_H
+#define LZPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Block layout  a sequence of:
+ *  1 byte      literal length << 4 | (match length - LZPACK_MINMATCH)
+ *              a nibble of 15 continues with 255-saturated bytes
+ *  literals
+ *  2 bytes     little-endian match offset  omitted in the last sequence
+ *
+ * Last sequence holds literals only  and ends the block
+ */
+#define LZPACK_MINMATCH         4
+#define LZPACK_HASH_BITS        12
+#define LZPACK_INPUT_MAX        65535   /* Positions stored in 16 bits */
+
+/* Worst case output size of an incompressible input */
+#define LZPACK_BOUND(n)         ((n) + (n) / 255 + 16)
+
+/*
+ * Match finder state  too large for kernel stack
+ */
+struct lzpack_ctx {
+    uint16_t table[1u << LZPACK_HASH_BITS];
+};
+
+size_t lzpack_compress(struct lzpack_ctx *, const void *, size_t, void *, size_t);
+int lzpack_decompress(const void *, size_t, void *, size_t);
+
+#endif /* LZPACK_H */
+
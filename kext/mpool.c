@@ -0,0 +1,107 @@
+/*
+ * Created 200109
+ */
+
+#include <stddef.h>
+#include <sys/errno.h>
+
+#include "mpool.h"
+
+#define MP_IDX_MASK     0xffffffffULL
+#define MP_TAG_ONE      (1ULL << 32)
+
+#define mp_load(p, mo)          __atomic_load_n(p, mo)
+#define mp_cas(p, o, n)         \
+    __atomic_compare_exchange_n(p, o, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+static inline volatile uint32_t *mp_link(const struct mpool *mp, uint64_t idx1)
+{
+    return (volatile uint32_t *) (mp->base + (idx1 - 1) * mp->bsize);
+}
+
+/**
+ * Initialize a pool over caller-supplied storage
+ * @buf     storage of nblock * bsize bytes  must be 8-byte aligned
+ * @bsize   block size  must be a positive multiple of 8
+ * @nblock  number of blocks
+ * @return  0 if success  EINVAL if bad argument
+ */
+int mpool_init(struct mpool *mp, void *buf, uint32_t bsize, uint32_t nblock)
+{
+    uint32_t i;
+
+    if (mp == NULL || buf == NULL) return EINVAL;
+    if (bsize == 0 || (bsize & (MPOOL_ALIGN - 1)) != 0) return EINVAL;
+    if (((uintptr_t) buf & (MPOOL_ALIGN - 1)) != 0) return EINVAL;
+    if (nblock == 0 || nblock == UINT32_MAX) return EINVAL;
+
+    mp->base = (uint8_t *) buf;
+    mp->bsize = bsize;
+    mp->nblock = nblock;
+    mp->inuse = 0;
+    mp->hiwat = 0;
+
+    /* Chain all blocks in address order  last one links to zero */
+    for (i = 1; i <= nblock; i++) {
+        *mp_link(mp, i) = i < nblock ? i + 1 : 0;
+    }
+    mp->top = 1;
+
+    return 0;
+}
+
+/**
+ * Take a block from the pool  safe to call concurrently
+ * @return  pointer to a block  NULL if the pool is empty
+ */
+void *mpool_get(struct mpool *mp)
+{
+    uint64_t top, next;
+    uint32_t n, hw;
+
+    top = mp_load(&mp->top, __ATOMIC_ACQUIRE);
+    do {
+        if ((top & MP_IDX_MASK) == 0) return NULL;
+        /*
+         * The block may be taken and reused concurrently  the link read is
+         *  then garbage  yet the tag guarantees the CAS will fail
+         */
+        next = ((top & ~MP_IDX_MASK) + MP_TAG_ONE) | *mp_link(mp, top & MP_IDX_MASK);
+    } while (!mp_cas(&mp->top, &top, next));
+
+    n = __atomic_add_fetch(&mp->inuse, 1, __ATOMIC_RELAXED);
+    hw = mp_load(&mp->hiwat, __ATOMIC_RELAXED);
+    while (n > hw && !__atomic_compare_exchange_n(&mp->hiwat, &hw, n, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        continue;
+    }
+
+    return (void *) mp_link(mp, top & MP_IDX_MASK);
+}
+
+/**
+ * Return a block to its pool  safe to call concurrently and from any CPU
+ * @p       block returned by mpool_get() of the same pool
+ */
+void mpool_put(struct mpool *mp, void *p)
+{
+    uint64_t idx1 = (uint64_t) ((uint8_t *) p - mp->base) / mp->bsize + 1;
+    uint64_t top, next;
+
+    top = mp_load(&mp->top, __ATOMIC_RELAXED);
+    do {
+        *mp_link(mp, idx1) = (uint32_t) (top & MP_IDX_MASK);
+        next = ((top & ~MP_IDX_MASK) + MP_TAG_ONE) | idx1;
+    } while (!mp_cas(&mp->top, &top, next));
+
+    (void) __atomic_sub_fetch(&mp->inuse, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @return  nonzero if p points to a block of the pool
+ */
+int mpool_owns(const struct mpool *mp, const void *p)
+{
+    const uint8_t *q = (const uint8_t *) p;
+    return q >= mp->base && q < mp->base + (size_t) mp->bsize * mp->nblock;
+}
+
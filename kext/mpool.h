@@ -0,0 +1,36 @@
+/*
+ * Created 200109
+ *
+ * Lock-free fixed-size block pool
+ *
+ * This file has no kernel dependency  it can be built in user space as-is
+ */
+
+#ifndef MPOOL_H
+#define MPOOL_H
+
+#include <stdint.h>
+
+#define MPOOL_ALIGN             8
+
+/*
+ * Free blocks form a Treiber stack  each free block stores index of its
+ *  successor in its first word  top of the stack is tagged by a generation
+ *  counter to defeat ABA with a plain 64-bit CAS
+ */
+struct mpool {
+    uint8_t *base;
+    uint32_t bsize;                 /* Block size  multiple of MPOOL_ALIGN */
+    uint32_t nblock;
+    volatile uint64_t top;          /* (tag << 32) | (index + 1)  zero if empty */
+    volatile uint32_t inuse;        /* Blocks currently handed out */
+    volatile uint32_t hiwat;        /* High-water mark of inuse */
+};
+
+int mpool_init(struct mpool *, void *, uint32_t, uint32_t);
+void *mpool_get(struct mpool *);
+void mpool_put(struct mpool *, void *);
+int mpool_owns(const struct mpool *, const void *);
+
+#endif /* MPOOL_H */
+
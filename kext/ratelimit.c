@@ -0,0 +1,50 @@
+/*
+ * Created 200108
+ */
+
+#include "ratelimit.h"
+
+/*
+ * Bound CAS retries so cost per call stays constant under a flood
+ *  a call lost all retries is treated as suppressed
+ */
+#define RATELIMIT_CAS_RETRY     4
+
+/**
+ * Take a token from the bucket
+ * @now         current time  in any monotonic unit
+ * @interval    time to refill one token  in the same unit as now
+ * @burst       bucket capacity(max tokens)  must be positive
+ * @return      1 if allowed  0 if suppressed
+ */
+int ratelimit_check(struct ratelimit *rl, uint64_t now, uint64_t interval, uint32_t burst)
+{
+    uint64_t tat;
+    uint64_t next;
+    int i;
+
+    tat = __atomic_load_n(&rl->tat, __ATOMIC_RELAXED);
+    for (i = 0; i < RATELIMIT_CAS_RETRY; i++) {
+        next = (tat > now ? tat : now) + interval;
+        /* Bucket empty if arrival time runs ahead more than burst tokens */
+        if (next - now > interval * burst) break;
+
+        if (__atomic_compare_exchange_n(&rl->tat, &tat, next, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+
+    (void) __atomic_add_fetch(&rl->suppressed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * Fetch and reset suppressed counter
+ * @return      number of calls suppressed since last time
+ */
+uint32_t ratelimit_take_suppressed(struct ratelimit *rl)
+{
+    if (__atomic_load_n(&rl->suppressed, __ATOMIC_RELAXED) == 0) return 0;
+    return __atomic_exchange_n(&rl->suppressed, 0, __ATOMIC_RELAXED);
+}
+
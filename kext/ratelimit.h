@@ -0,0 +1,28 @@
+/*
+ * Created 200108
+ *
+ * Lock-free token bucket rate limiter
+ *
+ * This file has no kernel dependency  it can be built in user space as-is
+ */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+
+/*
+ * Implemented as GCRA(generic cell rate algorithm)  which is equivalent to
+ *  a token bucket  yet the whole state is a single word updated by one CAS
+ */
+struct ratelimit {
+    volatile uint64_t tat;          /* Theoretical arrival time */
+    volatile uint32_t suppressed;   /* Suppressed since last pass */
+    uint32_t _reserved;
+};
+
+int ratelimit_check(struct ratelimit *, uint64_t, uint64_t, uint32_t);
+uint32_t ratelimit_take_suppressed(struct ratelimit *);
+
+#endif /* RATELIMIT_H */
+
@@ -0,0 +1,185 @@
+/*
+ * Created 200104
+ *
+ * Each record is prefixed with a 64-bit header word:
+ *  low 32 bits     record length(payload only  header excluded)
+ *  high 32 bits    record flags
+ *
+ * A zero header word means the record is not yet committed  consumer zeroes
+ *  every consumed byte before handing space back to producers
+ *  thus stale payload bytes can never be mistaken for a committed header
+ */
+
+#include <string.h>
+#include <sys/errno.h>
+
+#include "ringbuf.h"
+
+#define RB_F_COMMIT     (1ULL << 32)
+#define RB_F_PAD        (2ULL << 32)
+#define RB_LEN_MASK     0xffffffffULL
+
+#define RB_ROUNDUP(x)   (((x) + (RINGBUF_ALIGN - 1)) & ~((uint64_t) RINGBUF_ALIGN - 1))
+
+#define rb_load(p, mo)          __atomic_load_n(p, mo)
+#define rb_store(p, v, mo)      __atomic_store_n(p, v, mo)
+#define rb_cas(p, o, n)         \
+    __atomic_compare_exchange_n(p, o, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+
+static inline volatile uint64_t *rb_hdr(const struct ringbuf *rb, uint64_t pos)
+{
+    return (volatile uint64_t *) (rb->data + (pos & rb->mask));
+}
+
+/**
+ * Initialize a ring buffer over caller-supplied storage
+ * @buf     ring storage  must be 8-byte aligned
+ * @size    size of storage  must be power of 2
+ * @return  0 if success  EINVAL if bad argument
+ */
+int ringbuf_init(struct ringbuf *rb, void *buf, uint32_t size)
+{
+    if (rb == NULL || buf == NULL) return EINVAL;
+    if (size < RINGBUF_HDRSZ * 2 || (size & (size - 1)) != 0) return EINVAL;
+    if (((uintptr_t) buf & (RINGBUF_ALIGN - 1)) != 0) return EINVAL;
+
+    (void) memset(buf, 0, size);
+    rb->data = (uint8_t *) buf;
+    rb->size = size;
+    rb->mask = size - 1;
+    rb->head = 0;
+    rb->tail = 0;
+    return 0;
+}
+
+/**
+ * Reserve space for a record of given length
+ * @len     payload length
+ * @return  pointer to payload  NULL if the ring is full
+ *          reserved record must be committed via ringbuf_commit() later
+ *
+ * If the record cannot fit in the rest of the ring  a padding record
+ *  will be emitted to fill the gap and the record wraps to ring start
+ */
+void *ringbuf_reserve(struct ringbuf *rb, uint32_t len)
+{
+    uint64_t total = RB_ROUNDUP(RINGBUF_HDRSZ + (uint64_t) len);
+    uint64_t h, t, off, pad, next;
+
+    if (total > rb->size) return NULL;
+
+    h = rb_load(&rb->head, __ATOMIC_RELAXED);
+    do {
+        t = rb_load(&rb->tail, __ATOMIC_ACQUIRE);
+        off = h & rb->mask;
+        pad = rb->size - off < total ? rb->size - off : 0;
+        next = h + pad + total;
+        if (next - t > rb->size) return NULL;
+    } while (!rb_cas(&rb->head, &h, next));
+
+    if (pad != 0) {
+        /* Padding length includes its own header */
+        rb_store(rb_hdr(rb, h), RB_F_COMMIT | RB_F_PAD | pad, __ATOMIC_RELEASE);
+        h += pad;
+    }
+
+    /* Record length visible yet uncommitted */
+    rb_store(rb_hdr(rb, h), (uint64_t) len, __ATOMIC_RELAXED);
+    return (void *) (rb_hdr(rb, h) + 1);
+}
+
+/**
+ * Publish a reserved record to consumer
+ * @p       payload pointer returned by ringbuf_reserve()
+ */
+void ringbuf_commit(struct ringbuf *rb, void *p)
+{
+    volatile uint64_t *hdr = (volatile uint64_t *) p - 1;
+    (void) rb;
+    rb_store(hdr, *hdr | RB_F_COMMIT, __ATOMIC_RELEASE);
+}
+
+/**
+ * Publish a reserved record with its final length
+ * @p       payload pointer returned by ringbuf_reserve()
+ * @len     final payload length  must not exceed the reserved one
+ *
+ * Space beyond the final length is handed back as a padding record
+ *  so a producer may reserve for the worst case and fill in place
+ */
+void ringbuf_commit_len(struct ringbuf *rb, void *p, uint32_t len)
+{
+    volatile uint64_t *hdr = (volatile uint64_t *) p - 1;
+    uint64_t rlen = *hdr & RB_LEN_MASK;
+    uint64_t reserved, total;
+
+    (void) rb;
+
+    if (len > rlen) len = (uint32_t) rlen;
+    reserved = RB_ROUNDUP(RINGBUF_HDRSZ + rlen);
+    total = RB_ROUNDUP(RINGBUF_HDRSZ + (uint64_t) len);
+
+    if (total < reserved) {
+        /* A record never wraps  so does the padding inside it */
+        rb_store((volatile uint64_t *) ((uint8_t *) hdr + total),
+                    RB_F_COMMIT | RB_F_PAD | (reserved - total), __ATOMIC_RELAXED);
+    }
+
+    rb_store(hdr, RB_F_COMMIT | len, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the oldest committed record without removing it
+ * @lenp    (OUT) payload length
+ * @return  pointer to payload  NULL if no committed record available
+ *
+ * Records behind an uncommitted one won't be visible until it's committed
+ */
+void *ringbuf_peek(struct ringbuf *rb, uint32_t *lenp)
+{
+    uint64_t t, w, len;
+    volatile uint64_t *hdr;
+
+    while (1) {
+        t = rb->tail;
+        if (t == rb_load(&rb->head, __ATOMIC_ACQUIRE)) return NULL;
+
+        hdr = rb_hdr(rb, t);
+        w = rb_load(hdr, __ATOMIC_ACQUIRE);
+        if (!(w & RB_F_COMMIT)) return NULL;
+
+        len = w & RB_LEN_MASK;
+        if (w & RB_F_PAD) {
+            (void) memset((void *) hdr, 0, len);
+            rb_store(&rb->tail, t + len, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        if (lenp != NULL) *lenp = (uint32_t) len;
+        return (void *) (hdr + 1);
+    }
+}
+
+/**
+ * Remove the record returned by last ringbuf_peek()
+ */
+void ringbuf_consume(struct ringbuf *rb)
+{
+    uint64_t t = rb->tail;
+    volatile uint64_t *hdr = rb_hdr(rb, t);
+    uint64_t total = RB_ROUNDUP(RINGBUF_HDRSZ + (*hdr & RB_LEN_MASK));
+
+    (void) memset((void *) hdr, 0, total);
+    rb_store(&rb->tail, t + total, __ATOMIC_RELEASE);
+}
+
+/**
+ * @return  bytes currently reserved in the ring(a snapshot)
+ */
+uint32_t ringbuf_used(const struct ringbuf *rb)
+{
+    uint64_t t = rb_load(&rb->tail, __ATOMIC_ACQUIRE);
+    uint64_t h = rb_load(&rb->head, __ATOMIC_ACQUIRE);
+    return (uint32_t) (h - t);
+}
+
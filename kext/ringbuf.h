@@ -0,0 +1,46 @@
+/*
+ * Created 200104
+ *
+ * Lock-free multi-producer single-consumer ring buffer of variable-length records
+ *
+ * This file has no kernel dependency  it can be built in user space as-is
+ */
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdint.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE         64
+#endif
+
+/* Every record(and its header) is 8-byte aligned in the ring */
+#define RINGBUF_ALIGN           8
+#define RINGBUF_HDRSZ           sizeof(uint64_t)
+
+struct ringbuf {
+    uint8_t *data;
+    uint32_t size;          /* Ring capacity  must be power of 2 */
+    uint32_t mask;
+
+    /* Producers reserve space by advancing head */
+    volatile uint64_t head __attribute__ ((aligned (CACHE_LINE_SIZE)));
+    /* Consumer release space by advancing tail */
+    volatile uint64_t tail __attribute__ ((aligned (CACHE_LINE_SIZE)));
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+int ringbuf_init(struct ringbuf *, void *, uint32_t);
+
+/* Producer side  safe to call concurrently */
+void *ringbuf_reserve(struct ringbuf *, uint32_t);
+void ringbuf_commit(struct ringbuf *, void *);
+void ringbuf_commit_len(struct ringbuf *, void *, uint32_t);
+
+/* Consumer side  must be serialized by caller */
+void *ringbuf_peek(struct ringbuf *, uint32_t *);
+void ringbuf_consume(struct ringbuf *);
+uint32_t ringbuf_used(const struct ringbuf *);
+
+#endif /* RINGBUF_H */
+
@@ -0,0 +1,143 @@
+/*
+ * Created 200115
+ *
+ * Contention benchmark of statistics counters
+ *
+ * Mirrors how log_printf() bumps struct kextlog_statistics(log_sysctl.h)
+ *  every call adds to a few counters of a block of uint64_t fields
+ *  measured layouts:
+ *  global      one block shared by all threads(kext before)
+ *  sharded     a cache line aligned block per thread(per CPU in kext)
+ *               atomic adds are kept  since kext threads may migrate
+ *
+ * Sums are checked against the expected totals  cost of summing all shards
+ *  for a sysctl read is reported as well
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE     64
+#endif
+
+#define MAX_THREAD          16
+#define NCPU_MAX            64
+#define CALLS               2000000u
+#define NLEVEL              5
+
+/* Same shape and size class as struct kextlog_statistics */
+struct stats {
+    volatile uint64_t stackmsg;
+    volatile uint64_t ringmsg;
+    volatile uint64_t bytes_enqueued;
+    volatile uint64_t messages[NLEVEL];
+    volatile uint64_t filtered[NLEVEL];
+    volatile uint64_t dropped[NLEVEL];
+    volatile uint64_t _other[28];
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+#define NFIELD      (sizeof(struct stats) / sizeof(uint64_t))
+
+static struct stats shards[NCPU_MAX];
+static volatile int go;
+
+#define stat_add(s, f, n)   (void) __atomic_add_fetch(&(s)->f, (n), __ATOMIC_RELAXED)
+
+struct worker {
+    pthread_t thread;
+    struct stats *s;
+};
+
+static void *work(void *arg)
+{
+    struct stats *s = ((struct worker *) arg)->s;
+    uint32_t i;
+
+    while (!go) sched_yield();
+
+    /* A log_printf() which passed the level check and got enqueued */
+    for (i = 0; i < CALLS; i++) {
+        stat_add(s, ringmsg, 1);
+        stat_add(s, bytes_enqueued, 100);
+        stat_add(s, messages[i % NLEVEL], 1);
+    }
+
+    return NULL;
+}
+
+static uint64_t stat_sum(size_t off)
+{
+    uint64_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < NCPU_MAX; i++) {
+        sum += *(volatile uint64_t *) ((uint8_t *) &shards[i] + off);
+    }
+    return sum;
+}
+
+/**
+ * @return  million log calls per second
+ */
+static double run(uint32_t nthread, int sharded)
+{
+    struct worker w[MAX_THREAD];
+    uint64_t t0, n = (uint64_t) nthread * CALLS, msgs = 0;
+    uint32_t i;
+
+    (void) memset(shards, 0, sizeof(shards));
+
+    go = 0;
+    for (i = 0; i < nthread; i++) {
+        w[i].s = &shards[sharded ? i : 0];
+        CHECK(pthread_create(&w[i].thread, NULL, work, &w[i]) == 0);
+    }
+
+    t0 = now_ns();
+    go = 1;
+    for (i = 0; i < nthread; i++) (void) pthread_join(w[i].thread, NULL);
+    t0 = now_ns() - t0;
+
+    CHECK(stat_sum(__builtin_offsetof(struct stats, ringmsg)) == n);
+    CHECK(stat_sum(__builtin_offsetof(struct stats, bytes_enqueued)) == n * 100);
+    for (i = 0; i < NLEVEL; i++) {
+        msgs += stat_sum(__builtin_offsetof(struct stats, messages) + i * sizeof(uint64_t));
+    }
+    CHECK(msgs == n);
+
+    return mops(n, t0);
+}
+
+int main(void)
+{
+    static struct stats snap;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t max = ncpu < 4 ? 4 : (ncpu > MAX_THREAD ? MAX_THREAD : (uint32_t) ncpu);
+    uint32_t n, i;
+    uint64_t t0;
+
+    printf("%ld CPUs  %u calls per thread  %zu bytes per shard\n", ncpu, CALLS, sizeof(struct stats));
+    printf("%7s %14s %14s\n", "threads", "global Mops/s", "sharded Mops/s");
+    for (n = 1; n <= max; n *= 2) {
+        printf("%7u %14.2f %14.2f\n", n, run(n, 0), run(n, 1));
+    }
+
+    /* A full snapshot as kextlog.statistics returns */
+    t0 = now_ns();
+    for (n = 0; n < 10000; n++) {
+        for (i = 0; i < NFIELD; i++) {
+            ((volatile uint64_t *) &snap)[i] = stat_sum(i * sizeof(uint64_t));
+        }
+    }
+    printf("snapshot of %zu counters over %d shards  %.1f us\n",
+            NFIELD, NCPU_MAX, (double) (now_ns() - t0) / 10000 / 1000);
+
+    return 0;
+}
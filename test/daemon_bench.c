@@ -0,0 +1,317 @@
+/*
+ * Created 200115
+ *
+ * Sustained message rate of kextlog_daemon receive pipeline  fed over a
+ *  socketpair(kctl analog) by a thread sends batches as kext consumer does
+ *
+ * The daemon is built in as is  its receive_loop() drains the socket on
+ *  epoll wakeups  decode  render and write stages run on their own threads
+ * Each case runs in a child process  since daemon states are all static
+ *  every record must arrive in order  or the case fails
+ *
+ * Receive cases count records only(-q)  pipeline cases render every record
+ *  to /dev/null with stages pinned to 1  2 or 4 CPUs(-c)  so scaling of
+ *  the whole pipeline shows up where there are CPUs to scale on
+ * Persist cases count records only  and write them to segments in a temporary
+ *  directory(-s  $TMPDIR or /tmp) under each durability mode(-d)
+ *  numbers depend on the file system the directory lives on
+ */
+
+#define main daemon_main
+#include "../daemon/kextlog_daemon.c"
+#undef main
+
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "test.h"
+
+#define MESSAGES        300000u
+#define RECV_SIZE       65536
+#define BATCH_MAX       6144        /* KEXTLOG_BATCH_MAX */
+#define WARN_EVERY      1000        /* One WARNING record per so many  urgent to group commit */
+
+struct bench_case {
+    const char *name;
+    int stream;
+    uint32_t wire;
+    uint32_t compress;
+    uint32_t batch;                 /* Records per batch at most */
+    int render;                     /* Nonzero to render records */
+    int cpus;                       /* Stage i pinned to CPU i % cpus  zero if not pinned */
+};
+
+static const struct bench_case cases[] = {
+    {"DGRAM V1 unbatched", 0, KEXTLOG_WIRE_V1, 0, 1, 0, 0},
+    {"DGRAM V1", 0, KEXTLOG_WIRE_V1, 0, 64, 0, 0},
+    {"STREAM V1", 1, KEXTLOG_WIRE_V1, 0, 64, 0, 0},
+    {"DGRAM V2", 0, KEXTLOG_WIRE_V2, 0, 64, 0, 0},
+    {"DGRAM V3", 0, KEXTLOG_WIRE_V3, 0, 64, 0, 0},
+    {"DGRAM V1 lz", 0, KEXTLOG_WIRE_V1, 1, 64, 0, 0},
+    {"STREAM V3 lz", 1, KEXTLOG_WIRE_V3, 1, 64, 0, 0},
+};
+
+static const struct bench_case pipeline_cases[] = {
+    {"unpinned", 0, KEXTLOG_WIRE_V1, 0, 64, 1, 0},
+    {"1 CPU", 0, KEXTLOG_WIRE_V1, 0, 64, 1, 1},
+    {"2 CPUs", 0, KEXTLOG_WIRE_V1, 0, 64, 1, 2},
+    {"4 CPUs", 0, KEXTLOG_WIRE_V1, 0, 64, 1, 4},
+};
+
+static const struct bench_case persist_case = {"persist", 0, KEXTLOG_WIRE_V1, 0, 64, 0, 0};
+
+struct persist_case {
+    const char *name;
+    uint32_t sync;                  /* SEG_SYNC_* */
+    uint32_t sync_ms;               /* Period  SEG_SYNC_PERIODIC only */
+};
+
+static const struct persist_case persist_cases[] = {
+    {"none", SEG_SYNC_NONE, 0},
+    {"periodic 100 ms", SEG_SYNC_PERIODIC, 100},
+    {"periodic 10 ms", SEG_SYNC_PERIODIC, 10},
+    {"group", SEG_SYNC_GROUP, 0},
+};
+
+struct feeder {
+    const struct bench_case *c;
+    int fd;
+};
+
+/**
+ * Make record i in V1 layout
+ * @return      record size
+ */
+static size_t record_make(char *rec, uint32_t i)
+{
+    static const char *comms[] = {"mds_stores", "Safari", "fseventsd", "mdworker_shared"};
+    struct kextlog_msghdr *m = (struct kextlog_msghdr *) rec;
+    uint32_t t = i % 4;
+    int n;
+
+    (void) memset(m, 0, sizeof(*m));
+    m->pid = 400 + (int32_t) t;
+    m->tid = 0x2f1a30 + t;
+    m->scope = KEXTLOG_SCOPE_VNODE;
+    m->level = i % WARN_EVERY == WARN_EVERY - 1 ? KEXTLOG_LEVEL_WARNING : KEXTLOG_LEVEL_INFO;
+    m->timestamp = 123456789012ull + (uint64_t) i * 1500;
+    m->seq = i;
+    m->_padding = _KEXTLOG_PADDING_MAGIC;
+    n = sprintf(m->buffer, "vnode  act: %#x(%s) vp: %p %d %s %s/%x uid: %u pid: %d %s",
+                0x2u, "READ_DATA", (void *) (uintptr_t) (0xffffff8012340000 + (i & 0xfff0)), 1, "VREG",
+                "/Users/someone/Library/Caches/com.apple.Safari/fsCachedData", i & 0xffff, 501u, m->pid, comms[t]);
+    m->size = (uint32_t) n + 1;
+
+    return sizeof(*m) + m->size;
+}
+
+static void feed_send(const struct feeder *f, const char *p, size_t len)
+{
+    ssize_t n;
+
+    if (!f->c->stream) {
+        CHECK(send(f->fd, p, len, 0) == (ssize_t) len);
+        return;
+    }
+
+    while (len != 0) {
+        n = send(f->fd, p, len, 0);
+        CHECK(n > 0);
+        p += n;
+        len -= (size_t) n;
+    }
+}
+
+/**
+ * Send a batch as kext consumer does  see: log_consumer_send()
+ */
+static void feed_batch(const struct feeder *f, const char *data, uint32_t len, uint32_t cnt)
+{
+    static struct lzpack_ctx ctx;
+    static char frame[sizeof(struct kextlog_frame) + LZPACK_BOUND(BATCH_MAX)];
+    struct kextlog_frame *fr = (struct kextlog_frame *) frame;
+    size_t k = 0;
+
+    if (!f->c->compress && !f->c->stream) {
+        feed_send(f, data, len);
+        return;
+    }
+
+    fr->magic = KEXTLOG_FRAME_MAGIC;
+    fr->cnt = cnt;
+    if (f->c->compress) k = lzpack_compress(&ctx, data, len, frame + sizeof(*fr), len - 1);
+    if (k != 0) {
+        fr->len = (uint32_t) k;
+        fr->raw_len = len;
+    } else {
+        (void) memcpy(frame + sizeof(*fr), data, len);
+        fr->len = len;
+        fr->raw_len = 0;
+    }
+    feed_send(f, frame, sizeof(*fr) + fr->len);
+}
+
+static void *feed(void *arg)
+{
+    const struct feeder *f = (const struct feeder *) arg;
+    static char rec[sizeof(struct kextlog_msghdr) + 256];
+    static char batch[BATCH_MAX];
+    struct hdrpack_dict *d = f->c->wire == KEXTLOG_WIRE_V3 ? calloc(1, sizeof(*d)) : NULL;
+    struct hdrpack_state st;
+    uint32_t i, len = 0, cnt = 0;
+    size_t n;
+
+    hdrpack_reset(&st);
+    for (i = 0; i < MESSAGES; i++) {
+        n = record_make(rec, i);
+        if (cnt == f->c->batch || len + n > BATCH_MAX) {
+            feed_batch(f, batch, len, cnt);
+            hdrpack_reset(&st);
+            len = 0;
+            cnt = 0;
+        }
+
+        if (f->c->wire == KEXTLOG_WIRE_V1) {
+            (void) memcpy(batch + len, rec, n);
+        } else {
+            n = hdrpack_encode(&st, d, (const struct kextlog_msghdr *) rec, batch + len);
+        }
+        len += (uint32_t) n;
+        cnt++;
+    }
+    if (cnt != 0) feed_batch(f, batch, len, cnt);
+
+    /* Zero-length datagram or EOF ends receive_loop() */
+    if (f->c->stream) (void) shutdown(f->fd, SHUT_WR);
+    else CHECK(send(f->fd, "", 0, 0) == 0);
+
+    free(d);
+    return NULL;
+}
+
+/**
+ * Remove a segment directory along with segments in it
+ */
+static void seg_dir_remove(const char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *e;
+    DIR *d;
+
+    d = opendir(dir);
+    CHECK(d != NULL);
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') continue;
+        (void) snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        CHECK(unlink(path) == 0);
+    }
+    (void) closedir(d);
+    CHECK(rmdir(dir) == 0);
+}
+
+/**
+ * Run a case in a child process  prints a row of results
+ * @p           durability mode to persist records with  NULL if not persisting
+ */
+static void run(const struct bench_case *c, const struct persist_case *p)
+{
+    char dir[PATH_MAX];
+    const char *tmp;
+    struct feeder f;
+    pthread_t feeder;
+    int size = RECV_SIZE;
+    int fd[2];
+    uint64_t t0;
+    uint64_t got = 0;
+    pid_t pid;
+    int status;
+    int i;
+
+    (void) fflush(stdout);
+    pid = fork();
+    CHECK(pid >= 0);
+    if (pid != 0) {
+        CHECK(waitpid(pid, &status, 0) == pid);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        return;
+    }
+
+    CHECK(socketpair(AF_UNIX, c->stream ? SOCK_STREAM : SOCK_DGRAM, 0, fd) == 0);
+    CHECK(setsockopt(fd[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == 0);
+    CHECK(setsockopt(fd[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == 0);
+
+    /* As if kextlog.kctl.recvsize were RECV_SIZE  and options negotiated */
+    buffer_size = RECV_SIZE + RECV_SIZE / 4;
+    buffer = malloc(buffer_size);
+    unlz = malloc(buffer_size);
+    CHECK(buffer != NULL && unlz != NULL);
+    wire = c->wire;
+    compress = c->compress;
+    quiet = !c->render;
+    for (i = 0; i < STAGE_NR; i++) stage_cpu[i] = c->cpus != 0 ? i % c->cpus : -1;
+    if (p != NULL) {
+        tmp = getenv("TMPDIR");
+        (void) snprintf(dir, sizeof(dir), "%s/daemon_bench.XXXXXX", tmp != NULL && *tmp != '\0' ? tmp : "/tmp");
+        CHECK(mkdtemp(dir) != NULL);
+        seg_dir = dir;
+        seg_sync = p->sync;
+        seg_sync_ms = p->sync_ms;
+    }
+    CHECK(pipeline_init() == 0);
+
+    /* Pipeline statistics go to stderr */
+    CHECK(freopen("/dev/null", "w", stderr) != NULL);
+
+    f.c = c;
+    f.fd = fd[0];
+    t0 = now_ns();
+    CHECK(pthread_create(&feeder, NULL, feed, &f) == 0);
+    receive_loop(fd[1], c->stream);
+    t0 = now_ns() - t0;
+    (void) pthread_join(feeder, NULL);
+
+    for (i = 0; i < KEXTLOG_NLEVEL; i++) got += received[i];
+    if (got != MESSAGES || seq_gaps != 0 || (p != NULL && (segw.records != MESSAGES || seg_errors != 0))) {
+        printf("%-20s received: %llu seq gaps: %llu persisted: %llu\n", c->name,
+                (unsigned long long) got, (unsigned long long) seq_gaps, (unsigned long long) segw.records);
+        exit(1);
+    }
+
+    if (p != NULL) {
+        seg_dir_remove(dir);
+        printf("%-20s %8.2f %8.1f %8llu %10.1f %8llu\n", p->name, mops(MESSAGES, t0),
+                (double) segw.bytes * 1e9 / 1048576.0 / (double) t0, (unsigned long long) segw.syncs,
+                segw.syncs ? (double) segw.sync_records / (double) segw.syncs : 0.0,
+                (unsigned long long) hist_quantile(&segw.sync_lat, 99, 100) / 1000);
+    } else if (!c->render) {
+        printf("%-20s %8.2f %8.1f %10.1f\n", c->name, mops(MESSAGES, t0),
+                (double) rx_reads / (double) rx_wakeups, (double) MESSAGES / (double) rx_reads);
+    } else {
+        /* Depth and stalls tell which stage holds the pipeline back */
+        printf("%-20s %8.2f %5llu/%-5llu %5llu/%-5llu %5llu/%-5llu\n", c->name, mops(MESSAGES, t0),
+                (unsigned long long) ch_rx.depth_max, (unsigned long long) ch_rx.stalls,
+                (unsigned long long) ch_dec.depth_max, (unsigned long long) ch_dec.stalls,
+                (unsigned long long) ch_out.depth_max, (unsigned long long) ch_out.stalls);
+    }
+    exit(0);
+}
+
+int main(void)
+{
+    uint32_t i;
+
+    printf("%ld CPUs  %u messages  %d bytes receive buffer\n",
+            sysconf(_SC_NPROCESSORS_ONLN), MESSAGES, RECV_SIZE);
+    printf("%-20s %8s %8s %10s\n", "case", "Mmsg/s", "rd/wake", "msgs/read");
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) run(&cases[i], NULL);
+
+    printf("\nrendered to /dev/null  depth max/stalls of channels\n");
+    printf("%-20s %8s %11s %11s %11s\n", "stages", "Mmsg/s", "receive", "decode", "render");
+    for (i = 0; i < sizeof(pipeline_cases) / sizeof(pipeline_cases[0]); i++) run(&pipeline_cases[i], NULL);
+
+    printf("\npersisted to segments  sustained disk throughput\n");
+    printf("%-20s %8s %8s %8s %10s %8s\n", "durability", "Mmsg/s", "MiB/s", "syncs", "recs/sync", "p99 us");
+    for (i = 0; i < sizeof(persist_cases) / sizeof(persist_cases[0]); i++) run(&persist_case, &persist_cases[i]);
+
+    return 0;
+}
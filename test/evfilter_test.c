@@ -0,0 +1,194 @@
+/*
+ * Created 200115
+ *
+ * Test of KAuth event filter  and cost per event of evfilter_match()
+ *  compared with formatting the event as kauth callbacks do otherwise
+ *
+ * Events rejected by a filter should cost a small fraction of a vsnprintf()
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdarg.h>
+
+#include "test.h"
+#include "../kext/evfilter.h"
+
+#define BENCH_CALLS     2000000u
+
+static void test_match(void)
+{
+    struct evfilter f;
+    struct evfilter_event ev = {3, 0x4, 100, 501, "/Users/someone/a", NULL};
+
+    /* Empty filter passes anything */
+    (void) memset(&f, 0, sizeof(f));
+    CHECK(evfilter_prepare(&f) == 0);
+    CHECK(evfilter_match(&f, &ev));
+
+    /* Include set of pids  sorted by prepare */
+    f.npid = 3;
+    f.pids[0] = 300;
+    f.pids[1] = 100;
+    f.pids[2] = 7;
+    CHECK(evfilter_prepare(&f) == 0);
+    CHECK(f.pids[0] == 7 && f.pids[1] == 100 && f.pids[2] == 300);
+    CHECK(evfilter_match(&f, &ev));
+    ev.pid = 5;
+    CHECK(!evfilter_match(&f, &ev));
+
+    /* Exclude set of pids */
+    f.flags = EVFILTER_F_PID_EXCLUDE;
+    CHECK(evfilter_match(&f, &ev));
+    ev.pid = 300;
+    CHECK(!evfilter_match(&f, &ev));
+    ev.pid = 1;
+
+    /* Any path matches any prefix */
+    f.npath = 1;
+    (void) strcpy(f.paths[0], "/Users/");
+    CHECK(evfilter_match(&f, &ev));
+    ev.path = "/tmp/x";
+    CHECK(!evfilter_match(&f, &ev));
+    ev.path2 = "/Users/other";
+    CHECK(evfilter_match(&f, &ev));
+
+    /* Prefixes skipped if event has no path */
+    ev.path = ev.path2 = NULL;
+    CHECK(evfilter_match(&f, &ev));
+
+    /* Action mask of event's scope */
+    f.action_mask[3] = 0x2;
+    CHECK(!evfilter_match(&f, &ev));
+    f.action_mask[3] = 0x6;
+    CHECK(evfilter_match(&f, &ev));
+    f.action_mask[3] = 0;
+
+    /* Include and exclude set of uids */
+    f.nuid = 1;
+    f.uids[0] = 0;
+    CHECK(!evfilter_match(&f, &ev));
+    f.flags |= EVFILTER_F_UID_EXCLUDE;
+    CHECK(evfilter_match(&f, &ev));
+}
+
+static void test_malformed(void)
+{
+    struct evfilter f;
+
+    (void) memset(&f, 0, sizeof(f));
+    f.npid = EVFILTER_NPID + 1;
+    CHECK(evfilter_prepare(&f) != 0);
+
+    (void) memset(&f, 0, sizeof(f));
+    f.nuid = EVFILTER_NUID + 1;
+    CHECK(evfilter_prepare(&f) != 0);
+
+    (void) memset(&f, 0, sizeof(f));
+    f.flags = 0x80;
+    CHECK(evfilter_prepare(&f) != 0);
+
+    /* Prefix without trailing `\0' */
+    (void) memset(&f, 0, sizeof(f));
+    f.npath = 1;
+    (void) memset(f.paths[0], 'a', EVFILTER_PATH_MAX);
+    CHECK(evfilter_prepare(&f) != 0);
+}
+
+static int bench_vsnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+#define BENCH_PATH  "/Users/someone/Library/Caches/com.apple.Safari/fsCachedData/0a1b2c3d"
+
+/**
+ * @return      nanoseconds per evfilter_match()
+ */
+static double bench_match(const struct evfilter *f, int want)
+{
+    struct evfilter_event ev = {3, 0x4, 0, 501, BENCH_PATH, NULL};
+    volatile uint32_t sink = 0;
+    uint64_t t0;
+    uint32_t i;
+
+    t0 = now_ns();
+    for (i = 0; i < BENCH_CALLS; i++) {
+        /* Varies pid so the search isn't folded */
+        ev.pid = (int32_t) (i & 0xfff);
+        sink += (uint32_t) evfilter_match(f, &ev);
+    }
+    t0 = now_ns() - t0;
+
+    if (want >= 0) CHECK(sink == (want ? BENCH_CALLS : 0));
+    return (double) t0 / BENCH_CALLS;
+}
+
+static void bench(void)
+{
+    static char out[512];
+    volatile size_t sink = 0;
+    struct evfilter f;
+    uint64_t t0;
+    uint32_t i;
+
+    t0 = now_ns();
+    for (i = 0; i < BENCH_CALLS; i++) {
+        sink += (size_t) bench_vsnprintf(out, sizeof(out),
+                    "vnode  act: %#x(%s) vp: %p %d %s %s dvp: %p uid: %u pid: %d %s",
+                    0x12u, "READ_DATA", (void *) 0xffffff8012345678, 1, "VREG",
+                    BENCH_PATH, (void *) NULL, 501u, (int) (i & 0xfff), "Safari");
+    }
+    (void) sink;
+    printf("%u events\n", BENCH_CALLS);
+    printf("%-28s %8.1f ns/event\n", "vsnprintf(unfiltered)", (double) (now_ns() - t0) / BENCH_CALLS);
+
+    (void) memset(&f, 0, sizeof(f));
+    CHECK(evfilter_prepare(&f) == 0);
+    printf("%-28s %8.1f ns/event\n", "empty filter", bench_match(&f, 1));
+
+    /* Rejected early by action mask */
+    f.action_mask[3] = 0x2;
+    printf("%-28s %8.1f ns/event\n", "action mask reject", bench_match(&f, 0));
+    f.action_mask[3] = 0;
+
+    /* Full pid include set  none of them hit */
+    f.npid = EVFILTER_NPID;
+    for (i = 0; i < EVFILTER_NPID; i++) f.pids[i] = (int32_t) (0x10000 + i * 7);
+    CHECK(evfilter_prepare(&f) == 0);
+    printf("%-28s %8.1f ns/event\n", "16 pids reject", bench_match(&f, 0));
+
+    /* Full pid exclude set and uid include set  all pass */
+    f.flags = EVFILTER_F_PID_EXCLUDE;
+    f.nuid = EVFILTER_NUID;
+    for (i = 0; i < EVFILTER_NUID; i++) f.uids[i] = 495 + i;
+    CHECK(evfilter_prepare(&f) == 0);
+    printf("%-28s %8.1f ns/event\n", "16 pids + 8 uids pass", bench_match(&f, 1));
+
+    /* Path prefixes  last one hits */
+    (void) memset(&f, 0, sizeof(f));
+    f.npath = EVFILTER_NPATH;
+    (void) strcpy(f.paths[0], "/private/var/");
+    (void) strcpy(f.paths[1], "/Applications/");
+    (void) strcpy(f.paths[2], "/Users/someone/Documents/");
+    (void) strcpy(f.paths[3], "/Users/someone/Library/");
+    CHECK(evfilter_prepare(&f) == 0);
+    printf("%-28s %8.1f ns/event\n", "4 path prefixes pass", bench_match(&f, 1));
+    f.npath = 3;
+    printf("%-28s %8.1f ns/event\n", "3 path prefixes reject", bench_match(&f, 0));
+}
+
+int main(void)
+{
+    test_match();
+    test_malformed();
+    bench();
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Created 200115
+ *
+ * Round-trip test of fmtpack  and per-call cost of deferred formatting
+ *  compared with vsnprintf() as done in kext before
+ *
+ * Every case is packed by fmtpack_encode() and rendered by fmtpack_render()
+ *  output must be identical to vsnprintf() of the same arguments
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdarg.h>
+
+#include "test.h"
+#include "../kext/fmtpack.h"
+
+#define BENCH_CALLS     1000000u
+
+static char args[1024];
+
+static void roundtrip(const char *fmt, ...)
+{
+    char want[512], got[512];
+    va_list ap, ap2;
+    size_t n;
+    int len;
+
+    va_start(ap, fmt);
+    va_copy(ap2, ap);
+    n = fmtpack_encode(args, sizeof(args), fmt, ap);
+    (void) vsnprintf(want, sizeof(want), fmt, ap2);
+    va_end(ap2);
+    va_end(ap);
+
+    CHECK(n <= sizeof(args));
+    len = fmtpack_render(got, sizeof(got), fmt, args, n);
+    if (strcmp(want, got) != 0) {
+        fprintf(stderr, "fmt: %s\nwant: %s\ngot:  %s\n", fmt, want, got);
+    }
+    CHECK(strcmp(want, got) == 0);
+    CHECK(len == (int) strlen(want));
+}
+
+static size_t encode(void *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    size_t n;
+
+    va_start(ap, fmt);
+    n = fmtpack_encode(buf, size, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+static void test_roundtrip(void)
+{
+    roundtrip("plain text");
+    roundtrip("%d %i %u %x %X %o %c %%", -1, 42, 7u, 0xbeefu, 0xcafeu, 8u, 'z');
+    roundtrip("%hhd %hd %ld %lld %zu %jd %td", 300, 70000, -5L, -9LL,
+                (size_t) 99, (long long) 1 << 40, (long) -3);
+    roundtrip("%#x %08x %-6d| %+d %5.2s %.*s %*d", 0x12u, 0xabu, 3, 4, "abcdef", 3, "xyzw", 6, 42);
+    roundtrip("%s %s %s", "", (char *) NULL, "/private/var/folders/x y/z");
+    roundtrip("%p %p", (void *) 0x1234, (void *) NULL);
+    roundtrip("%f %e %g", 1.5, 2e10, 0.25);
+    roundtrip("vnode  act: %#x(%s) vp: %p %d %s %s dvp: %p uid: %u pid: %d %s",
+                0x12u, "READ|WRITE", (void *) 0x1234, 1, "VREG", "/tmp/a b",
+                (void *) NULL, 501u, 33, "bash");
+}
+
+static void test_edge(void)
+{
+    char small[10];
+    size_t n;
+    int len;
+
+    /* Output truncated like snprintf() */
+    n = encode(args, sizeof(args), "hello %s world", "abc");
+    len = fmtpack_render(small, sizeof(small), "hello %s world", args, n);
+    CHECK(len == (int) strlen("hello abc world"));
+    CHECK(strcmp(small, "hello abc") == 0);
+
+    /* Size required returned if buffer too small */
+    n = encode(args, 4, "%s", "abcdefgh");
+    CHECK(n > 4);
+    CHECK(encode(args, sizeof(args), "%s", "abcdefgh") == n);
+
+    /* Arguments shorter than format claims */
+    n = encode(args, sizeof(args), "%d %s", 1, "abcdefgh");
+    CHECK(fmtpack_render(small, sizeof(small), "%d %s", args, n - 4) < 0);
+    CHECK(fmtpack_render(small, sizeof(small), "%d %s %d", args, n) < 0);
+}
+
+static int bench_vsnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+#define BENCH_FMT   "vnode  act: %#x(%s) vp: %p %d %s %s dvp: %p uid: %u pid: %d %s"
+#define BENCH_ARGS  0x12u, "READ_DATA|WRITE_DATA", (void *) 0xffffff8012345678, 1, "VREG",  \
+                    "/Users/someone/Library/Caches/com.apple.Safari/fsCachedData/0a1b2c3d", \
+                    (void *) 0xffffff8087654321, 501u, 3321, "Safari"
+
+static void bench(void)
+{
+    static char out[512];
+    volatile size_t sink = 0;
+    uint64_t t0, t_text, t_enc, t_render;
+    size_t n = 0;
+    uint32_t i;
+
+    t0 = now_ns();
+    for (i = 0; i < BENCH_CALLS; i++) sink += (size_t) bench_vsnprintf(out, sizeof(out), BENCH_FMT, BENCH_ARGS);
+    t_text = now_ns() - t0;
+
+    t0 = now_ns();
+    for (i = 0; i < BENCH_CALLS; i++) sink += (n = encode(args, sizeof(args), BENCH_FMT, BENCH_ARGS));
+    t_enc = now_ns() - t0;
+
+    t0 = now_ns();
+    for (i = 0; i < BENCH_CALLS; i++) sink += (size_t) fmtpack_render(out, sizeof(out), BENCH_FMT, args, n);
+    t_render = now_ns() - t0;
+
+    (void) sink;
+    printf("%u calls  %zu bytes text  %zu bytes packed\n", BENCH_CALLS, strlen(out), n);
+    printf("%-24s %8.1f ns/call\n", "vsnprintf(kext before)", (double) t_text / BENCH_CALLS);
+    printf("%-24s %8.1f ns/call\n", "fmtpack_encode(kext)", (double) t_enc / BENCH_CALLS);
+    printf("%-24s %8.1f ns/call\n", "fmtpack_render(daemon)", (double) t_render / BENCH_CALLS);
+}
+
+int main(void)
+{
+    test_roundtrip();
+    test_edge();
+    bench();
+    return 0;
+}
@@ -0,0 +1,320 @@
+/*
+ * Created 200115
+ *
+ * Round-trip test of compact record headers(wire format V2 and V3)  and bytes
+ *  per message compared with struct kextlog_msghdr(V1) on a synthetic kauth trace
+ *
+ * The trace mimics a vnode storm: a few busy threads  short bodies
+ *  timestamps microseconds apart  and now and then a gap of seq(drops)
+ * Records are cut into batches of KEXTLOG_BATCH_MAX bytes as kext consumer
+ *  does  each batch starts from a zeroed delta state
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+
+#include "test.h"
+#include "../kext/hdrpack.h"
+
+#define NREC            100000u
+#define BODY_MAX        160
+#define BATCH_MAX       6144        /* KEXTLOG_BATCH_MAX */
+#define BENCH_ROUNDS    20u
+
+struct rec {
+    struct kextlog_msghdr hdr;
+    char body[BODY_MAX];
+};
+
+static struct rec trace[NREC];
+static struct hdrpack_dict enc_dict;
+static struct hdrpack_dict dec_dict;
+static uint8_t packed[NREC * (HDRPACK_MAX + BODY_MAX)];
+static size_t packed_len;
+static uint32_t nbatch;
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+    rnd_state = rnd_state * 1103515245u + 12345u;
+    return rnd_state >> 8;
+}
+
+static void trace_make(void)
+{
+    static const uint64_t tids[] = {0x2f1a33, 0x2f09c1, 0x1c4, 0x30aa02, 0x2ffe10, 0x99};
+    static const int32_t pids[] = {412, 412, 0, 1733, 98, 0};
+    static const char *comms[] = {"mds_stores", "mds_stores", "kernel_task", "Safari", "fseventsd", "kernel_task"};
+    static const char *dirs[] = {
+        "/Users/someone/Library/Caches/com.apple.Safari/fsCachedData",
+        "/private/var/folders/zz/zyxvpxvq6csfxvn_n0000000000000/T",
+        "/System/Library/Frameworks/CoreServices.framework/Versions/A",
+        "/usr/lib",
+    };
+    uint64_t ts = 123456789012ull, seq = 0;
+    struct rec *r;
+    uint32_t i, t;
+    int n;
+
+    for (i = 0; i < NREC; i++) {
+        r = &trace[i];
+        t = rnd() % 6;
+        (void) memset(&r->hdr, 0, sizeof(r->hdr));
+        r->hdr.pid = pids[t];
+        r->hdr.tid = tids[t];
+        r->hdr.scope = i % 16 == 0 ? KEXTLOG_SCOPE_FILEOP : KEXTLOG_SCOPE_VNODE;
+        r->hdr.level = i % 64 == 0 ? KEXTLOG_LEVEL_WARNING : KEXTLOG_LEVEL_INFO;
+        r->hdr.flags = i % 500 == 0 ? KEXTLOG_FLAG_MSG_DROPPED : 0;
+        ts += rnd() % 20000;
+        r->hdr.timestamp = ts;
+        seq += i % 1000 == 999 ? 1 + rnd() % 50 : 1;
+        r->hdr.seq = seq;
+        n = snprintf(r->body, sizeof(r->body), "vnode  act: %#x %s/%x uid: %u pid: %d %s",
+                    1u << (rnd() % 14), dirs[rnd() % 4], rnd() & 0xffff, 501u, pids[t], comms[t]);
+        CHECK(n > 0 && n < BODY_MAX);
+        r->hdr.size = (uint32_t) n + 1;
+    }
+}
+
+/**
+ * Pack the whole trace into batches
+ * @dict        thread dictionary  NULL for V2  lives through all batches
+ */
+static void trace_pack(struct hdrpack_dict *dict)
+{
+    static uint8_t rec[sizeof(struct kextlog_msghdr) + HDRPACK_MAX + BODY_MAX];
+    struct hdrpack_state st;
+    size_t batch = BATCH_MAX, n;
+    uint32_t i;
+
+    if (dict != NULL) hdrpack_dict_reset(dict);
+    packed_len = 0;
+    nbatch = 0;
+    for (i = 0; i < NREC; i++) {
+        /* hdrpack_encode() wants the buffer right after the header */
+        (void) memcpy(rec, &trace[i].hdr, sizeof(trace[i].hdr));
+        (void) memcpy(rec + sizeof(trace[i].hdr), trace[i].body, trace[i].hdr.size);
+
+        if (batch + HDRPACK_MAX + trace[i].hdr.size > BATCH_MAX) {
+            hdrpack_reset(&st);
+            batch = 0;
+            nbatch++;
+        }
+        n = hdrpack_encode(&st, dict, (const struct kextlog_msghdr *) rec, packed + packed_len);
+        packed_len += n;
+        batch += n;
+    }
+}
+
+/**
+ * Unpack the trace  checking every record against the original one
+ * @dict        thread dictionary  NULL for V2
+ * @verify      nonzero to compare records
+ */
+static void trace_unpack(struct hdrpack_dict *dict, int verify)
+{
+    struct hdrpack_state st;
+    struct kextlog_msghdr h;
+    const struct rec *r;
+    const char *body;
+    size_t off = 0, batch = BATCH_MAX;
+    uint32_t i;
+    int n;
+
+    if (dict != NULL) hdrpack_dict_reset(dict);
+    for (i = 0; i < NREC; i++) {
+        r = &trace[i];
+        /* Batch boundaries as encoder cut them  decoder of daemon knows them by datagram */
+        if (batch + HDRPACK_MAX + r->hdr.size > BATCH_MAX) {
+            hdrpack_reset(&st);
+            batch = 0;
+        }
+        n = hdrpack_decode(&st, dict, packed + off, packed_len - off, &h, &body);
+        CHECK(n > 0);
+        off += (size_t) n;
+        batch += (size_t) n;
+
+        if (!verify) continue;
+        CHECK(h.pid == r->hdr.pid && h.tid == r->hdr.tid);
+        CHECK(h.scope == r->hdr.scope && h.level == r->hdr.level && h.flags == r->hdr.flags);
+        CHECK(h.timestamp == r->hdr.timestamp && h.seq == r->hdr.seq);
+        CHECK(h.size == r->hdr.size && h._padding == _KEXTLOG_PADDING_MAGIC);
+        CHECK(memcmp(body, r->body, h.size) == 0);
+    }
+    CHECK(off == packed_len);
+}
+
+static void test_edge(void)
+{
+    static uint8_t rec[sizeof(struct kextlog_msghdr) + 8];
+    struct kextlog_msghdr *m = (struct kextlog_msghdr *) rec;
+    struct hdrpack_state st;
+    struct kextlog_msghdr h;
+    uint8_t out[HDRPACK_MAX + 8];
+    const char *body;
+    size_t n, k;
+
+    /* Extreme values round trip  time and tid may go backwards */
+    (void) memset(rec, 0, sizeof(rec));
+    m->pid = -1;
+    m->tid = UINT64_MAX;
+    m->timestamp = UINT64_MAX;
+    m->seq = 0;
+    m->level = KEXTLOG_LEVEL_ERROR;
+    m->flags = 0x1f;
+    m->scope = KEXTLOG_SCOPE_MAX - 1;
+    m->size = 8;
+    (void) memcpy(m->buffer, "1234567", 8);
+
+    hdrpack_reset(&st);
+    n = hdrpack_encode(&st, NULL, m, out);
+    CHECK(n <= HDRPACK_MAX + 8);
+
+    hdrpack_reset(&st);
+    CHECK(hdrpack_decode(&st, NULL, out, n, &h, &body) == (int) n);
+    CHECK(h.pid == -1 && h.tid == UINT64_MAX && h.timestamp == UINT64_MAX && h.seq == 0);
+    CHECK(h.level == KEXTLOG_LEVEL_ERROR && h.flags == 0x1f && strcmp(body, "1234567") == 0);
+
+    /* Truncated at any byte */
+    for (k = 0; k < n; k++) {
+        hdrpack_reset(&st);
+        CHECK(hdrpack_decode(&st, NULL, out, k, &h, &body) < 0);
+    }
+
+    /* Flags ORed into an encoded record */
+    m->flags = 0;
+    hdrpack_reset(&st);
+    n = hdrpack_encode(&st, NULL, m, out);
+    hdrpack_or_flags(out, KEXTLOG_FLAG_MSG_DROPPED);
+    hdrpack_reset(&st);
+    CHECK(hdrpack_decode(&st, NULL, out, n, &h, &body) == (int) n);
+    CHECK(h.flags == KEXTLOG_FLAG_MSG_DROPPED);
+}
+
+/**
+ * Slot of a tid in thread dictionary  same hash as hdrpack_encode()
+ */
+static uint32_t dict_slot(uint64_t tid)
+{
+    return (uint32_t) ((tid * 0x9e3779b97f4a7c15ull) >> 58);
+}
+
+/**
+ * Encode a record of given thread with V3  decode it back right away
+ * @return      bytes of the encoded record
+ */
+static size_t dict_roundtrip(struct hdrpack_state *est, struct hdrpack_state *dst, int32_t pid, uint64_t tid)
+{
+    static uint8_t rec[sizeof(struct kextlog_msghdr) + 4];
+    struct kextlog_msghdr *m = (struct kextlog_msghdr *) rec;
+    struct kextlog_msghdr h;
+    uint8_t out[HDRPACK_MAX + 4];
+    const char *body;
+    size_t n;
+
+    (void) memset(rec, 0, sizeof(rec));
+    m->pid = pid;
+    m->tid = tid;
+    m->seq = est->seq + 1;
+    m->size = 4;
+    (void) memcpy(m->buffer, "abc", 4);
+
+    n = hdrpack_encode(est, &enc_dict, m, out);
+    CHECK(hdrpack_decode(dst, &dec_dict, out, n, &h, &body) == (int) n);
+    CHECK(h.pid == pid && h.tid == tid && strcmp(body, "abc") == 0);
+    return n;
+}
+
+static void test_dict(void)
+{
+    static const uint8_t bad[] = {0, 4, 0, 0x80, 0x01, 0, 0, 0, 'a', 'b', 'c', 0};
+    struct hdrpack_state est, dst;
+    struct kextlog_msghdr h;
+    const char *body;
+    uint64_t tid2;
+    size_t def, ref;
+
+    hdrpack_dict_reset(&enc_dict);
+    hdrpack_dict_reset(&dec_dict);
+    hdrpack_reset(&est);
+    hdrpack_reset(&dst);
+
+    /* First record of a thread defines it  later ones refer to its slot */
+    def = dict_roundtrip(&est, &dst, 412, 0x2f1a33);
+    ref = dict_roundtrip(&est, &dst, 412, 0x2f1a33);
+    CHECK(ref < def);
+    CHECK(dec_dict.tid[dict_slot(0x2f1a33)] == 0x2f1a33 && dec_dict.pid[dict_slot(0x2f1a33)] == 412);
+
+    /* Same tid of another pid(tid reused after exec) redefines the slot */
+    CHECK(dict_roundtrip(&est, &dst, 413, 0x2f1a33) == def);
+
+    /* Threads collide on a slot  each evicts the other */
+    for (tid2 = 0x2f1a34; dict_slot(tid2) != dict_slot(0x2f1a33); tid2++) continue;
+    CHECK(dict_roundtrip(&est, &dst, 98, tid2) > ref);
+    CHECK(dict_roundtrip(&est, &dst, 413, 0x2f1a33) > ref);
+    CHECK(dict_roundtrip(&est, &dst, 98, tid2) > ref);
+
+    /* Dictionary outlives a batch */
+    hdrpack_reset(&est);
+    hdrpack_reset(&dst);
+    CHECK(dict_roundtrip(&est, &dst, 98, tid2) == ref);
+
+    /* Both ends reset after a lost batch  threads defined again */
+    hdrpack_dict_reset(&enc_dict);
+    hdrpack_dict_reset(&dec_dict);
+    CHECK(dict_roundtrip(&est, &dst, 98, tid2) > ref);
+
+    /* Slot out of dictionary  i.e. varint of HDRPACK_DICT_SIZE << 1 */
+    hdrpack_reset(&dst);
+    CHECK(hdrpack_decode(&dst, &dec_dict, bad, sizeof(bad), &h, &body) < 0);
+}
+
+/**
+ * Report bytes per message and codec cost of a wire format
+ */
+static void bench(const char *name, struct hdrpack_dict *dict, uint64_t body_bytes)
+{
+    uint64_t t0, t_enc, t_dec;
+    uint32_t i;
+
+    t0 = now_ns();
+    for (i = 0; i < BENCH_ROUNDS; i++) trace_pack(dict);
+    t_enc = now_ns() - t0;
+
+    t0 = now_ns();
+    for (i = 0; i < BENCH_ROUNDS; i++) trace_unpack(dict, 0);
+    t_dec = now_ns() - t0;
+
+    printf("%-4s %10.1f %10.1f %10.1f %10.1f\n", name,
+            (double) packed_len / NREC, (double) (packed_len - body_bytes) / NREC,
+            (double) t_enc / BENCH_ROUNDS / NREC, (double) t_dec / BENCH_ROUNDS / NREC);
+}
+
+int main(void)
+{
+    uint64_t body_bytes = 0;
+    uint32_t i;
+
+    test_edge();
+    test_dict();
+
+    trace_make();
+    trace_pack(NULL);
+    trace_unpack(NULL, 1);
+    trace_pack(&enc_dict);
+    trace_unpack(&dec_dict, 1);
+    CHECK(memcmp(&enc_dict, &dec_dict, sizeof(enc_dict)) == 0);
+
+    for (i = 0; i < NREC; i++) body_bytes += trace[i].hdr.size;
+    printf("%u records  %.1f bytes body per record  %u batches\n",
+            NREC, (double) body_bytes / NREC, nbatch);
+    printf("%-4s %10s %10s %10s %10s\n", "wire", "bytes/msg", "hdr/msg", "enc ns", "dec ns");
+    printf("%-4s %10.1f %10zu %10s %10s\n", "V1",
+            (double) body_bytes / NREC + sizeof(struct kextlog_msghdr), sizeof(struct kextlog_msghdr), "-", "-");
+    bench("V2", NULL, body_bytes);
+    bench("V3", &enc_dict, body_bytes);
+
+    return 0;
+}
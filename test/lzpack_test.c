@@ -0,0 +1,157 @@
+/*
+ * Created 200115
+ *
+ * Round-trip test of lzpack  and its compression ratio and MB/s on batches
+ *  of kauth records as kext consumer sends them
+ *
+ * Batches are V1 records(struct kextlog_msghdr followed by text) of
+ *  repetitive vnode messages  random bytes are measured for the worst case
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+
+#include "test.h"
+#include "../kext/kextlog.h"
+#include "../kext/lzpack.h"
+
+#define BENCH_BYTES     (64u << 20)     /* Input bytes compressed per measurement */
+
+static struct lzpack_ctx ctx;
+static uint8_t in[LZPACK_INPUT_MAX + 1];
+static uint8_t z[LZPACK_BOUND(LZPACK_INPUT_MAX + 1)];
+static uint8_t out[LZPACK_INPUT_MAX + 1];
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+    rnd_state = rnd_state * 1103515245u + 12345u;
+    return rnd_state >> 8;
+}
+
+static void roundtrip(size_t n)
+{
+    size_t k, t;
+
+    k = lzpack_compress(&ctx, in, n, z, sizeof(z));
+    CHECK(k != 0 && k <= LZPACK_BOUND(n));
+    CHECK(lzpack_decompress(z, k, out, n) == (int) n);
+    CHECK(memcmp(in, out, n) == 0);
+
+    /* Output one byte short */
+    if (n != 0) CHECK(lzpack_decompress(z, k, out, n - 1) < 0);
+    /* Truncated blocks never decode to the full input */
+    for (t = 0; t < k; t += 1 + t / 16) CHECK(lzpack_decompress(z, t, out, n) != (int) n);
+    /* Output capacity short of compressed size */
+    CHECK(lzpack_compress(&ctx, in, n, z, k - 1) == 0);
+}
+
+static void test_roundtrip(void)
+{
+    size_t n, i;
+
+    /* Small alphabets  every length up to a few sequences */
+    for (n = 0; n < 300; n++) {
+        for (i = 0; i < n; i++) in[i] = (uint8_t) (rnd() % 3);
+        roundtrip(n);
+    }
+
+    /* Incompressible  at most LZPACK_BOUND() */
+    for (i = 0; i < LZPACK_INPUT_MAX; i++) in[i] = (uint8_t) rnd();
+    roundtrip(LZPACK_INPUT_MAX);
+
+    /* Long runs  saturated length bytes */
+    (void) memset(in, 'a', LZPACK_INPUT_MAX);
+    roundtrip(LZPACK_INPUT_MAX);
+
+    /* Input too large */
+    CHECK(lzpack_compress(&ctx, in, LZPACK_INPUT_MAX + 1, z, sizeof(z)) == 0);
+}
+
+/**
+ * Fill a batch with V1 vnode records
+ * @return      bytes filled  at most size
+ */
+static size_t batch_make(size_t size)
+{
+    static const char *comms[] = {"mds_stores", "Safari", "fseventsd", "mdworker_shared"};
+    static const char *acts[] = {"READ_DATA", "WRITE_DATA", "READ_ATTRIBUTES", "EXECUTE"};
+    static const char *dirs[] = {
+        "/Users/someone/Library/Caches/com.apple.Safari/fsCachedData",
+        "/private/var/folders/zz/zyxvpxvq6csfxvn_n0000000000000/T",
+        "/System/Library/Frameworks/CoreServices.framework/Versions/A",
+        "/usr/lib",
+    };
+    static uint64_t ts = 123456789012ull, seq = 0;
+    struct kextlog_msghdr m;
+    char body[256];
+    size_t off = 0;
+    uint32_t t;
+    int n;
+
+    for (;;) {
+        t = rnd() % 4;
+        n = snprintf(body, sizeof(body), "vnode  act: %#x(%s) vp: %p %d %s %s/%x uid: %u pid: %d %s",
+                    1u << (rnd() % 14), acts[rnd() % 4], (void *) (uintptr_t) (0xffffff8012340000 + (rnd() & 0xfff0)),
+                    1, "VREG", dirs[rnd() % 4], rnd() & 0xffff, 501u, 400 + (int) t, comms[t]);
+        CHECK(n > 0 && n < (int) sizeof(body));
+        if (off + sizeof(m) + (size_t) n + 1 > size) break;
+
+        (void) memset(&m, 0, sizeof(m));
+        m.pid = 400 + (int32_t) t;
+        m.tid = 0x2f1a30 + t;
+        m.scope = KEXTLOG_SCOPE_VNODE;
+        m.level = KEXTLOG_LEVEL_INFO;
+        ts += rnd() % 20000;
+        m.timestamp = ts;
+        m.seq = seq++;
+        m.size = (uint32_t) n + 1;
+        m._padding = _KEXTLOG_PADDING_MAGIC;
+        (void) memcpy(in + off, &m, sizeof(m));
+        (void) memcpy(in + off + sizeof(m), body, (size_t) n + 1);
+        off += sizeof(m) + (size_t) n + 1;
+    }
+
+    return off;
+}
+
+static void bench(const char *name, size_t n)
+{
+    uint64_t t0, t_comp, t_dec;
+    uint32_t i, rounds = (uint32_t) (BENCH_BYTES / n);
+    size_t k = 0;
+
+    t0 = now_ns();
+    for (i = 0; i < rounds; i++) k = lzpack_compress(&ctx, in, n, z, sizeof(z));
+    t_comp = now_ns() - t0;
+    CHECK(k != 0);
+
+    t0 = now_ns();
+    for (i = 0; i < rounds; i++) CHECK(lzpack_decompress(z, k, out, sizeof(out)) == (int) n);
+    t_dec = now_ns() - t0;
+    CHECK(memcmp(in, out, n) == 0);
+
+    printf("%-10s %7zu %7.2f %10.1f %10.1f\n", name, n, (double) n / (double) k,
+            (double) n * rounds * 1e3 / (double) t_comp, (double) n * rounds * 1e3 / (double) t_dec);
+}
+
+int main(void)
+{
+    static const size_t sizes[] = {1024, 6144, 32768};
+    size_t i, n;
+
+    test_roundtrip();
+
+    printf("%-10s %7s %7s %10s %10s\n", "input", "bytes", "ratio", "comp MB/s", "dec MB/s");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        n = batch_make(sizes[i]);
+        roundtrip(n);
+        bench("records", n);
+    }
+    for (i = 0; i < 6144; i++) in[i] = (uint8_t) rnd();
+    bench("random", 6144);
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Created 200115
+ *
+ * Test of lock-free block pool  and alloc/free throughput of it compared
+ *  with malloc(3) for size classes of oversize log messages
+ *
+ * Every thread takes a block  touches it as log_printf() does  and frees it
+ *  measured layouts:
+ *  malloc      malloc() and free()
+ *  shared      all threads share one pool
+ *  per-cpu     each thread owns a pool(as kext does per CPU)
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../kext/mpool.h"
+
+#define MAX_THREAD      16
+#define NBLOCK          64
+#define CALLS           500000u
+
+enum { MODE_MALLOC, MODE_SHARED, MODE_PERCPU };
+
+static const uint32_t sizes[] = {256, 512, 1024, 4096};
+
+static struct mpool pools[MAX_THREAD];
+static uint64_t *pool_mem[MAX_THREAD];
+
+static volatile int go;
+
+struct worker {
+    pthread_t thread;
+    int mode;
+    uint32_t size;
+    struct mpool *mp;
+};
+
+static void test_pool(void)
+{
+    static uint64_t mem[8 * 64 / sizeof(uint64_t)];
+    struct mpool mp;
+    void *p[8];
+    int i;
+
+    CHECK(mpool_init(&mp, mem, 60, 8) != 0);
+    CHECK(mpool_init(&mp, mem, 64, 0) != 0);
+    CHECK(mpool_init(&mp, mem, 64, 8) == 0);
+
+    for (i = 0; i < 8; i++) {
+        p[i] = mpool_get(&mp);
+        CHECK(p[i] != NULL);
+        CHECK(mpool_owns(&mp, p[i]));
+        (void) memset(p[i], 0xa5, 64);
+    }
+    CHECK(mpool_get(&mp) == NULL);
+    CHECK(mp.inuse == 8 && mp.hiwat == 8);
+    CHECK(!mpool_owns(&mp, mem + sizeof(mem) / sizeof(mem[0])));
+
+    for (i = 0; i < 8; i++) mpool_put(&mp, p[i]);
+    CHECK(mp.inuse == 0 && mp.hiwat == 8);
+
+    /* LIFO reuse keeps the hottest block on top */
+    p[0] = mpool_get(&mp);
+    CHECK(p[0] == p[7]);
+    mpool_put(&mp, p[0]);
+}
+
+static void *work(void *arg)
+{
+    struct worker *w = (struct worker *) arg;
+    uint32_t i;
+    uint64_t *p;
+
+    while (!go) sched_yield();
+
+    for (i = 0; i < CALLS; i++) {
+        if (w->mode == MODE_MALLOC) {
+            p = malloc(w->size);
+            CHECK(p != NULL);
+        } else {
+            while ((p = mpool_get(w->mp)) == NULL) sched_yield();
+        }
+
+        /* Exclusive ownership  no one else may write the block meanwhile */
+        p[0] = (uint64_t) (uintptr_t) w;
+        p[w->size / sizeof(*p) - 1] = i;
+        CHECK(p[0] == (uint64_t) (uintptr_t) w);
+
+        if (w->mode == MODE_MALLOC) free(p);
+        else mpool_put(w->mp, p);
+    }
+
+    return NULL;
+}
+
+/**
+ * @return  million alloc/free pairs per second
+ */
+static double run(int mode, uint32_t size, uint32_t nthread)
+{
+    struct worker w[MAX_THREAD];
+    uint64_t t0;
+    uint32_t i;
+
+    for (i = 0; i < nthread; i++) {
+        CHECK(mpool_init(&pools[i], pool_mem[i], size, NBLOCK) == 0);
+    }
+
+    go = 0;
+    for (i = 0; i < nthread; i++) {
+        w[i].mode = mode;
+        w[i].size = size;
+        w[i].mp = &pools[mode == MODE_PERCPU ? i : 0];
+        CHECK(pthread_create(&w[i].thread, NULL, work, &w[i]) == 0);
+    }
+
+    t0 = now_ns();
+    go = 1;
+    for (i = 0; i < nthread; i++) (void) pthread_join(w[i].thread, NULL);
+    t0 = now_ns() - t0;
+
+    for (i = 0; i < nthread; i++) CHECK(pools[i].inuse == 0);
+
+    return mops((uint64_t) nthread * CALLS, t0);
+}
+
+int main(void)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t max = ncpu < 4 ? 4 : (ncpu > MAX_THREAD ? MAX_THREAD : (uint32_t) ncpu);
+    uint32_t i, n, size;
+
+    test_pool();
+
+    for (i = 0; i < MAX_THREAD; i++) {
+        pool_mem[i] = malloc((size_t) NBLOCK * sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+        CHECK(pool_mem[i] != NULL);
+    }
+
+    printf("%ld CPUs  %u alloc/free per thread  Mops/s\n", ncpu, CALLS);
+    printf("%5s %7s %10s %10s %10s\n", "size", "threads", "malloc", "shared", "per-cpu");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size = sizes[i];
+        for (n = 1; n <= max; n *= 2) {
+            printf("%5u %7u %10.2f %10.2f %10.2f\n", size, n,
+                    run(MODE_MALLOC, size, n), run(MODE_SHARED, size, n), run(MODE_PERCPU, size, n));
+        }
+    }
+
+    for (i = 0; i < MAX_THREAD; i++) free(pool_mem[i]);
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Created 200115
+ *
+ * Test of GCRA rate limiter  and its cost per call under a flood
+ *
+ * A flood never makes a call slower: suppressed calls cost one load and
+ *  one atomic add  contended ones give up after a bounded number of CAS
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../kext/ratelimit.h"
+
+#define MAX_THREAD      16
+#define FLOOD_CALLS     2000000u
+
+/* Ten messages per millisecond  burst of 50 */
+#define INTERVAL        100000u
+#define BURST           50u
+
+static void test_bucket(void)
+{
+    struct ratelimit rl = {0, 0, 0};
+    uint64_t now = 1000000000;
+    uint32_t i, n;
+
+    /* Full bucket passes a burst  then nothing */
+    for (n = 0, i = 0; i < BURST * 2; i++) n += ratelimit_check(&rl, now, INTERVAL, BURST);
+    CHECK(n == BURST);
+    CHECK(ratelimit_take_suppressed(&rl) == BURST);
+    CHECK(ratelimit_take_suppressed(&rl) == 0);
+
+    /* One token per interval */
+    CHECK(ratelimit_check(&rl, now + INTERVAL / 2, INTERVAL, BURST) == 0);
+    CHECK(ratelimit_check(&rl, now + INTERVAL, INTERVAL, BURST) == 1);
+    CHECK(ratelimit_check(&rl, now + INTERVAL, INTERVAL, BURST) == 0);
+
+    /* Idle time refills at most a burst */
+    now += INTERVAL * BURST * 100;
+    for (n = 0, i = 0; i < BURST * 2; i++) n += ratelimit_check(&rl, now, INTERVAL, BURST);
+    CHECK(n == BURST);
+    (void) ratelimit_take_suppressed(&rl);
+
+    /* Bucket just drained  then one token per interval */
+    for (n = 0, i = 0; i < 1000000; i++) n += ratelimit_check(&rl, now + i * 100, INTERVAL, BURST);
+    CHECK(n == 1000000 / (INTERVAL / 100) - 1);
+    CHECK(ratelimit_take_suppressed(&rl) == 1000000 - n);
+}
+
+static struct ratelimit flood_rl;
+static volatile int go;
+static volatile uint64_t passed;
+static volatile uint64_t cpu_ns;
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void *flood(void *arg)
+{
+    uint32_t i, n = 0;
+    uint64_t t0;
+
+    (void) arg;
+    while (!go) sched_yield();
+    t0 = thread_cpu_ns();
+    for (i = 0; i < FLOOD_CALLS; i++) n += ratelimit_check(&flood_rl, now_ns(), INTERVAL, BURST);
+    t0 = thread_cpu_ns() - t0;
+    (void) __atomic_add_fetch(&passed, n, __ATOMIC_RELAXED);
+    (void) __atomic_add_fetch(&cpu_ns, t0, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * Flood a single limiter from given number of threads
+ *  cost is CPU time per call  clock read included
+ */
+static void run(uint32_t nthread)
+{
+    pthread_t t[MAX_THREAD];
+    uint64_t t0, allowed, calls = (uint64_t) nthread * FLOOD_CALLS;
+    uint32_t i;
+
+    flood_rl.tat = 0;
+    flood_rl.suppressed = 0;
+    passed = 0;
+    cpu_ns = 0;
+    go = 0;
+    for (i = 0; i < nthread; i++) CHECK(pthread_create(&t[i], NULL, flood, NULL) == 0);
+
+    t0 = now_ns();
+    go = 1;
+    for (i = 0; i < nthread; i++) (void) pthread_join(t[i], NULL);
+    t0 = now_ns() - t0;
+
+    /* Never passes more than the rate allows */
+    allowed = BURST + t0 / INTERVAL + 1;
+    CHECK(passed <= allowed);
+    CHECK(passed + ratelimit_take_suppressed(&flood_rl) == calls);
+
+    printf("%7u %10.1f %10llu %10llu\n", nthread, (double) cpu_ns / calls,
+            (unsigned long long) passed, (unsigned long long) allowed);
+}
+
+int main(void)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t max = ncpu < 4 ? 4 : (ncpu > MAX_THREAD ? MAX_THREAD : (uint32_t) ncpu);
+    uint64_t t0;
+    uint32_t n;
+
+    test_bucket();
+
+    /* Baseline cost of reading the clock  which every call does */
+    t0 = now_ns();
+    for (n = 0; n < FLOOD_CALLS; n++) (void) now_ns();
+    printf("%ld CPUs  %u calls per thread  clock read %.1f ns\n",
+            ncpu, FLOOD_CALLS, (double) (now_ns() - t0) / FLOOD_CALLS);
+
+    printf("%7s %10s %10s %10s\n", "threads", "ns/call", "passed", "allowed");
+    for (n = 1; n <= max; n *= 2) run(n);
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Created 200115
+ *
+ * Multi-producer stress test of ringbuf
+ *
+ * Every producer writes records of varying length tagged with its id and
+ *  a sequence number  consumer checks per-producer order  length and
+ *  payload of every record it drains
+ *
+ * Two layouts are measured for 1..N producers:
+ *  shared      all producers reserve from one ring
+ *  per-cpu     each producer owns a ring(as kext does per CPU)
+ *               consumer drains them round robin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../kext/ringbuf.h"
+
+#define MAX_PROD        16
+#define RING_SIZE       16384
+#define RECORDS         500000u
+
+struct ring {
+    struct ringbuf rb;
+    uint8_t buf[RING_SIZE] __attribute__ ((aligned (CACHE_LINE_SIZE)));
+};
+
+static struct ring rings[MAX_PROD];
+static volatile int go;
+
+struct producer {
+    pthread_t thread;
+    uint32_t id;
+    struct ring *ring;
+};
+
+static inline uint32_t rec_len(uint32_t id, uint32_t seq)
+{
+    return 8 + (seq * 7 + id) % 120;
+}
+
+static void *produce(void *arg)
+{
+    struct producer *p = (struct producer *) arg;
+    uint32_t seq, len;
+    uint32_t *rec;
+
+    while (!go) sched_yield();
+
+    for (seq = 0; seq < RECORDS; seq++) {
+        len = rec_len(p->id, seq);
+        while ((rec = ringbuf_reserve(&p->ring->rb, len)) == NULL) sched_yield();
+        rec[0] = p->id;
+        rec[1] = seq;
+        (void) memset(rec + 2, (int) (seq & 0xff), len - 8);
+        ringbuf_commit(&p->ring->rb, rec);
+    }
+
+    return NULL;
+}
+
+static void verify(const uint32_t *rec, uint32_t len, uint32_t *next, uint32_t nprod)
+{
+    const uint8_t *b = (const uint8_t *) rec;
+    uint32_t id = rec[0], seq = rec[1], i;
+
+    CHECK(id < nprod);
+    CHECK(seq == next[id]);
+    CHECK(len == rec_len(id, seq));
+    for (i = 8; i < len; i++) CHECK(b[i] == (seq & 0xff));
+    next[id]++;
+}
+
+/**
+ * Run one round
+ * @nprod   number of producers
+ * @nring   number of rings  either 1 or nprod
+ * @return  throughput in million records per second
+ */
+static double run(uint32_t nprod, uint32_t nring)
+{
+    struct producer prod[MAX_PROD];
+    uint32_t next[MAX_PROD] = {0};
+    uint64_t got = 0, total = (uint64_t) nprod * RECORDS, t0;
+    uint32_t i, r = 0, len;
+    const uint32_t *rec;
+
+    for (i = 0; i < nring; i++) {
+        CHECK(ringbuf_init(&rings[i].rb, rings[i].buf, RING_SIZE) == 0);
+    }
+
+    go = 0;
+    for (i = 0; i < nprod; i++) {
+        prod[i].id = i;
+        prod[i].ring = &rings[i % nring];
+        CHECK(pthread_create(&prod[i].thread, NULL, produce, &prod[i]) == 0);
+    }
+
+    t0 = now_ns();
+    go = 1;
+
+    while (got < total) {
+        rec = ringbuf_peek(&rings[r].rb, &len);
+        if (rec == NULL) {
+            if (++r == nring) {
+                r = 0;
+                sched_yield();
+            }
+            continue;
+        }
+        verify(rec, len, next, nprod);
+        ringbuf_consume(&rings[r].rb);
+        got++;
+    }
+
+    t0 = now_ns() - t0;
+    for (i = 0; i < nprod; i++) (void) pthread_join(prod[i].thread, NULL);
+    for (i = 0; i < nring; i++) CHECK(ringbuf_used(&rings[i].rb) == 0);
+
+    return mops(total, t0);
+}
+
+static void test_edge(void)
+{
+    uint32_t len;
+    void *p;
+
+    CHECK(ringbuf_init(&rings[0].rb, rings[0].buf, 1000) != 0);
+    CHECK(ringbuf_init(&rings[0].rb, rings[0].buf, RING_SIZE) == 0);
+
+    /* A record never larger than the ring */
+    CHECK(ringbuf_reserve(&rings[0].rb, RING_SIZE) == NULL);
+    CHECK(ringbuf_reserve(&rings[0].rb, RING_SIZE - RINGBUF_HDRSZ) != NULL);
+    CHECK(ringbuf_reserve(&rings[0].rb, 1) == NULL);
+
+    /* Uncommitted record is invisible */
+    CHECK(ringbuf_init(&rings[0].rb, rings[0].buf, RING_SIZE) == 0);
+    p = ringbuf_reserve(&rings[0].rb, 100);
+    CHECK(p != NULL);
+    CHECK(ringbuf_peek(&rings[0].rb, &len) == NULL);
+
+    /* Shrunk record hands back its tail */
+    ringbuf_commit_len(&rings[0].rb, p, 10);
+    CHECK(ringbuf_peek(&rings[0].rb, &len) == p && len == 10);
+    ringbuf_consume(&rings[0].rb);
+    CHECK(ringbuf_peek(&rings[0].rb, &len) == NULL);
+    CHECK(ringbuf_used(&rings[0].rb) == 0);
+}
+
+int main(void)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t max = ncpu < 4 ? 4 : (ncpu > MAX_PROD ? MAX_PROD : (uint32_t) ncpu);
+    uint32_t n;
+
+    test_edge();
+
+    printf("%ld CPUs  %u records per producer\n", ncpu, RECORDS);
+    printf("%9s %14s %14s\n", "producers", "shared Mrec/s", "per-cpu Mrec/s");
+    for (n = 1; n <= max; n *= 2) {
+        printf("%9u %14.2f %14.2f\n", n, run(n, 1), run(n, n));
+    }
+
+    return 0;
+}
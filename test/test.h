@@ -0,0 +1,40 @@
+/*
+ * Created 200115
+ *
+ * Helpers shared by user space tests and benchmarks
+ *
+ * Includer should define _POSIX_C_SOURCE before any system header
+ *  o.w. clock_gettime() isn't visible under -std=c99
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #cond);                         \
+            exit(1);                                                    \
+        }                                                               \
+    } while (0)
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Million operations per second */
+static inline double mops(uint64_t n, uint64_t ns)
+{
+    return ns != 0 ? (double) n * 1e3 / (double) ns : 0.0;
+}
+
+#endif /* TEST_H */
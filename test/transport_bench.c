@@ -0,0 +1,208 @@
+/*
+ * Created 200115
+ *
+ * Sustained message rate of SOCK_DGRAM vs framed SOCK_STREAM transport
+ *
+ * Mirrors the kext consumer and the daemon receive loop in user space
+ *  over an AF_UNIX socketpair(kctl analog):
+ *  sender      packs records into batches  one batch per datagram
+ *               or one struct kextlog_frame per batch on a stream
+ *  receiver    reads into a buffer of the receive buffer size  walks records
+ *               frames spanning read(2) boundaries are kept for next read
+ *
+ * Every record is checked in order  so a lost or torn record fails the run
+ *  numbers show the transport cost only  kctl itself may differ on macOS
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "test.h"
+#include "../kext/kextlog.h"
+
+#define MESSAGES        500000u
+#define RECV_SIZE       65536
+#define BODY_SIZE       96
+
+static const uint32_t batch_sizes[] = {1, 8, 32, 128};
+
+struct run {
+    int fd[2];
+    int stream;
+    uint32_t batch;
+    uint64_t reads;
+};
+
+static uint32_t batch_fill(char *buf, uint32_t first, uint32_t cnt)
+{
+    struct kextlog_msghdr m;
+    uint32_t i, off = 0;
+
+    (void) memset(&m, 0, sizeof(m));
+    m.level = KEXTLOG_LEVEL_INFO;
+    m.scope = KEXTLOG_SCOPE_VNODE;
+    m.size = BODY_SIZE;
+    m._padding = _KEXTLOG_PADDING_MAGIC;
+
+    for (i = 0; i < cnt; i++) {
+        m.seq = first + i;
+        m.timestamp = first + i;
+        (void) memcpy(buf + off, &m, sizeof(m));
+        (void) memset(buf + off + sizeof(m), 'a' + (int) ((first + i) % 26), BODY_SIZE - 1);
+        buf[off + sizeof(m) + BODY_SIZE - 1] = '\0';
+        off += (uint32_t) sizeof(m) + BODY_SIZE;
+    }
+
+    return off;
+}
+
+static void send_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len != 0) {
+        n = send(fd, buf, len, 0);
+        CHECK(n > 0);
+        buf += n;
+        len -= (size_t) n;
+    }
+}
+
+static void *produce(void *arg)
+{
+    struct run *r = (struct run *) arg;
+    static char buf[sizeof(struct kextlog_frame) + RECV_SIZE];
+    struct kextlog_frame f = {KEXTLOG_FRAME_MAGIC, 0, 0, 0};
+    uint32_t i, cnt, len;
+
+    for (i = 0; i < MESSAGES; i += cnt) {
+        cnt = MESSAGES - i < r->batch ? MESSAGES - i : r->batch;
+        len = batch_fill(buf + sizeof(f), i, cnt);
+
+        if (r->stream) {
+            f.len = len;
+            f.cnt = cnt;
+            (void) memcpy(buf, &f, sizeof(f));
+            send_all(r->fd[0], buf, sizeof(f) + len);
+        } else {
+            CHECK(send(r->fd[0], buf + sizeof(f), len, 0) == (ssize_t) len);
+        }
+    }
+
+    /* Zero-length datagram or EOF marks the end */
+    if (r->stream) (void) shutdown(r->fd[0], SHUT_WR);
+    else CHECK(send(r->fd[0], "", 0, 0) == 0);
+    return NULL;
+}
+
+/**
+ * @return      number of records walked  fails on any out of order one
+ */
+static uint32_t walk(const char *p, uint32_t len, uint32_t *next)
+{
+    struct kextlog_msghdr m;
+    uint32_t off = 0, n = 0;
+
+    while (off < len) {
+        CHECK(len - off >= sizeof(m));
+        (void) memcpy(&m, p + off, sizeof(m));
+        CHECK(m._padding == _KEXTLOG_PADDING_MAGIC && m.size <= len - off - sizeof(m));
+        CHECK(m.seq == *next);
+        (*next)++;
+        off += (uint32_t) sizeof(m) + m.size;
+        n++;
+    }
+
+    return n;
+}
+
+static uint32_t receive_dgram(struct run *r)
+{
+    static char buf[RECV_SIZE];
+    uint32_t got = 0, next = 0;
+    ssize_t n;
+
+    while ((n = recv(r->fd[1], buf, sizeof(buf), 0)) > 0) {
+        r->reads++;
+        got += walk(buf, (uint32_t) n, &next);
+    }
+    CHECK(n == 0);
+
+    return got;
+}
+
+static uint32_t receive_stream(struct run *r)
+{
+    static char buf[RECV_SIZE];
+    struct kextlog_frame f;
+    uint32_t got = 0, next = 0;
+    size_t have = 0, off;
+    ssize_t n;
+
+    while ((n = read(r->fd[1], buf + have, sizeof(buf) - have)) > 0) {
+        r->reads++;
+        have += (size_t) n;
+
+        for (off = 0; have - off >= sizeof(f); off += sizeof(f) + f.len) {
+            (void) memcpy(&f, buf + off, sizeof(f));
+            CHECK(f.magic == KEXTLOG_FRAME_MAGIC && f.len <= sizeof(buf) - sizeof(f));
+            if (have - off - sizeof(f) < f.len) break;  /* Partial frame */
+            CHECK(walk(buf + off + sizeof(f), f.len, &next) == f.cnt);
+            got += f.cnt;
+        }
+
+        have -= off;
+        (void) memmove(buf, buf + off, have);
+    }
+    CHECK(n == 0 && have == 0);
+
+    return got;
+}
+
+static void run(int stream, uint32_t batch)
+{
+    struct run r;
+    pthread_t producer;
+    int size = RECV_SIZE;
+    uint64_t t0;
+
+    (void) memset(&r, 0, sizeof(r));
+    r.stream = stream;
+    r.batch = batch;
+    CHECK(socketpair(AF_UNIX, stream ? SOCK_STREAM : SOCK_DGRAM, 0, r.fd) == 0);
+    /* Receive buffer as kextlog.kctl.recvsize  see: log_kctl_register() */
+    CHECK(setsockopt(r.fd[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == 0);
+    CHECK(setsockopt(r.fd[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == 0);
+
+    t0 = now_ns();
+    CHECK(pthread_create(&producer, NULL, produce, &r) == 0);
+    CHECK((stream ? receive_stream(&r) : receive_dgram(&r)) == MESSAGES);
+    t0 = now_ns() - t0;
+    (void) pthread_join(producer, NULL);
+
+    (void) close(r.fd[0]);
+    (void) close(r.fd[1]);
+
+    printf("%-7s %6u %10.2f %12.1f\n", stream ? "STREAM" : "DGRAM", batch,
+            mops(MESSAGES, t0), (double) MESSAGES / (double) r.reads);
+}
+
+int main(void)
+{
+    uint32_t i;
+
+    printf("%ld CPUs  %u messages of %zu bytes  %d bytes buffer\n",
+            sysconf(_SC_NPROCESSORS_ONLN), MESSAGES,
+            sizeof(struct kextlog_msghdr) + BODY_SIZE, RECV_SIZE);
+    printf("%-7s %6s %10s %12s\n", "mode", "batch", "Mmsg/s", "msgs/read");
+    for (i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+        run(0, batch_sizes[i]);
+        run(1, batch_sizes[i]);
+    }
+
+    return 0;
+}